@@ -32,17 +32,17 @@ ArcEager::~ArcEager()
 void ArcEager::make_transitions()
 {
     for (size_t i = 0; i < labels.size(); ++i)
-        transitions.push_back("LR(" + labels[i] + ")"); // left reduce, only LR has ROOT label
+        add_transition("LR(" + labels[i] + ")", LEFT_REDUCE, i); // left reduce, only LR has ROOT label
     for (size_t i = 0; i < labels.size() - 1; ++i)
-        transitions.push_back("RS(" + labels[i] + ")"); // right shift
+        add_transition("RS(" + labels[i] + ")", RIGHT_SHIFT, i); // right shift
     for (size_t i = 0; i < labels.size() - 1; ++i)
-        transitions.push_back("LP(" + labels[i] + ")"); // left pass
+        add_transition("LP(" + labels[i] + ")", LEFT_PASS, i); // left pass
     for (size_t i = 0; i < labels.size() - 1; ++i)
-        transitions.push_back("RP(" + labels[i] + ")"); // right pass
+        add_transition("RP(" + labels[i] + ")", RIGHT_PASS, i); // right pass
 
-    transitions.push_back("NS"); // no shift
-    transitions.push_back("NR"); // no reduce
-    transitions.push_back("NP"); // no pass
+    no_shift = add_transition("NS", NO_SHIFT); // no shift
+    add_transition("NR", NO_REDUCE); // no reduce
+    add_transition("NP", NO_PASS); // no pass
 
     cerr << "Transition types:" << endl;
     for (size_t i = 0; i < transitions.size(); ++i)
@@ -51,42 +51,59 @@ void ArcEager::make_transitions()
 }   
 
 bool ArcEager::can_apply(Configuration& c, const string& t)
+{
+    int id = find_transition(t);
+    if (id < 0)
+        return false;
+    vector<char> mask;
+    legal_mask(c, mask);
+    return mask[id];
+}
+
+void ArcEager::legal_mask(Configuration& c, vector<char>& mask)
 {
     int n_stack = c.get_stack_size();
     int n_buffer = c.get_buffer_size();
     int w = c.get_stack(0);
     int b = c.get_buffer(0);
-    std::vector<int> head_w = c.get_head(w);
-    std::vector<int> head_b = c.get_head(b);
-    int w_head = head_w.size();
-    int b_head = head_b.size();
-    root_label = labels[labels.size() - 1];
-    /*
-    if (startswith(t, "LR") || startswith(t, "LP"))
-        return (w > 0 && b > 0 && !c.has_path_to(w, b) && !c.is_root(w) && w_head == 0);
-    else if (startswith(t, "RS") || startswith(t, "RP")){
-        string l = t.substr(3, t.length() - 4);
-        if (w == 0)
-            return (l == root_label && !c.graph.is_single_root() && b_head == 0);
-        else
-            return (l != root_label && b > 0 && w >0 && !c.has_path_to(b, w) && b_head == 0);
-    }*/
+    int w_head = c.get_head(w).size();
+    int b_head = c.get_head(b).size();
+    int root = labels.size() - 1; // label id of root_label
+
     //changed input buffer, root to the last of the buffer, swap L and R
-    if (startswith(t, "RS") || startswith(t, "RP"))
-        return (w > 0 && b > 0 && !c.has_path_to(b, w) && !c.is_root(b) && b_head == 0);
-    else if (startswith(t, "LR") || startswith(t, "LP")){
-        string l = t.substr(3, t.length() - 4);
-        if (b == 0)
-            return (l == root_label && !c.graph.is_single_root() && w_head == 0);
-        else
-            return (l != root_label && b > 0 && w >0 && !c.has_path_to(w, b) && w_head == 0);
+    bool right = (w > 0 && b > 0 && !c.has_path_to(b, w) && !c.is_root(b) && b_head == 0);
+    // LR/LP with the root label (to b = 0), and with any other label
+    bool left_root = false;
+    bool left = false;
+    if (b == 0)
+        left_root = (!c.graph.is_single_root() && w_head == 0);
+    else
+        left = (b > 0 && w > 0 && !c.has_path_to(w, b) && w_head == 0);
+
+    mask.resize(transitions.size());
+    for (size_t i = 0; i < transitions.size(); ++i)
+    {
+        switch (trans_actions[i])
+        {
+            case RIGHT_SHIFT:
+            case RIGHT_PASS:
+                mask[i] = right;
+                break;
+            case LEFT_REDUCE:
+            case LEFT_PASS:
+                mask[i] = (trans_labels[i] == root) ? left_root : left;
+                break;
+            case NO_SHIFT:
+                mask[i] = (n_buffer > 0);
+                break;
+            case NO_REDUCE: // w has head
+                mask[i] = (n_stack > 0 && w_head == 1);
+                break;
+            case NO_PASS: // can not pass root(0)
+                mask[i] = (n_stack > 1 && n_buffer > 0);
+                break;
+        }
     }
-    else if (t == "NS")
-        return (n_buffer > 0);
-    else if (t == "NR") // w has head
-        return (n_stack > 0 && w_head == 1);
-    else if (t == "NP") // can not pass root(0)
-        return (n_stack > 1 && n_buffer > 0);
 }
 
 void ArcEager::apply(Configuration& c, const string& t)
@@ -143,6 +160,59 @@ void ArcEager::apply(Configuration& c, const string& t)
     }
 }
 
+void ArcEager::apply(Configuration& c, int t)
+{
+    if (t < 0)
+        return;
+
+    int b = c.get_buffer(0);
+    int w = c.get_stack(0);
+
+    switch (trans_actions[t])
+    {
+        // Left Reduce
+        case LEFT_REDUCE:
+            c.add_arc(b, w, arc_labels[trans_labels[t]]);
+            c.reduce();
+            c.lvalency[b] += 1;
+            c.rhvalency[w] += 1;
+            break;
+        // Right Reduce
+        case RIGHT_SHIFT:
+            c.add_arc(w, b, arc_labels[trans_labels[t]]);
+            c.shift();
+            c.rvalency[w] += 1;
+            c.lhvalency[b] += 1;
+            break;
+        // Left Attach
+        case LEFT_PASS:
+            c.add_arc(b, w, arc_labels[trans_labels[t]]);
+            c.pass();
+            c.lvalency[b] += 1;
+            c.rhvalency[w] += 1;
+            break;
+        // Right Attach
+        case RIGHT_PASS:
+            c.add_arc(w, b, arc_labels[trans_labels[t]]);
+            c.pass();
+            c.rvalency[w] += 1;
+            c.lhvalency[b] += 1;
+            break;
+        // No Shift
+        case NO_SHIFT:
+            c.shift();
+            break;
+        // No Reduce
+        case NO_REDUCE:
+            c.reduce();
+            break;
+        // No Pass
+        case NO_PASS:
+            c.pass();
+            break;
+    }
+}
+
 const string ArcEager::get_oracle(
         Configuration& c,
         DependencyGraph& graph)
@@ -8,6 +8,10 @@
 class ArcEager : public ParsingSystem
 {
     public:
+        // actions of the compiled transitions (trans_actions)
+        enum { LEFT_REDUCE, RIGHT_SHIFT, LEFT_PASS, RIGHT_PASS,
+               NO_SHIFT, NO_REDUCE, NO_PASS };
+
         ArcEager() { lang = "english"; }
         explicit ArcEager(std::vector<std::string>& ldict,
                               std::string& language,
@@ -20,6 +24,10 @@ class ArcEager : public ParsingSystem
 
         void apply(Configuration& c, const std::string& t);
 
+        void legal_mask(Configuration& c, std::vector<char>& mask);
+
+        void apply(Configuration& c, int t);
+
         const std::string get_oracle(
                 Configuration& c,
                 DependencyGraph& graph);
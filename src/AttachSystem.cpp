@@ -32,16 +32,16 @@ AttachSystem::~AttachSystem()
 void AttachSystem::make_transitions()
 {
     for (size_t i = 0; i < labels.size(); ++i)
-        transitions.push_back("LR(" + labels[i] + ")"); // left reduce
+        add_transition("LR(" + labels[i] + ")", LEFT_REDUCE, i); // left reduce
     for (size_t i = 0; i < labels.size(); ++i)
-        transitions.push_back("RR(" + labels[i] + ")"); // right reduce
+        add_transition("RR(" + labels[i] + ")", RIGHT_REDUCE, i); // right reduce
     for (size_t i = 0; i < labels.size(); ++i)
-        transitions.push_back("LA(" + labels[i] + ")"); // left attach, not pop stack
+        add_transition("LA(" + labels[i] + ")", LEFT_ATTACH, i); // left attach, not pop stack
     for (size_t i = 0; i < labels.size(); ++i)
-        transitions.push_back("RA(" + labels[i] + ")"); // right attach, not pop stack
+        add_transition("RA(" + labels[i] + ")", RIGHT_ATTACH, i); // right attach, not pop stack
 
-    transitions.push_back("E"); // Exchange/Swap
-    transitions.push_back("S"); // shift
+    add_transition("E", EXCHANGE); // Exchange/Swap
+    add_transition("S", SHIFT); // shift
 
     cerr << "Transition types:" << endl;
     for (size_t i = 0; i < transitions.size(); ++i)
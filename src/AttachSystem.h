@@ -8,6 +8,10 @@
 class AttachSystem : public ParsingSystem
 {
     public:
+        // actions of the compiled transitions (trans_actions)
+        enum { LEFT_REDUCE, RIGHT_REDUCE, LEFT_ATTACH, RIGHT_ATTACH,
+               EXCHANGE, SHIFT };
+
         AttachSystem() { lang = "english"; }
         explicit AttachSystem(std::vector<std::string>& ldict,
                               std::string& language,
@@ -3,6 +3,8 @@
 
 #include <chrono>
 #include "ThreadPool.h"
+#include "Kernels.h"
+#include "Random.h"
 
 #include "fastexp.h"
 
@@ -10,7 +12,8 @@
 #include <ctime>
 #include <cmath>
 #include <cassert>
-#include <set>
+#include <cstdint>
+#include <atomic>
 
 #include <omp.h>
 
@@ -22,28 +25,82 @@ using namespace std;
 /**
  * Definition of static variables
  */
-Mat<double> NNClassifier::grad_saved;
-Mat<double> NNClassifier::saved;
-unordered_map<int, int> NNClassifier::pre_map;
+template <typename Real>
+Mat<Real> NNClassifier<Real>::grad_saved;
+template <typename Real>
+Mat<Real> NNClassifier<Real>::saved;
+template <typename Real>
+PreComputeIndex NNClassifier<Real>::pre_map;
+template <typename Real>
+atomic<uint64_t> NNClassifier<Real>::param_version(1);
+template <typename Real>
+vector<uint64_t> NNClassifier<Real>::W1_version;
+template <typename Real>
+vector<uint64_t> NNClassifier<Real>::E_version[5];
+template <typename Real>
+vector<uint64_t> NNClassifier<Real>::saved_version;
+
+template <typename Real>
+Mat<Real> NNClassifier<Real>::W1;
+template <typename Real>
+Vec<Real> NNClassifier<Real>::b1;
+template <typename Real>
+Mat<Real> NNClassifier<Real>::W2;
+
+template <typename Real>
+Mat<Real> NNClassifier<Real>::Eb;
+template <typename Real>
+Mat<Real> NNClassifier<Real>::Ed;
+template <typename Real>
+Mat<Real> NNClassifier<Real>::Ev;
+template <typename Real>
+Mat<Real> NNClassifier<Real>::Ec;
+template <typename Real>
+Mat<Real> NNClassifier<Real>::El;
+
+template <typename Real>
+Dataset NNClassifier<Real>::dataset;
 
-Mat<double> NNClassifier::W1;
-Vec<double> NNClassifier::b1;
-Mat<double> NNClassifier::W2;
 
-Mat<double> NNClassifier::Eb;
-Mat<double> NNClassifier::Ed;
-Mat<double> NNClassifier::Ev;
-Mat<double> NNClassifier::Ec;
-Mat<double> NNClassifier::El;
-
-Dataset NNClassifier::dataset;
+/**
+ * @dst = @src, except that a view (a weight block of a mapped
+ *  ModelFile) is shared rather than copied
+ */
+template <typename Real>
+static void adopt(Mat<Real> & dst, const Mat<Real> & src)
+{
+    if (src.borrowed())
+        dst.borrow(const_cast<Real *>(src[0]), src.nrows(), src.ncols());
+    else
+    {
+        if (dst.borrowed())
+            dst.dealloc();
+        dst = src;
+    }
+}
 
+template <typename Real>
+static void adopt(Vec<Real> & dst, const Vec<Real> & src)
+{
+    if (src.borrowed())
+        dst.borrow(const_cast<Real *>(&src[0]), src.size());
+    else
+    {
+        if (dst.borrowed())
+            dst.dealloc();
+        dst = src;
+    }
+}
 
-NNClassifier::NNClassifier()
+template <typename Real>
+NNClassifier<Real>::NNClassifier()
+    : ada_step(0), Eb_fixed_rows(0), emb_sq(0), emb_sq_valid(false),
+      calibrating(false), quantized(false), act_scale(0)
 {
 }
 
-NNClassifier::NNClassifier(const NNClassifier & classifier)
+template <typename Real>
+NNClassifier<Real>::NNClassifier(const NNClassifier & classifier)
 {
     config = classifier.config;
 
@@ -59,77 +116,118 @@ NNClassifier::NNClassifier(const NNClassifier & classifier)
 
     num_labels = classifier.num_labels;
     // debug = classifier.debug;
+
+    calibrating = false;
+    quantized = false;
+    act_scale = 0;
+
+    rng_seed = classifier.rng_seed;
+    dropout_round = classifier.dropout_round;
+
+    ada_step = classifier.ada_step.load();
+    for (int t = 0; t < 5; ++t)
+        l2_step[t] = classifier.l2_step[t];
+    unit_l2_step = classifier.unit_l2_step;
+    Eb_fixed_rows = classifier.Eb_fixed_rows;
+    emb_sq_valid = false;
 }
 
-NNClassifier::NNClassifier(
+template <typename Real>
+NNClassifier<Real>::NNClassifier(
         const Config& _config,
-        const Mat<double>& _Eb,
-        const Mat<double>& _Ed,
-        const Mat<double>& _Ev,
-        const Mat<double>& _Ec,
-        const Mat<double>& _El,
-        const Mat<double>& _W1,
-        const Vec<double>& _b1,
-        const Mat<double>& _W2,
+        const Mat<Real>& _Eb,
+        const Mat<Real>& _Ed,
+        const Mat<Real>& _Ev,
+        const Mat<Real>& _Ec,
+        const Mat<Real>& _El,
+        const Mat<Real>& _W1,
+        const Vec<Real>& _b1,
+        const Mat<Real>& _W2,
         const vector<int>& pre_computed_ids)
 {
     // NNClassifier(_config, Dataset(), _E, _W1, _b1, _W2, pre_computed_ids);
     config = _config;
-    Eb = _Eb;
-    Ed = _Ed;
-    Ev = _Ev;
-    Ec = _Ec;
-    El = _El;
-    W1 = _W1;
-    b1 = _b1;
-    W2 = _W2;
+    adopt(Eb, _Eb);
+    adopt(Ed, _Ed);
+    adopt(Ev, _Ev);
+    adopt(Ec, _Ec);
+    adopt(El, _El);
+    adopt(W1, _W1);
+    adopt(b1, _b1);
+    adopt(W2, _W2);
+    touch_all_params();
 
     num_labels = W2.nrows();
 
     cursor = 0;
 
+    ada_step = 0;
+    Eb_fixed_rows = 0;
+    emb_sq_valid = false;
+
+    calibrating = false;
+    quantized = false;
+    act_scale = 0;
+
+    rng_seed = Random::seed_or_clock(config.seed);
+    dropout_round = 0;
+
     // /* debug
+    pre_map.set_num_tokens(config.num_tokens);
     for (size_t i = 0; i < pre_computed_ids.size(); ++i)
     {
-        pre_map[pre_computed_ids[i]] = i;
+        pre_map.insert(pre_computed_ids[i], i);
     }
     // */
 }
 
-NNClassifier::NNClassifier(
+template <typename Real>
+NNClassifier<Real>::NNClassifier(
         const Config& _config,
         const Dataset& _dataset,
-        const Mat<double>& _Eb,
-        const Mat<double>& _Ed,
-        const Mat<double>& _Ev,
-        const Mat<double>& _Ec,
-        const Mat<double>& _El,
-        const Mat<double>& _W1,
-        const Vec<double>& _b1,
-        const Mat<double>& _W2,
+        const Mat<Real>& _Eb,
+        const Mat<Real>& _Ed,
+        const Mat<Real>& _Ev,
+        const Mat<Real>& _Ec,
+        const Mat<Real>& _El,
+        const Mat<Real>& _W1,
+        const Vec<Real>& _b1,
+        const Mat<Real>& _W2,
         const vector<int>& pre_computed_ids)
 {
     config = _config;
     dataset = _dataset;
-    Eb = _Eb;
-    Ed = _Ed;
-    Ev = _Ev;
-    Ec = _Ec;
-    El = _El;
-    W1 = _W1;
-    b1 = _b1;
-    W2 = _W2;
-
+    adopt(Eb, _Eb);
+    adopt(Ed, _Ed);
+    adopt(Ev, _Ev);
+    adopt(Ec, _Ec);
+    adopt(El, _El);
+    adopt(W1, _W1);
+    adopt(b1, _b1);
+    adopt(W2, _W2);
+    touch_all_params();
+
+    ada_step = 0;
+    Eb_fixed_rows = 0;
+    emb_sq_valid = false;
     init_gradient_histories();
 
     num_labels = W2.nrows(); // number of transitions
 
     cursor = 0;
 
+    calibrating = false;
+    quantized = false;
+    act_scale = 0;
+
+    rng_seed = Random::seed_or_clock(config.seed);
+    dropout_round = 0;
+
     // /* debug
+    pre_map.set_num_tokens(config.num_tokens);
     for (size_t i = 0; i < pre_computed_ids.size(); ++i)
     {
-        pre_map[pre_computed_ids[i]] = i;
+        pre_map.insert(pre_computed_ids[i], i);
     }
     // */
 
@@ -141,12 +239,12 @@ NNClassifier::NNClassifier(
     grad_W2.resize(W2.nrows(), W2.ncols());
     grad_E.resize(E.nrows(), E.ncols());
     */
-    grad_saved.resize(pre_map.size(), config.hidden_size);
 
     // debug = false;
 }
 
-void NNClassifier::set_dataset(
+template <typename Real>
+void NNClassifier<Real>::set_dataset(
         const Dataset & _dataset,
         const vector<int> & pre_computed_ids)
 {
@@ -159,27 +257,68 @@ void NNClassifier::set_dataset(
     cursor = 0;
 
     // /* debug
+    pre_map.set_num_tokens(config.num_tokens);
     for (size_t i = 0; i < pre_computed_ids.size(); ++i)
     {
-        pre_map[pre_computed_ids[i]] = i;
+        pre_map.insert(pre_computed_ids[i], i);
     }
     // */
 
     print_info();
+}
+
+// indices of the set bits of @mask, in increasing order
+static void mask_to_units(const vector<uint64_t> & mask, vector<int> & units)
+{
+    units.clear();
+    for (size_t w = 0; w < mask.size(); ++w)
+        for (uint64_t bits = mask[w]; bits; bits &= bits - 1)
+            units.push_back(w * 64 + __builtin_ctzll(bits));
+}
 
-    grad_saved.resize(pre_map.size(), config.hidden_size);
+template <typename Real>
+void NNClassifier<Real>::alloc_gradients(Cost<Real> & c)
+{
+    c.grad_W1.resize(W1.nrows(), W1.ncols()); c.grad_W1 = .0;
+    c.grad_b1.resize(b1.size()); c.grad_b1 = .0;
+    c.grad_W2.resize(W2.nrows(), W2.ncols()); c.grad_W2 = .0;
+    c.grad_Eb.resize(Eb.nrows(), Eb.ncols());
+    c.grad_Ed.resize(Ed.nrows(), Ed.ncols());
+    c.grad_Ev.resize(Ev.nrows(), Ev.ncols());
+    c.grad_Ec.resize(Ec.nrows(), Ec.ncols());
+    c.grad_El.resize(El.nrows(), El.ncols());
+}
+
+template <typename Real>
+Cost<Real> NNClassifier<Real>::thread_proc(
+        size_t begin,
+        size_t end,
+        size_t batch_size,
+        Mat<Real> * saved_grad)
+{
+    Cost<Real> c;
+    alloc_gradients(c);
+    thread_proc(begin, end, batch_size, saved_grad, c, NULL);
+    return c;
 }
 
-Cost NNClassifier::thread_proc(vector<Sample> & chunk, size_t batch_size)
+template <typename Real>
+void NNClassifier<Real>::thread_proc(
+        size_t begin,
+        size_t end,
+        size_t batch_size,
+        Mat<Real> * saved_grad,
+        Cost<Real> & c,
+        vector<uint64_t> * touched)
 {
-    Mat<double> grad_W1(0.0, W1.nrows(), W1.ncols());
-    Vec<double> grad_b1(0.0, b1.size());
-    Mat<double> grad_W2(0.0, W2.nrows(), W2.ncols());
-    Mat<double> grad_Eb(0.0, Eb.nrows(), Eb.ncols());
-    Mat<double> grad_Ed(0.0, Ed.nrows(), Ed.ncols());
-    Mat<double> grad_Ev(0.0, Ev.nrows(), Ev.ncols());
-    Mat<double> grad_Ec(0.0, Ec.nrows(), Ec.ncols());
-    Mat<double> grad_El(0.0, El.nrows(), El.ncols());
+    Mat<Real> & grad_W1 = c.grad_W1;
+    Vec<Real> & grad_b1 = c.grad_b1;
+    Mat<Real> & grad_W2 = c.grad_W2;
+    SparseRows<Real> & grad_Eb = c.grad_Eb;
+    SparseRows<Real> & grad_Ed = c.grad_Ed;
+    SparseRows<Real> & grad_Ev = c.grad_Ev;
+    SparseRows<Real> & grad_Ec = c.grad_Ec;
+    SparseRows<Real> & grad_El = c.grad_El;
 
     /*
     cerr << "W1.size = " << W1.nrows() << ", " << W1.ncols() << endl;
@@ -196,22 +335,27 @@ Cost NNClassifier::thread_proc(vector<Sample> & chunk, size_t batch_size)
     double loss = 0.0;
     int correct = 0;
 
-    vector<vector<int>> dropout_histories;
+    vector<vector<int>> & dropout_histories = c.dropout_histories;
 
-    for (size_t i = 0; i < chunk.size(); ++i)
+    vector<uint64_t> drop_mask;
+    vector<int> active_units;
+    for (size_t i = begin; i < end; ++i)
     {
-        vector<int>& features = chunk[i].get_feature();
+        vector<int>& features = samples[i]->get_feature();
 
-        vector<int>& label = chunk[i].get_label();
+        vector<int>& label = samples[i]->get_label();
 
         // feed forward the neural net
-        Vec<double> scores(0.0, num_labels);
-        Vec<double> hidden(0.0, config.hidden_size);
-        Vec<double> hidden3(0.0, config.hidden_size);
+        Vec<Real> scores(0.0, num_labels);
+        Vec<Real> hidden(0.0, config.hidden_size);
+        Vec<Real> hidden3(0.0, config.hidden_size);
 
         // Run dropout: randomly dropout some hidden units
-        vector<int> active_units;
-        dropout(config.hidden_size, config.dropout_prob, active_units);
+        dropout(i, drop_mask);
+        mask_to_units(drop_mask, active_units);
+        if (touched)
+            for (size_t w = 0; w < drop_mask.size(); ++w)
+                (*touched)[w] |= drop_mask[w];
 
         if (config.debug)
             dropout_histories.push_back(active_units);
@@ -222,9 +366,6 @@ Cost NNClassifier::thread_proc(vector<Sample> & chunk, size_t batch_size)
         {
             int tok = features[j]; // feature ID
             int E_index = tok;
-            // feature index in @pre_map.keys()
-            // considering position in input layer
-            int index = tok * config.num_tokens + j;
             int feat_type = config.get_feat_type(j);
 
             assert (feat_type != Config::NONEXIST);
@@ -240,11 +381,11 @@ Cost NNClassifier::thread_proc(vector<Sample> & chunk, size_t batch_size)
             int emb_size = config.get_embedding_size(feat_type);
             // embedding size for current token
 
+            // row in @saved, considering position in input layer
+            int id = saved_grad ? pre_map.find(j, tok) : -1;
             // /* debug
-            if (pre_map.find(index) != pre_map.end())
+            if (id >= 0)
             {
-                int id = pre_map[index];
-
                 for (size_t k = 0; k < active_units.size(); ++k)
                 {
                     int node_index = active_units[k]; // active hidden unit
@@ -344,7 +485,7 @@ Cost NNClassifier::thread_proc(vector<Sample> & chunk, size_t batch_size)
         double sum1 = .0;
         double sum2 = .0;
         double max_score = scores[opt_label];
-        Vec<double> tmp = scores;
+        Vec<Real> tmp = scores;
         for (int j = 0; j < num_labels; ++j)
         {
             if (label[j] >= 0)
@@ -387,7 +528,7 @@ Cost NNClassifier::thread_proc(vector<Sample> & chunk, size_t batch_size)
         // here, we only consider the situation where only one unit
         // in the output layer is activated.
         // NB: in Danqi's implementation, she consider all possible decisions
-        Vec<double> grad_hidden3(0.0, config.hidden_size);
+        Vec<Real> grad_hidden3(0.0, config.hidden_size);
         // double delta = -(1 - scores[label] / sum2) / config.batch_size;
 
         for (int i = 0; i < num_labels; ++i)
@@ -404,7 +545,7 @@ Cost NNClassifier::thread_proc(vector<Sample> & chunk, size_t batch_size)
             }
         }
 
-        Vec<double> grad_hidden(0.0, config.hidden_size);
+        Vec<Real> grad_hidden(0.0, config.hidden_size);
         // #pragma omp parallel for
         for (size_t j = 0; j < active_units.size(); ++j)
         {
@@ -421,7 +562,6 @@ Cost NNClassifier::thread_proc(vector<Sample> & chunk, size_t batch_size)
         {
             int tok = features[j];
             int E_index = tok;
-            int index = tok * config.num_tokens + j;
             int feat_type = config.get_feat_type(j);
 
             assert (feat_type != Config::NONEXIST);
@@ -435,59 +575,37 @@ Cost NNClassifier::thread_proc(vector<Sample> & chunk, size_t batch_size)
                 E_index -= Eb.nrows() + Ed.nrows() + Ev.nrows() + Ec.nrows();
 
             int emb_size = config.get_embedding_size(feat_type);
+            int id = saved_grad ? pre_map.find(j, tok) : -1;
             // /* debug
-            if (pre_map.find(index) != pre_map.end())
+            if (id >= 0)
             {
-                int id = pre_map[index];
                 for (size_t k = 0; k < active_units.size(); ++k)
                 {
                     int node_index = active_units[k];
-                    grad_saved[id][node_index] += grad_hidden[node_index];
+                    (*saved_grad)[saved_slot[id]][node_index] += grad_hidden[node_index];
                 }
             }
-            else
+            else if (feat_type != Config::CONST_FEAT)
             {
             // */
+                const Real * E_row = get_embedding_row(feat_type, tok);
+                SparseRows<Real> & grad_E =
+                    (feat_type == Config::BASIC_FEAT)   ? grad_Eb :
+                    (feat_type == Config::DIST_FEAT)    ? grad_Ed :
+                    (feat_type == Config::VALENCY_FEAT) ? grad_Ev :
+                    (feat_type == Config::CLUSTER_FEAT) ? grad_Ec :
+                                                          grad_El;
+                Real * grad_E_row = grad_E.row(E_index);
+
                 for (size_t k = 0; k < active_units.size(); ++k)
                 {
                     int node_index = active_units[k];
                     for (int l = 0; l < emb_size; ++l)
                     {
-                        if (feat_type == Config::BASIC_FEAT)
-                        {
-                            grad_W1[node_index][offset+l] +=
-                                grad_hidden[node_index] * Eb[E_index][l];
-                            grad_Eb[E_index][l] +=
-                                grad_hidden[node_index] * W1[node_index][offset+l];
-                        }
-                        else if (feat_type == Config::DIST_FEAT)
-                        {
-                            grad_W1[node_index][offset+l] +=
-                                grad_hidden[node_index] * Ed[E_index][l];
-                            grad_Ed[E_index][l] +=
-                                grad_hidden[node_index] * W1[node_index][offset+l];
-                        }
-                        else if (feat_type == Config::VALENCY_FEAT)
-                        {
-                            grad_W1[node_index][offset+l] +=
-                                grad_hidden[node_index] * Ev[E_index][l];
-                            grad_Ev[E_index][l] +=
-                                grad_hidden[node_index] * W1[node_index][offset+l];
-                        }
-                        else if (feat_type == Config::CLUSTER_FEAT)
-                        {
-                            grad_W1[node_index][offset+l] +=
-                                grad_hidden[node_index] * Ec[E_index][l];
-                            grad_Ec[E_index][l] +=
-                                grad_hidden[node_index] * W1[node_index][offset+l];
-                        }
-                        else if (feat_type == Config::LENGTH_FEAT)
-                        {
-                            grad_W1[node_index][offset+l] +=
-                                grad_hidden[node_index] * El[E_index][l];
-                            grad_El[E_index][l] +=
-                                grad_hidden[node_index] * W1[node_index][offset+l];
-                        }
+                        grad_W1[node_index][offset+l] +=
+                            grad_hidden[node_index] * E_row[l];
+                        grad_E_row[l] +=
+                            grad_hidden[node_index] * W1[node_index][offset+l];
                     }
                 }
             }
@@ -496,10 +614,318 @@ Cost NNClassifier::thread_proc(vector<Sample> & chunk, size_t batch_size)
     }
 
     // cerr << "Thread loss = " << loss << endl;
+    c.loss = loss / batch_size;
+    c.percent_correct = (double)correct / batch_size;
+
+    /*
+    cerr << "grad_W2: " << grad_W2.nrows() << " * " << grad_W2.ncols() << endl
+         << "grad_W1: " << grad_W1.nrows() << " * " << grad_W1.ncols() << endl
+         << "grad_Eb: " << grad_Eb.nrows() << " * " << grad_Eb.ncols() << endl
+         << "grad_Ed: " << grad_Ed.nrows() << " * " << grad_Ed.ncols() << endl
+         << "grad_Ev: " << grad_Ev.nrows() << " * " << grad_Ev.ncols() << endl
+         << "grad_Ec: " << grad_Ec.nrows() << " * " << grad_Ec.ncols() << endl;
+    */
+}
+
+/**
+ * samples per block in thread_proc_batch(...), small enough
+ *  for the block buffers to stay in cache
+ */
+static const int TRAIN_BLOCK = 256;
+
+template <typename Real>
+Cost<Real> NNClassifier<Real>::thread_proc_batch(
+        size_t begin,
+        size_t end,
+        size_t batch_size,
+        Mat<Real> * saved_grad)
+{
+    const int H = config.hidden_size;
+    const int L = num_labels;
+
+    Mat<Real> grad_W1(0.0, W1.nrows(), W1.ncols());
+    Mat<Real> grad_W1T(0.0, W1.ncols(), W1.nrows());
+    Vec<Real> grad_b1(0.0, b1.size());
+    Mat<Real> grad_W2(0.0, W2.nrows(), W2.ncols());
+    SparseRows<Real> grad_Eb(Eb.nrows(), Eb.ncols());
+    SparseRows<Real> grad_Ed(Ed.nrows(), Ed.ncols());
+    SparseRows<Real> grad_Ev(Ev.nrows(), Ev.ncols());
+    SparseRows<Real> grad_Ec(Ec.nrows(), Ec.ncols());
+    SparseRows<Real> grad_El(El.nrows(), El.ncols());
+
+    double loss = 0.0;
+    int correct = 0;
+
+    vector<vector<int>> dropout_histories;
+
+    int max_emb_size = 0;
+    for (int j = 0; j < config.num_tokens; ++j)
+        max_emb_size = max(max_emb_size,
+                config.get_embedding_size(config.get_feat_type(j)));
+
+    /**
+     * block buffers, one row per sample (the ..T ones are
+     *  transposed: one column per sample)
+     */
+    Mat<Real> hidden(TRAIN_BLOCK, H);   // pre-activation, with b1
+    Mat<Real> hidden3(TRAIN_BLOCK, H);  // masked cube
+    Mat<Real> mask(TRAIN_BLOCK, H);     // dropout
+    Mat<Real> scores(TRAIN_BLOCK, L);
+    Mat<Real> delta(TRAIN_BLOCK, L);    // d loss / d scores
+    Mat<Real> grad_hidden(TRAIN_BLOCK, H);
+    Mat<Real> deltaT(L, TRAIN_BLOCK);
+    Mat<Real> embT(max_emb_size, TRAIN_BLOCK);
+    Mat<Real> grad_emb(TRAIN_BLOCK, max_emb_size);
+
+    vector<const Real *> a_rows;
+    vector<const Real *> b_rows;
+    vector<Real *> c_rows;
+    vector< vector<int> > emb_samples(config.num_tokens);
+    vector< pair<int, int> > saved_samples; // (sample, row of @saved_grad)
+    vector<uint64_t> drop_mask;
+    vector<int> active_units;
+
+    for (size_t s0 = begin; s0 < end; s0 += TRAIN_BLOCK)
+    {
+        int nb = min((size_t)TRAIN_BLOCK, end - s0);
+
+        for (int b = 0; b < nb; ++b)
+        {
+            dropout(s0 + b, drop_mask);
+            if (config.debug)
+            {
+                mask_to_units(drop_mask, active_units);
+                dropout_histories.push_back(active_units);
+            }
+
+            for (int k = 0; k < H; ++k)
+            {
+                mask[b][k] = (drop_mask[k >> 6] >> (k & 63)) & 1;
+                hidden[b][k] = 0.0;
+            }
+        }
+
+        /**
+         * hidden layer, token position by token position: the
+         *  pre-computed features are added from @saved, the others
+         *  form one gemm with the W1 columns of the position
+         */
+        saved_samples.clear();
+        int offset = 0;
+        for (int j = 0; j < config.num_tokens; ++j)
+        {
+            int feat_type = config.get_feat_type(j);
+            int emb_size = config.get_embedding_size(feat_type);
+            assert (feat_type != Config::NONEXIST);
+
+            emb_samples[j].clear();
+            a_rows.clear();
+            c_rows.clear();
+            for (int b = 0; b < nb; ++b)
+            {
+                int tok = samples[s0 + b]->get_feature()[j];
+                int id = saved_grad ? pre_map.find(j, tok) : -1;
+                if (id >= 0)
+                {
+                    Kernels::add(hidden[b], saved[id], H);
+                    saved_samples.push_back(make_pair(b, saved_slot[id]));
+                }
+                else if (feat_type != Config::CONST_FEAT)
+                {
+                    emb_samples[j].push_back(b);
+                    a_rows.push_back(get_embedding_row(feat_type, tok));
+                    c_rows.push_back(hidden[b]);
+                }
+            }
+
+            b_rows.clear();
+            for (int l = 0; l < emb_size; ++l)
+                b_rows.push_back(W1T[offset + l]);
+            if (!a_rows.empty())
+                Kernels::gemm_nn(&a_rows[0],
+                        &b_rows[0],
+                        &c_rows[0],
+                        a_rows.size(),
+                        H,
+                        emb_size);
+            offset += emb_size;
+        }
+
+        // add bias term, cube activation (clipped), dropout
+        for (int b = 0; b < nb; ++b)
+            for (int k = 0; k < H; ++k)
+            {
+                Real h = hidden[b][k] + b1[k];
+                Real h3 = h * h * h;
+                if (h3 > 50) h3 = 50;
+                if (h3 < -50) h3 = -50;
+                hidden[b][k] = h;
+                hidden3[b][k] = mask[b][k] * h3;
+            }
+
+        // softmax layer
+        a_rows.clear();
+        c_rows.clear();
+        for (int b = 0; b < nb; ++b)
+        {
+            for (int i = 0; i < L; ++i)
+                scores[b][i] = 0.0;
+            a_rows.push_back(hidden3[b]);
+            c_rows.push_back(scores[b]);
+        }
+        Kernels::gemm(&a_rows[0], W2[0], W2.ncols(), &c_rows[0], nb, L, H);
+
+        for (int b = 0; b < nb; ++b)
+        {
+            vector<int>& label = samples[s0 + b]->get_label();
+            Real * s = scores[b];
+
+            int opt_label = -1;
+            for (int i = 0; i < L; ++i)
+                if (label[i] >= 0)
+                    if (opt_label < 0 || s[i] > s[opt_label])
+                        opt_label = i;
+
+            double sum1 = .0;
+            double sum2 = .0;
+            double max_score = s[opt_label];
+            for (int i = 0; i < L; ++i)
+            {
+                if (label[i] >= 0)
+                {
+                    s[i] = exp(s[i] - max_score);
+                    if (label[i] == 1) sum1 += s[i];
+                    sum2 += s[i];
+                }
+            }
+
+            loss += (log(sum2) - log(sum1));
+            if (label[opt_label] == 1)
+                correct += 1;
+
+            for (int i = 0; i < L; ++i)
+                delta[b][i] = (label[i] >= 0)
+                    ? -(label[i] - s[i] / sum2) / batch_size
+                    : 0.0;
+        }
+
+        // grad_W2 += delta^T * hidden3
+        b_rows.clear();
+        for (int b = 0; b < nb; ++b)
+        {
+            for (int i = 0; i < L; ++i)
+                deltaT[i][b] = delta[b][i];
+            b_rows.push_back(hidden3[b]);
+        }
+        a_rows.clear();
+        c_rows.clear();
+        for (int i = 0; i < L; ++i)
+        {
+            a_rows.push_back(deltaT[i]);
+            c_rows.push_back(grad_W2[i]);
+        }
+        Kernels::gemm_nn(&a_rows[0], &b_rows[0], &c_rows[0], L, H, nb);
+
+        // grad_hidden3 = delta * W2, then through the cube and the mask
+        a_rows.clear();
+        b_rows.clear();
+        c_rows.clear();
+        for (int b = 0; b < nb; ++b)
+        {
+            for (int k = 0; k < H; ++k)
+                grad_hidden[b][k] = 0.0;
+            a_rows.push_back(delta[b]);
+            c_rows.push_back(grad_hidden[b]);
+        }
+        for (int i = 0; i < L; ++i)
+            b_rows.push_back(W2[i]);
+        Kernels::gemm_nn(&a_rows[0], &b_rows[0], &c_rows[0], nb, H, L);
+
+        for (int b = 0; b < nb; ++b)
+            for (int k = 0; k < H; ++k)
+            {
+                grad_hidden[b][k] *= 3 * hidden[b][k] * hidden[b][k] * mask[b][k];
+                grad_b1[k] += grad_hidden[b][k];
+            }
+
+        for (size_t i = 0; i < saved_samples.size(); ++i)
+            Kernels::add((*saved_grad)[saved_samples[i].second],
+                    grad_hidden[saved_samples[i].first],
+                    H);
+
+        /**
+         * W1 and embeddings, token position by token position:
+         *  grad_W1T[offset..] += E^T * grad_hidden
+         *  grad_E             += grad_hidden * W1[:, offset..]
+         */
+        offset = 0;
+        for (int j = 0; j < config.num_tokens; ++j)
+        {
+            int feat_type = config.get_feat_type(j);
+            int emb_size = config.get_embedding_size(feat_type);
+            vector<int> & sb = emb_samples[j];
+            int nj = sb.size();
+            if (nj == 0)
+            {
+                offset += emb_size;
+                continue;
+            }
+
+            b_rows.clear();
+            for (int t = 0; t < nj; ++t)
+            {
+                int tok = samples[s0 + sb[t]]->get_feature()[j];
+                const Real * e = get_embedding_row(feat_type, tok);
+                for (int l = 0; l < emb_size; ++l)
+                    embT[l][t] = e[l];
+                b_rows.push_back(grad_hidden[sb[t]]);
+            }
+
+            a_rows.clear();
+            c_rows.clear();
+            for (int l = 0; l < emb_size; ++l)
+            {
+                a_rows.push_back(embT[l]);
+                c_rows.push_back(grad_W1T[offset + l]);
+            }
+            Kernels::gemm_nn(&a_rows[0], &b_rows[0], &c_rows[0], emb_size, H, nj);
+
+            a_rows.clear();
+            c_rows.clear();
+            for (int t = 0; t < nj; ++t)
+            {
+                for (int l = 0; l < emb_size; ++l)
+                    grad_emb[t][l] = 0.0;
+                a_rows.push_back(grad_hidden[sb[t]]);
+                c_rows.push_back(grad_emb[t]);
+            }
+            Kernels::gemm(&a_rows[0], W1T[offset], H, &c_rows[0], nj, emb_size, H);
+
+            SparseRows<Real> & grad_E =
+                (feat_type == Config::BASIC_FEAT)   ? grad_Eb :
+                (feat_type == Config::DIST_FEAT)    ? grad_Ed :
+                (feat_type == Config::VALENCY_FEAT) ? grad_Ev :
+                (feat_type == Config::CLUSTER_FEAT) ? grad_Ec :
+                                                      grad_El;
+            for (int t = 0; t < nj; ++t)
+            {
+                int tok = samples[s0 + sb[t]]->get_feature()[j];
+                Kernels::add(grad_E.row(get_embedding_index(feat_type, tok)),
+                        grad_emb[t],
+                        emb_size);
+            }
+            offset += emb_size;
+        }
+    }
+
+    for (int k = 0; k < grad_W1.nrows(); ++k)
+        for (int l = 0; l < grad_W1.ncols(); ++l)
+            grad_W1[k][l] = grad_W1T[l][k];
+
     loss /= batch_size;
     double accuracy = (double)correct / batch_size;
 
-    Cost cost(loss,
+    return Cost<Real>(loss,
                 accuracy,
                 grad_W1,
                 grad_b1,
@@ -510,20 +936,10 @@ Cost NNClassifier::thread_proc(vector<Sample> & chunk, size_t batch_size)
                 grad_Ec,
                 grad_El,
                 dropout_histories);
-
-    /*
-    cerr << "grad_W2: " << grad_W2.nrows() << " * " << grad_W2.ncols() << endl
-         << "grad_W1: " << grad_W1.nrows() << " * " << grad_W1.ncols() << endl
-         << "grad_Eb: " << grad_Eb.nrows() << " * " << grad_Eb.ncols() << endl
-         << "grad_Ed: " << grad_Ed.nrows() << " * " << grad_Ed.ncols() << endl
-         << "grad_Ev: " << grad_Ev.nrows() << " * " << grad_Ev.ncols() << endl
-         << "grad_Ec: " << grad_Ec.nrows() << " * " << grad_Ec.ncols() << endl;
-    */
-
-    return cost;
 }
 
-void NNClassifier::compute_cost_function()
+template <typename Real>
+void NNClassifier<Real>::compute_cost_function()
 {
     /*
     for (int i = 0; i < W1.nrows(); ++i)
@@ -551,26 +967,14 @@ void NNClassifier::compute_cost_function()
             dataset.samples,
             config.batch_size);
     */
-    Util::get_minibatch(
-            dataset.samples,
-            samples,
-            config.batch_size,
-            cursor);
-    cursor += samples.size();
-    if (cursor >= dataset.n)
-        cursor = cursor - dataset.n; // equals to cursor % dataset.n
+    next_minibatch();
 
     cerr << "Sample " << samples.size() << " samples for training" << endl;
 
     // should be smaller than number of CPU cores.
     int num_chunks = config.training_threads;
-    vector<vector<Sample>> chunks;
-    Util::partition_into_chunks(samples, chunks, num_chunks);
-
-    /*
-    for (size_t i = 0; i < chunks.size(); ++i)
-        cerr << "Chunk " << i << " = " << chunks[i].size() << endl;
-    */
+    if (!workers)
+        workers = make_shared<ThreadPool>(num_chunks);
 
     /**
      * determine the feature IDs which need to be pre-computed
@@ -585,19 +989,50 @@ void NNClassifier::compute_cost_function()
     pre_compute(feature_ids_to_pre_compute);
     // */
 
-    for (int i = 0; i < grad_saved.nrows(); ++i)
-        for (int j = 0; j < grad_saved.ncols(); ++j)
-            grad_saved[i][j] = 0.0;
+    int n_saved = feature_ids_to_pre_compute.size();
+    if (saved_slot.size() != (size_t)pre_map.size())
+        saved_slot.assign(pre_map.size(), -1);
+    for (int k = 0; k < n_saved; ++k)
+        saved_slot[pre_map.find(feature_ids_to_pre_compute[k])] = k;
+    grad_saved.resize(n_saved, config.hidden_size);
 
-    // cerr << "build thread pool..." << endl;
-    ThreadPool pool(num_chunks);
-    vector<future<Cost>> results;
+    /**
+     * Chunk i covers samples[begin, end), sized as
+     *  Util::partition_into_chunks would, and accumulates the
+     *  gradients of pre-computed units in grad_saved_parts[i],
+     *  which has the rows of @grad_saved only.
+     */
+    grad_saved_parts.resize(num_chunks);
+    if (config.batched_training)
+    {
+        W1T.resize(W1.ncols(), W1.nrows());
+        for (int i = 0; i < W1.nrows(); ++i)
+            for (int j = 0; j < W1.ncols(); ++j)
+                W1T[j][i] = W1[i][j];
+    }
+    vector<future<Cost<Real> > > results;
+    size_t chunk_size = samples.size() / num_chunks;
+    size_t remainder = samples.size() % num_chunks;
+    size_t begin = 0;
     for (int i = 0; i < num_chunks; ++i)
     {
-        results.emplace_back(pool.enqueue(&NNClassifier::thread_proc, *this, chunks[i], samples.size()));
-        // results.emplace_back(pool.enqueue(&NNClassifier::thread_func, *this, chunks[i], samples.size()));
+        size_t end = begin + chunk_size + ((size_t)i < remainder ? 1 : 0);
+        size_t n = samples.size();
+        Mat<Real> * part = &grad_saved_parts[i];
+        bool batched = config.batched_training;
+        results.emplace_back(workers->enqueue(
+                    [this, begin, end, n, part, batched]()
+                    {
+                        part->resize(grad_saved.nrows(), grad_saved.ncols());
+                        for (int k = 0; k < part->nrows(); ++k)
+                            for (int l = 0; l < part->ncols(); ++l)
+                                (*part)[k][l] = 0.0;
+                        if (batched)
+                            return thread_proc_batch(begin, end, n, part);
+                        return thread_proc(begin, end, n, part);
+                    }));
+        begin = end;
     }
-    // cerr << "all threads built" << endl;
 
     // Merge
     cost.init();
@@ -609,6 +1044,21 @@ void NNClassifier::compute_cost_function()
             cost.merge(results[i].get(), config.debug);
     }
 
+    // grad_saved = sum of the parts, rows split among threads
+    #pragma omp parallel for
+    for (int k = 0; k < n_saved; ++k)
+    {
+        for (int l = 0; l < grad_saved.ncols(); ++l)
+        {
+            Real sum = 0.0;
+            for (int i = 0; i < num_chunks; ++i)
+                sum += grad_saved_parts[i][k][l];
+            grad_saved[k][l] = sum;
+        }
+    }
+    for (int k = 0; k < n_saved; ++k)
+        saved_slot[pre_map.find(feature_ids_to_pre_compute[k])] = -1;
+
     // cost = 0.0;
     // int correct = 0;
 
@@ -626,190 +1076,217 @@ void NNClassifier::compute_cost_function()
     add_l2_regularization(cost);
 }
 
-void NNClassifier::back_prop_saved(Cost& cost, vector<int> & features_seen)
+template <typename Real>
+void NNClassifier<Real>::next_minibatch()
 {
-    // #pragma omp parallel for
-    for (size_t i = 0; i < features_seen.size(); ++i)
+    /**
+     * The mini-batch wraps around the end of the dataset;
+     *  only pointers into @dataset are taken.
+     */
+    samples.clear();
+    ++dropout_round; // fresh dropout streams
+    int batch_size = min(config.batch_size, dataset.n);
+    for (int i = 0; i < batch_size; ++i)
+        samples.push_back(&dataset.samples[(cursor + i) % dataset.n]);
+    cursor += samples.size();
+    if (cursor >= dataset.n)
+        cursor = cursor - dataset.n; // equals to cursor % dataset.n
+}
+
+template <typename Real>
+void NNClassifier<Real>::train_hogwild(int E_start_pos)
+{
+    next_minibatch();
+
+    int num_threads = config.training_threads;
+    if (!workers)
+        workers = make_shared<ThreadPool>(num_threads);
+
+    /**
+     * Each worker repeatedly claims the next slice of the
+     *  mini-batch, back-propagates it and updates the shared
+     *  weights (and AdaGrad histories) in place. Returns the
+     *  summed loss and number of correct samples.
+     */
+    /**
+     * The gradients go to a buffer of the worker, kept across
+     *  calls; the step reads and resets only the entries of the
+     *  hidden units active in the slice (and the embedding rows
+     *  touched), so a slice costs no sweep of W1 or W2.
+     */
+    hogwild_parts.resize(num_threads);
+    for (int i = 0; i < num_threads; ++i)
+        if (hogwild_parts[i].grad_W1.nrows() != W1.nrows()
+                || hogwild_parts[i].grad_W1.ncols() != W1.ncols())
+            alloc_gradients(hogwild_parts[i]);
+    if (unit_l2_step.size() != (size_t)W1.nrows())
+        unit_l2_step.assign(W1.nrows(), ada_step);
+
+    size_t step = max(1, config.hogwild_batch_size);
+    atomic<size_t> next(0);
+    vector<future<pair<double, double> > > results;
+    for (int i = 0; i < num_threads; ++i)
     {
-        // cerr << "cost.grad_Eb[0][0]" << cost.grad_Eb[0][0] << endl;
+        Cost<Real> * part = &hogwild_parts[i];
+        results.emplace_back(workers->enqueue(
+                    [this, &next, step, E_start_pos, part]()
+                    {
+                        double loss = 0.0;
+                        double correct = 0.0;
+                        vector<uint64_t> touched;
+                        vector<int> units;
+                        for (;;)
+                        {
+                            size_t begin = next.fetch_add(step);
+                            if (begin >= samples.size())
+                                break;
+                            size_t end = min(begin + step, samples.size());
+
+                            Cost<Real> & c = *part;
+                            touched.assign((config.hidden_size + 63) / 64, 0);
+                            thread_proc(begin, end, end - begin, NULL, c, &touched);
+                            mask_to_units(touched, units);
+                            apply_ada_gradient(c, E_start_pos, &units);
+                            c.dropout_histories.clear();
+
+                            loss += c.loss * (end - begin);
+                            correct += c.percent_correct * (end - begin);
+                        }
+                        return make_pair(loss, correct);
+                    }));
+    }
 
-        int map_x = pre_map[features_seen[i]];
+    cost.init();
+    for (int i = 0; i < num_threads; ++i)
+    {
+        pair<double, double> r = results[i].get();
+        cost.loss += r.first;
+        cost.percent_correct += r.second;
+    }
+    cost.loss /= samples.size();
+    cost.percent_correct /= samples.size();
+}
 
-        int tok = features_seen[i] / config.num_tokens;
-        // int offset = (features_seen[i] % config.num_tokens) * config.embedding_size;
-        int pos = features_seen[i] % config.num_tokens;
+template <typename Real>
+void NNClassifier<Real>::back_prop_saved(Cost<Real>& cost, vector<int> & features_seen)
+{
+    /**
+     * Features at the same position share a block of W1 columns,
+     *  so positions are split among threads: grad_W1 is written
+     *  without conflicts. Embedding rows may be shared across
+     *  positions, hence they go to per-thread buffers first.
+     */
+    vector< vector<int> > by_pos(config.num_tokens); // indices in @features_seen
+    for (size_t i = 0; i < features_seen.size(); ++i)
+        by_pos[features_seen[i] % config.num_tokens].push_back(i);
+
+    int num_threads = omp_get_max_threads();
+    vector< Cost<Real> > parts(num_threads);
+    for (int t = 0; t < num_threads; ++t)
+    {
+        parts[t].grad_Eb.resize(Eb.nrows(), Eb.ncols());
+        parts[t].grad_Ed.resize(Ed.nrows(), Ed.ncols());
+        parts[t].grad_Ev.resize(Ev.nrows(), Ev.ncols());
+        parts[t].grad_Ec.resize(Ec.nrows(), Ec.ncols());
+        parts[t].grad_El.resize(El.nrows(), El.ncols());
+    }
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int pos = 0; pos < config.num_tokens; ++pos)
+    {
         int feat_type = config.get_feat_type(pos);
+        assert (feat_type != Config::NONEXIST);
+        if (feat_type == Config::CONST_FEAT)
+            continue;
+
         int offset = config.get_offset(pos);
         int emb_size = config.get_embedding_size(feat_type);
+        SparseRows<Real> & grad_E = parts[omp_get_thread_num()].grad_E(feat_type);
 
-        int E_index = tok;
-        assert (feat_type != Config::NONEXIST);
-        if (feat_type == Config::DIST_FEAT)
-            E_index -= Eb.nrows();
-        else if (feat_type == Config::VALENCY_FEAT)
-            E_index -= Eb.nrows() + Ed.nrows();
-        else if (feat_type == Config::CLUSTER_FEAT)
-            E_index -= Eb.nrows() + Ed.nrows() + Ev.nrows();
-        else if (feat_type == Config::LENGTH_FEAT)
-            E_index -= Eb.nrows() + Ed.nrows() + Ev.nrows() + Ec.nrows();
-
-        for (int j = 0; j < config.hidden_size; ++j)
+        for (size_t i = 0; i < by_pos[pos].size(); ++i)
         {
-            double delta = grad_saved[map_x][j];
-            if (feat_type == Config::BASIC_FEAT)
-                for (int k = 0; k < emb_size; ++k)
-                {
-                    cost.grad_W1[j][offset + k] += delta * Eb[E_index][k];
-                    cost.grad_Eb[E_index][k] += delta * W1[j][offset + k];
-                }
-            else if (feat_type == Config::DIST_FEAT)
-                for (int k = 0; k < emb_size; ++k)
-                {
-                    cost.grad_W1[j][offset + k] += delta * Ed[E_index][k];
-                    cost.grad_Ed[E_index][k] += delta * W1[j][offset + k];
-                }
-            else if (feat_type == Config::VALENCY_FEAT)
-                for (int k = 0; k < emb_size; ++k)
-                {
-                    cost.grad_W1[j][offset + k] += delta * Ev[E_index][k];
-                    cost.grad_Ev[E_index][k] += delta * W1[j][offset + k];
-                }
-            else if (feat_type == Config::CLUSTER_FEAT)
-                for (int k = 0; k < emb_size; ++k)
-                {
-                    cost.grad_W1[j][offset + k] += delta * Ec[E_index][k];
-                    cost.grad_Ec[E_index][k] += delta * W1[j][offset + k];
-                }
-            else if (feat_type == Config::LENGTH_FEAT)
+            int k_saved = by_pos[pos][i]; // row of @grad_saved
+            int tok = features_seen[k_saved] / config.num_tokens;
+
+            const Real * E_row = get_embedding_row(feat_type, tok);
+            Real * grad_E_row = grad_E.row(get_embedding_index(feat_type, tok));
+            for (int j = 0; j < config.hidden_size; ++j)
+            {
+                double delta = grad_saved[k_saved][j];
                 for (int k = 0; k < emb_size; ++k)
                 {
-                    cost.grad_W1[j][offset + k] += delta * El[E_index][k];
-                    cost.grad_El[E_index][k] += delta * W1[j][offset + k];
+                    cost.grad_W1[j][offset + k] += delta * E_row[k];
+                    grad_E_row[k] += delta * W1[j][offset + k];
                 }
+            }
         }
     }
+
+    for (int t = 0; t < num_threads; ++t)
+    {
+        cost.grad_Eb.merge(parts[t].grad_Eb);
+        cost.grad_Ed.merge(parts[t].grad_Ed);
+        cost.grad_Ev.merge(parts[t].grad_Ev);
+        cost.grad_Ec.merge(parts[t].grad_Ec);
+        cost.grad_El.merge(parts[t].grad_El);
+    }
 }
 
-void NNClassifier::add_l2_regularization(Cost& cost)
+template <typename Real>
+void NNClassifier<Real>::add_l2_regularization(Cost<Real>& cost)
 {
-    // cerr << "regularize W1" << endl;
+    double sq = 0.0;
+    #pragma omp parallel for reduction(+:sq)
     for (int i = 0; i < W1.nrows(); ++i)
-    {
         for (int j = 0; j < W1.ncols(); ++j)
-        {
-            cost.loss += config.reg_parameter
-                        * W1[i][j]
-                        * W1[i][j]
-                        / 2.0;
-            cost.grad_W1[i][j] += config.reg_parameter
-                        * W1[i][j];
-        }
-    }
+            sq += W1[i][j] * W1[i][j];
 
     // whether regularize the bias term b1?
-    // cerr << "regularize b1" << endl;
     for (int i = 0; i < b1.size(); ++i)
-    {
-        cost.loss += config.reg_parameter * b1[i] * b1[i] / 2.0;
-        cost.grad_b1[i] += config.reg_parameter * b1[i];
-    }
+        sq += b1[i] * b1[i];
 
-    // cerr << "regularize W2" << endl;
     for (int i = 0; i < W2.nrows(); ++i)
-    {
         for (int j = 0; j < W2.ncols(); ++j)
-        {
-            cost.loss += config.reg_parameter
-                        * W2[i][j]
-                        * W2[i][j]
-                        / 2.0;
-            // cerr << "W2[i][j]=" << W2[i][j] << " (" << i << "," << j << ")" << endl;
-            // cerr << "cost.grad_W2[i][j]=" << cost.grad_W2[i][j] << " (" << i << "," << j << ")" << endl;
-            cost.grad_W2[i][j] += config.reg_parameter * W2[i][j];
-        }
-    }
+            sq += W2[i][j] * W2[i][j];
 
-    // cerr << "regularize Eb" << endl;
-    for (int i = 0; i < Eb.nrows(); ++i)
-    {
-        for (int j = 0; j < Eb.ncols(); ++j)
-        {
-            cost.loss += config.reg_parameter
-                        * Eb[i][j]
-                        * Eb[i][j]
-                        / 2.0;
-            cost.grad_Eb[i][j] += config.reg_parameter
-                        * Eb[i][j];
-        }
-    }
-
-    // cerr << "regularize Ed" << endl;
-    for (int i = 0; i < Ed.nrows(); ++i)
-    {
-        for (int j = 0; j < Ed.ncols(); ++j)
-        {
-            cost.loss += config.reg_parameter
-                        * Ed[i][j]
-                        * Ed[i][j]
-                        / 2.0;
-            cost.grad_Ed[i][j] += config.reg_parameter
-                        * Ed[i][j];
-        }
-    }
-    // cerr << "regularize Ev" << endl;
-    for (int i = 0; i < Ev.nrows(); ++i)
-    {
-        for (int j = 0; j < Ev.ncols(); ++j)
-        {
-            cost.loss += config.reg_parameter
-                        * Ev[i][j]
-                        * Ev[i][j]
-                        / 2.0;
-            cost.grad_Ev[i][j] += config.reg_parameter
-                        * Ev[i][j];
-        }
-    }
-    // cerr << "regularize Ec" << endl;
-    for (int i = 0; i < Ec.nrows(); ++i)
-    {
-        for (int j = 0; j < Ec.ncols(); ++j)
-        {
-            cost.loss += config.reg_parameter
-                        * Ec[i][j]
-                        * Ec[i][j]
-                        / 2.0;
-            cost.grad_Ec[i][j] += config.reg_parameter
-                        * Ec[i][j];
-        }
-    }
-    // cerr << "regularize El" << endl;
-    for (int i = 0; i < El.nrows(); ++i)
+    /**
+     * Embeddings: swept once, then kept up to date by the
+     *  AdaGrad step, which only changes the touched rows.
+     *  (The L2 decay still pending on untouched rows is left out.)
+     */
+    if (!emb_sq_valid)
     {
-        for (int j = 0; j < El.ncols(); ++j)
+        Mat<Real> * E[] = {&Eb, &Ed, &Ev, &Ec, &El};
+        double e_sq = 0.0;
+        for (int t = 0; t < 5; ++t)
         {
-            cost.loss += config.reg_parameter
-                        * El[i][j]
-                        * El[i][j]
-                        / 2.0;
-            cost.grad_El[i][j] += config.reg_parameter
-                        * El[i][j];
+            Mat<Real> & emb = *E[t];
+            #pragma omp parallel for reduction(+:e_sq)
+            for (int i = 0; i < emb.nrows(); ++i)
+                for (int j = 0; j < emb.ncols(); ++j)
+                    e_sq += emb[i][j] * emb[i][j];
         }
+        emb_sq = e_sq;
+        emb_sq_valid = true;
     }
 
+    cost.loss += config.reg_parameter * (sq + emb_sq) / 2.0;
 }
 
-void NNClassifier::dropout(int size, double prob, vector<int>& active_units)
+template <typename Real>
+void NNClassifier<Real>::dropout(size_t i, vector<uint64_t> & mask)
 {
-    active_units.clear();
-    for (int i = 0; i < size; ++i)
-    {
-        // if (rand() % 10 / 10 > prob)
-        if (Util::rand_double() > prob)
-            active_units.push_back(i);
-    }
+    mask.resize((config.hidden_size + 63) / 64);
+    Kernels::bernoulli_mask(
+            Random::stream_key(rng_seed, dropout_round, i),
+            Random::threshold(config.dropout_prob),
+            &mask[0],
+            config.hidden_size);
 }
 
-void NNClassifier::check_gradient()
+
+template <typename Real>
+void NNClassifier<Real>::check_gradient()
 {
     /**
      * check gradients computed by @compute_cost_function
@@ -826,14 +1303,34 @@ void NNClassifier::check_gradient()
     // first step: randomly sample a mini-batch
     compute_cost_function(); // set cost and gradient
 
-    Mat<double> num_grad_W1(0.0, cost.grad_W1.nrows(), cost.grad_W1.ncols());
-    Mat<double> num_grad_W2(0.0, cost.grad_W2.nrows(), cost.grad_W2.ncols());
-    Vec<double> num_grad_b1(0.0, cost.grad_b1.size());
-    Mat<double> num_grad_Eb(0.0, cost.grad_Eb.nrows(), cost.grad_Eb.ncols());
-    Mat<double> num_grad_Ed(0.0, cost.grad_Ed.nrows(), cost.grad_Ed.ncols());
-    Mat<double> num_grad_Ev(0.0, cost.grad_Ev.nrows(), cost.grad_Ev.ncols());
-    Mat<double> num_grad_Ec(0.0, cost.grad_Ec.nrows(), cost.grad_Ec.ncols());
-    Mat<double> num_grad_El(0.0, cost.grad_El.nrows(), cost.grad_El.ncols());
+    // the L2 gradient is left to the AdaGrad step, add it here
+    for (int i = 0; i < W1.nrows(); ++i)
+        for (int j = 0; j < W1.ncols(); ++j)
+            cost.grad_W1[i][j] += config.reg_parameter * W1[i][j];
+    for (int i = 0; i < b1.size(); ++i)
+        cost.grad_b1[i] += config.reg_parameter * b1[i];
+    for (int i = 0; i < W2.nrows(); ++i)
+        for (int j = 0; j < W2.ncols(); ++j)
+            cost.grad_W2[i][j] += config.reg_parameter * W2[i][j];
+    Mat<Real> * E[] = {&Eb, &Ed, &Ev, &Ec, &El};
+    SparseRows<Real> * grad_E[] = {&cost.grad_Eb, &cost.grad_Ed,
+            &cost.grad_Ev, &cost.grad_Ec, &cost.grad_El};
+    for (int t = 0; t < 5; ++t)
+        for (int i = 0; i < E[t]->nrows(); ++i)
+        {
+            Real * g = grad_E[t]->row(i);
+            for (int j = 0; j < E[t]->ncols(); ++j)
+                g[j] += config.reg_parameter * (*E[t])[i][j];
+        }
+
+    Mat<Real> num_grad_W1(0.0, cost.grad_W1.nrows(), cost.grad_W1.ncols());
+    Mat<Real> num_grad_W2(0.0, cost.grad_W2.nrows(), cost.grad_W2.ncols());
+    Vec<Real> num_grad_b1(0.0, cost.grad_b1.size());
+    Mat<Real> num_grad_Eb(0.0, cost.grad_Eb.nrows(), cost.grad_Eb.ncols());
+    Mat<Real> num_grad_Ed(0.0, cost.grad_Ed.nrows(), cost.grad_Ed.ncols());
+    Mat<Real> num_grad_Ev(0.0, cost.grad_Ev.nrows(), cost.grad_Ev.ncols());
+    Mat<Real> num_grad_Ec(0.0, cost.grad_Ec.nrows(), cost.grad_Ec.ncols());
+    Mat<Real> num_grad_El(0.0, cost.grad_El.nrows(), cost.grad_El.ncols());
 
     // second step: compute numerical gradients
     compute_numerical_gradients(
@@ -845,6 +1342,7 @@ void NNClassifier::check_gradient()
             num_grad_Ev,
             num_grad_Ec,
             num_grad_El);
+    touch_all_params(); // perturbed and restored, up to rounding
 
     // second step: compute the diff between two gradients
     // norm(numgrad-grad) / norm(numgrad+grad) should be small
@@ -875,11 +1373,11 @@ void NNClassifier::check_gradient()
     double diff_grad_W1 = Util::l2_norm(Util::mat_subtract(num_grad_W1, cost.grad_W1)) / Util::l2_norm(Util::mat_add(num_grad_W1, cost.grad_W1));
     double diff_grad_b1 = Util::l2_norm(Util::vec_subtract(num_grad_b1, cost.grad_b1)) / Util::l2_norm(Util::vec_add(num_grad_b1, cost.grad_b1));
     double diff_grad_W2 = Util::l2_norm(Util::mat_subtract(num_grad_W2, cost.grad_W2)) / Util::l2_norm(Util::mat_add(num_grad_W2, cost.grad_W2));
-    double diff_grad_Eb = Util::l2_norm(Util::mat_subtract(num_grad_Eb, cost.grad_Eb)) / Util::l2_norm(Util::mat_add(num_grad_Eb, cost.grad_Eb));
-    double diff_grad_Ed = Util::l2_norm(Util::mat_subtract(num_grad_Ed, cost.grad_Ed)) / Util::l2_norm(Util::mat_add(num_grad_Ed, cost.grad_Ed));
-    double diff_grad_Ev = Util::l2_norm(Util::mat_subtract(num_grad_Ev, cost.grad_Ev)) / Util::l2_norm(Util::mat_add(num_grad_Ev, cost.grad_Ev));
-    double diff_grad_Ec = Util::l2_norm(Util::mat_subtract(num_grad_Ec, cost.grad_Ec)) / Util::l2_norm(Util::mat_add(num_grad_Ec, cost.grad_Ec));
-    double diff_grad_El = Util::l2_norm(Util::mat_subtract(num_grad_El, cost.grad_El)) / Util::l2_norm(Util::mat_add(num_grad_El, cost.grad_El));
+    double diff_grad_Eb = Util::l2_norm(Util::mat_subtract(num_grad_Eb, cost.grad_Eb.to_mat())) / Util::l2_norm(Util::mat_add(num_grad_Eb, cost.grad_Eb.to_mat()));
+    double diff_grad_Ed = Util::l2_norm(Util::mat_subtract(num_grad_Ed, cost.grad_Ed.to_mat())) / Util::l2_norm(Util::mat_add(num_grad_Ed, cost.grad_Ed.to_mat()));
+    double diff_grad_Ev = Util::l2_norm(Util::mat_subtract(num_grad_Ev, cost.grad_Ev.to_mat())) / Util::l2_norm(Util::mat_add(num_grad_Ev, cost.grad_Ev.to_mat()));
+    double diff_grad_Ec = Util::l2_norm(Util::mat_subtract(num_grad_Ec, cost.grad_Ec.to_mat())) / Util::l2_norm(Util::mat_add(num_grad_Ec, cost.grad_Ec.to_mat()));
+    double diff_grad_El = Util::l2_norm(Util::mat_subtract(num_grad_El, cost.grad_El.to_mat())) / Util::l2_norm(Util::mat_add(num_grad_El, cost.grad_El.to_mat()));
 
     /*
     for (int i = 0; i < num_grad_W2.nrows(); ++i)
@@ -900,15 +1398,16 @@ void NNClassifier::check_gradient()
     cerr << "diff(El) = " << diff_grad_El << endl;
 }
 
-void NNClassifier::compute_numerical_gradients(
-        Mat<double> & num_grad_W1,
-        Vec<double> & num_grad_b1,
-        Mat<double> & num_grad_W2,
-        Mat<double> & num_grad_Eb,
-        Mat<double> & num_grad_Ed,
-        Mat<double> & num_grad_Ev,
-        Mat<double> & num_grad_Ec,
-        Mat<double> & num_grad_El)
+template <typename Real>
+void NNClassifier<Real>::compute_numerical_gradients(
+        Mat<Real> & num_grad_W1,
+        Vec<Real> & num_grad_b1,
+        Mat<Real> & num_grad_W2,
+        Mat<Real> & num_grad_Eb,
+        Mat<Real> & num_grad_Ed,
+        Mat<Real> & num_grad_Ev,
+        Mat<Real> & num_grad_Ec,
+        Mat<Real> & num_grad_El)
 {
     if (samples.size() == 0)
     {
@@ -1016,7 +1515,8 @@ void NNClassifier::compute_numerical_gradients(
 }
 
 // for gradient checking. Single threading
-double NNClassifier::compute_cost()
+template <typename Real>
+double NNClassifier<Real>::compute_cost()
 {
     // make use of samples / dropout_histories
 
@@ -1026,13 +1526,13 @@ double NNClassifier::compute_cost()
     // cerr << "dropout_history.size=" << cost.dropout_histories.size() << endl;
     for (size_t i = 0; i < samples.size(); ++i)
     {
-        vector<int> features = samples[i].get_feature();
-        vector<int> label = samples[i].get_label();
+        vector<int> features = samples[i]->get_feature();
+        vector<int> label = samples[i]->get_label();
 
         vector<int> active_units = cost.dropout_histories[i];
-        Vec<double> scores(0.0, num_labels);
-        Vec<double> hidden(0.0, config.hidden_size);
-        Vec<double> hidden3(0.0, config.hidden_size);
+        Vec<Real> scores(0.0, num_labels);
+        Vec<Real> hidden(0.0, config.hidden_size);
+        Vec<Real> hidden3(0.0, config.hidden_size);
 
         // feed-forward to hidden layer
         int offset = 0;
@@ -1203,103 +1703,266 @@ double NNClassifier::compute_cost()
     return v_cost;
 }
 
-void NNClassifier::take_ada_gradient_step(int E_start_pos)
+template <typename Real>
+void NNClassifier<Real>::take_ada_gradient_step(int E_start_pos)
 {
-    for (int i = 0; i < W1.nrows(); ++i)
+    apply_ada_gradient(cost, E_start_pos);
+}
+
+/**
+ * g = grad + reg * w, then the AdaGrad update of @w with @g
+ */
+template <typename Real>
+static inline void ada_update(
+        Real * w,
+        const Real * grad,
+        double * eg2,
+        int n,
+        double reg,
+        double alpha,
+        double eps)
+{
+    for (int j = 0; j < n; ++j)
     {
-        for (int j = 0; j < W1.ncols(); ++j)
-        {
-            eg2W1[i][j] += cost.grad_W1[i][j] * cost.grad_W1[i][j];
-            W1[i][j] -= config.ada_alpha * cost.grad_W1[i][j] /
-                    sqrt(eg2W1[i][j] + config.ada_eps);
-        }
+        double g = grad[j] + reg * w[j];
+        eg2[j] += g * g;
+        w[j] -= alpha * g / sqrt(eg2[j] + eps);
     }
+}
 
-    for (int i = 0; i < b1.size(); ++i)
+/**
+ * @k AdaGrad steps on @w with the L2 gradient alone:
+ *  w *= (1 - x)^k, x = alpha * reg / sqrt(eg2 + eps), taking @eg2
+ *  as constant ((reg * w)^2 is negligible next to it). k * x is
+ *  tiny in practice, where two terms of the binomial series do.
+ */
+template <typename Real>
+static inline void l2_decay(
+        Real * w,
+        const double * eg2,
+        int n,
+        int k,
+        double reg,
+        double alpha,
+        double eps)
+{
+    if (k <= 0 || reg == 0)
+        return;
+    for (int j = 0; j < n; ++j)
     {
-        eg2b1[i] += cost.grad_b1[i] * cost.grad_b1[i];
-        b1[i] -= config.ada_alpha * cost.grad_b1[i] /
-                    sqrt(eg2b1[i] + config.ada_eps);
+        double x = alpha * reg / sqrt(eg2[j] + eps);
+        if (k * x < 1e-3)
+            w[j] *= 1 - k * x + 0.5 * k * (k - 1.0) * x * x;
+        else
+            w[j] *= pow(1 - x, k);
     }
+}
 
-    for (int i = 0; i < W2.nrows(); ++i)
+template <typename Real>
+static inline double sum_sq(const Real * w, int n)
+{
+    double s = 0.0;
+    for (int j = 0; j < n; ++j)
+        s += w[j] * w[j];
+    return s;
+}
+
+template <typename Real>
+void NNClassifier<Real>::apply_ada_gradient(
+        Cost<Real>& cost,
+        int E_start_pos,
+        const vector<int> * units)
+{
+    const double reg = config.reg_parameter;
+    const double alpha = config.ada_alpha;
+    const double eps = config.ada_eps;
+    // Hogwild workers are already one per core
+    const bool par = !config.hogwild;
+    const int step = ++ada_step;
+    const uint64_t version = ++param_version;
+
+    // a hidden unit's row of W1 spans every position's columns
+    for (size_t pos = 0; pos < W1_version.size(); ++pos)
+        W1_version[pos] = version;
+
+    if (units == NULL)
     {
-        for (int j = 0; j < W2.ncols(); ++j)
-        {
-            eg2W2[i][j] += cost.grad_W2[i][j] * cost.grad_W2[i][j];
-            W2[i][j] -= config.ada_alpha * cost.grad_W2[i][j] /
-                    sqrt(eg2W2[i][j] + config.ada_eps);
-        }
-    }
+        #pragma omp parallel for if (par)
+        for (int i = 0; i < W1.nrows(); ++i)
+            ada_update(W1[i], cost.grad_W1[i], eg2W1[i], W1.ncols(), reg, alpha, eps);
 
-    for (int i = 0; i < Eb.nrows(); ++i)
+        ada_update(&b1[0], &cost.grad_b1[0], &eg2b1[0], b1.size(), reg, alpha, eps);
+
+        #pragma omp parallel for if (par)
+        for (int i = 0; i < W2.nrows(); ++i)
+            ada_update(W2[i], cost.grad_W2[i], eg2W2[i], W2.ncols(), reg, alpha, eps);
+
+        unit_l2_step.assign(W1.nrows(), step);
+    }
+    else
     {
-        if (config.fix_word_embeddings && i < E_start_pos)
-            continue;
-        for (int j = 0; j < Eb.ncols(); ++j)
+        /**
+         * the row of W1, the entry of b1 and the column of W2 of
+         *  each unit, first catching up with the L2 decay of the
+         *  steps since it was last active; its gradient entries
+         *  are reset for @cost to be reused
+         */
+        for (size_t u = 0; u < units->size(); ++u)
         {
-            eg2Eb[i][j] += cost.grad_Eb[i][j] * cost.grad_Eb[i][j];
-            Eb[i][j] -= config.ada_alpha * cost.grad_Eb[i][j] /
-                    sqrt(eg2Eb[i][j] + config.ada_eps);
+            int k = (*units)[u];
+            int missed = step - 1 - unit_l2_step[k];
+
+            Real * g = cost.grad_W1[k];
+            l2_decay(W1[k], eg2W1[k], W1.ncols(), missed, reg, alpha, eps);
+            ada_update(W1[k], g, eg2W1[k], W1.ncols(), reg, alpha, eps);
+            for (int j = 0; j < W1.ncols(); ++j)
+                g[j] = 0.0;
+
+            l2_decay(&b1[k], &eg2b1[k], 1, missed, reg, alpha, eps);
+            ada_update(&b1[k], &cost.grad_b1[k], &eg2b1[k], 1, reg, alpha, eps);
+            cost.grad_b1[k] = 0.0;
+
+            for (int i = 0; i < W2.nrows(); ++i)
+            {
+                l2_decay(&W2[i][k], &eg2W2[i][k], 1, missed, reg, alpha, eps);
+                ada_update(&W2[i][k], &cost.grad_W2[i][k], &eg2W2[i][k], 1, reg, alpha, eps);
+                cost.grad_W2[i][k] = 0.0;
+            }
+            unit_l2_step[k] = step;
         }
     }
 
-    for (int i = 0; i < Ed.nrows(); ++i)
+    /**
+     * embeddings: touched rows only, each first catching up with
+     *  the L2 decay of the steps since it was last updated
+     */
+    if (config.fix_word_embeddings)
+        Eb_fixed_rows = E_start_pos;
+    Mat<Real> * E[] = {&Eb, &Ed, &Ev, &Ec, &El};
+    Mat<double> * eg2E[] = {&eg2Eb, &eg2Ed, &eg2Ev, &eg2Ec, &eg2El};
+    SparseRows<Real> * grad_E[] = {&cost.grad_Eb, &cost.grad_Ed,
+            &cost.grad_Ev, &cost.grad_Ec, &cost.grad_El};
+    double d_sq = 0.0;
+    for (int t = 0; t < 5; ++t)
     {
-        for (int j = 0; j < Ed.ncols(); ++j)
+        SparseRows<Real> & gE = *grad_E[t];
+        int n = E[t]->ncols();
+        #pragma omp parallel for if (par) reduction(+:d_sq)
+        for (int k = 0; k < (int)gE.size(); ++k)
         {
-            eg2Ed[i][j] += cost.grad_Ed[i][j] * cost.grad_Ed[i][j];
-            Ed[i][j] -= config.ada_alpha * cost.grad_Ed[i][j] /
-                    sqrt(eg2Ed[i][j] + config.ada_eps);
+            int i = gE.row_id(k);
+            if (t == 0 && i < Eb_fixed_rows)
+                continue;
+
+            Real * e = (*E[t])[i];
+            double * eg2 = (*eg2E[t])[i];
+            double before = sum_sq(e, n);
+            l2_decay(e, eg2, n, step - 1 - l2_step[t][i], reg, alpha, eps);
+            ada_update(e, gE.row_at(k), eg2, n, reg, alpha, eps);
+            l2_step[t][i] = step;
+            E_version[t][i] = version;
+            d_sq += sum_sq(e, n) - before;
         }
     }
+    // concurrent Hogwild steps
+    #pragma omp atomic
+    emb_sq += d_sq;
 
-    for (int i = 0; i < Ev.nrows(); ++i)
+    if (units != NULL)
+        for (int t = 0; t < 5; ++t)
+            grad_E[t]->clear();
+}
+
+template <typename Real>
+void NNClassifier<Real>::apply_pending_l2()
+{
+    const int step = ada_step;
+    const uint64_t version = ++param_version;
+    Mat<Real> * E[] = {&Eb, &Ed, &Ev, &Ec, &El};
+    Mat<double> * eg2E[] = {&eg2Eb, &eg2Ed, &eg2Ev, &eg2Ec, &eg2El};
+    int num_decayed = 0;
+    for (int t = 0; t < 5; ++t)
     {
-        for (int j = 0; j < Ev.ncols(); ++j)
+        Mat<Real> & emb = *E[t];
+        if (l2_step[t].size() != (size_t)emb.nrows()
+                || eg2E[t]->nrows() != emb.nrows())
         {
-            eg2Ev[i][j] += cost.grad_Ev[i][j] * cost.grad_Ev[i][j];
-            Ev[i][j] -= config.ada_alpha * cost.grad_Ev[i][j] /
-                    sqrt(eg2Ev[i][j] + config.ada_eps);
+            // no steps taken on this table yet
+            l2_step[t].assign(emb.nrows(), step);
+            continue;
         }
-    }
 
-    for (int i = 0; i < Ec.nrows(); ++i)
-    {
-        for (int j = 0; j < Ec.ncols(); ++j)
+        #pragma omp parallel for reduction(+:num_decayed)
+        for (int i = 0; i < emb.nrows(); ++i)
         {
-            eg2Ec[i][j] += cost.grad_Ec[i][j] * cost.grad_Ec[i][j];
-            Ec[i][j] -= config.ada_alpha * cost.grad_Ec[i][j] /
-                    sqrt(eg2Ec[i][j] + config.ada_eps);
+            int k = step - l2_step[t][i];
+            if (k > 0 && !(t == 0 && i < Eb_fixed_rows))
+            {
+                l2_decay(emb[i], (*eg2E[t])[i], emb.ncols(), k,
+                        config.reg_parameter,
+                        config.ada_alpha,
+                        config.ada_eps);
+                if (config.reg_parameter != 0)
+                    E_version[t][i] = version;
+                ++num_decayed;
+            }
+            l2_step[t][i] = step;
         }
     }
 
-    for (int i = 0; i < El.nrows(); ++i)
+    if (num_decayed > 0 && config.reg_parameter != 0)
+        emb_sq_valid = false;
+
+    // hidden units left out of Hogwild steps: W1 row, b1, W2 column
+    if (unit_l2_step.size() != (size_t)W1.nrows()
+            || eg2W1.nrows() != W1.nrows())
     {
-        for (int j = 0; j < El.ncols(); ++j)
-        {
-            eg2El[i][j] += cost.grad_El[i][j] * cost.grad_El[i][j];
-            El[i][j] -= config.ada_alpha * cost.grad_El[i][j] /
-                    sqrt(eg2El[i][j] + config.ada_eps);
-        }
+        unit_l2_step.assign(W1.nrows(), step);
+        return;
+    }
+    int num_units = 0;
+    for (int k = 0; k < W1.nrows(); ++k)
+    {
+        int missed = step - unit_l2_step[k];
+        unit_l2_step[k] = step;
+        if (missed <= 0)
+            continue;
+        l2_decay(W1[k], eg2W1[k], W1.ncols(), missed,
+                config.reg_parameter, config.ada_alpha, config.ada_eps);
+        l2_decay(&b1[k], &eg2b1[k], 1, missed,
+                config.reg_parameter, config.ada_alpha, config.ada_eps);
+        for (int i = 0; i < W2.nrows(); ++i)
+            l2_decay(&W2[i][k], &eg2W2[i][k], 1, missed,
+                    config.reg_parameter, config.ada_alpha, config.ada_eps);
+        ++num_units;
     }
+    if (num_units > 0 && config.reg_parameter != 0)
+        for (size_t pos = 0; pos < W1_version.size(); ++pos)
+            W1_version[pos] = version;
 }
 
-vector<int> NNClassifier::get_pre_computed_ids(
-        vector<Sample>& samples)
+template <typename Real>
+vector<int> NNClassifier<Real>::get_pre_computed_ids(
+        vector<Sample*>& samples)
 {
-    set<int> feature_ids;
+    // one bit per row of @saved, ids in order of first occurrence
+    vector<uint64_t> seen((pre_map.size() + 63) / 64, 0);
+    vector<int> feature_ids;
 
     for (size_t i = 0; i < samples.size(); ++i)
     {
-        vector<int> feats = samples[i].get_feature();
+        vector<int>& feats = samples[i]->get_feature();
         assert(feats.size() == (unsigned int)config.num_tokens);
         for (size_t j = 0; j < feats.size(); ++j)
         {
-            int tok = feats[j];
-            int index = tok * config.num_tokens + j;
-            if (pre_map.find(index) != pre_map.end())
-                feature_ids.insert(index);
+            int map_x = pre_map.find(j, feats[j]);
+            if (map_x < 0)
+                continue;
+            uint64_t bit = 1ULL << (map_x & 63);
+            if (seen[map_x >> 6] & bit)
+                continue;
+            seen[map_x >> 6] |= bit;
+            feature_ids.push_back(feats[j] * config.num_tokens + j);
         }
     }
 
@@ -1310,213 +1973,582 @@ vector<int> NNClassifier::get_pre_computed_ids(
          << "%"
          << endl;
 
-    return vector<int>(feature_ids.begin(), feature_ids.end());
+    return feature_ids;
 }
 
-double NNClassifier::get_loss()
+template <typename Real>
+double NNClassifier<Real>::get_loss()
 {
     return cost.loss;
 }
 
-double NNClassifier::get_accuracy()
+template <typename Real>
+double NNClassifier<Real>::get_accuracy()
 {
     return cost.percent_correct;
 }
 
-Mat<double>& NNClassifier::get_W1()
+template <typename Real>
+Mat<Real>& NNClassifier<Real>::get_W1()
 {
     return W1;
 }
 
-Mat<double>& NNClassifier::get_W2()
+template <typename Real>
+Mat<Real>& NNClassifier<Real>::get_W2()
 {
     return W2;
 }
 
-Mat<double>& NNClassifier::get_Eb()
+template <typename Real>
+Mat<Real>& NNClassifier<Real>::get_Eb()
 {
     return Eb;
 }
 
-Mat<double>& NNClassifier::get_Ed()
+template <typename Real>
+Mat<Real>& NNClassifier<Real>::get_Ed()
 {
     return Ed;
 }
 
-Mat<double>& NNClassifier::get_Ev()
+template <typename Real>
+Mat<Real>& NNClassifier<Real>::get_Ev()
 {
     return Ev;
 }
 
-Mat<double>& NNClassifier::get_Ec()
+template <typename Real>
+Mat<Real>& NNClassifier<Real>::get_Ec()
 {
     return Ec;
 }
 
-Mat<double>& NNClassifier::get_El()
+template <typename Real>
+Mat<Real>& NNClassifier<Real>::get_El()
 {
     return El;
 }
 
-Vec<double>& NNClassifier::get_b1()
+template <typename Real>
+Vec<Real>& NNClassifier<Real>::get_b1()
 {
     return b1;
 }
 
-void NNClassifier::pre_compute()
+template <typename Real>
+void NNClassifier<Real>::pre_compute()
 {
     // TODO
-    vector<int> candidates;
-    // unordered_map<int, int>::iterator iter = pre_map.begin();
-    auto iter = pre_map.begin();
-    for (; iter != pre_map.end(); ++iter)
-        candidates.push_back(iter->first);
+    vector<int> candidates = pre_map.keys();
     pre_compute(candidates);
 }
 
-void NNClassifier::pre_compute(
+template <typename Real>
+bool NNClassifier<Real>::adopt_pre_computed(
+        const vector<int>& ids,
+        const Mat<Real>& table)
+{
+    if (table.nrows() != (int)ids.size()
+            || (!ids.empty() && table.ncols() != config.hidden_size))
+        return false;
+
+    pre_map.set_num_tokens(config.num_tokens);
+    pre_map.clear();
+    for (size_t i = 0; i < ids.size(); ++i)
+        pre_map.insert(ids[i], i);
+    if (pre_map.size() != (int)ids.size())
+    {
+        pre_map.clear();
+        return false; // duplicate IDs
+    }
+
+    adopt(saved, table);
+    saved_version.assign(pre_map.size(), param_version);
+    if (quantized)
+        qsaved.quantize(saved);
+
+    cerr << "Adopted " << pre_map.size() << " pre-computed rows" << endl;
+    return true;
+}
+
+template <typename Real>
+Mat<Real>& NNClassifier<Real>::get_pre_computed(vector<int>& ids)
+{
+    pre_compute();
+
+    const vector<int> & keys = pre_map.keys();
+    ids.assign(keys.size(), -1);
+    for (size_t i = 0; i < keys.size(); ++i)
+        ids[pre_map.find(keys[i])] = keys[i];
+    return saved;
+}
+
+template <typename Real>
+void NNClassifier<Real>::pre_compute(
         vector<int>& candidates,
         bool refill)
 {
     cerr << "pre_map.size = " << pre_map.size() << endl;
     cerr << "candidates.size = " << candidates.size() << endl;
     if (refill)
+    {
+        pre_map.set_num_tokens(config.num_tokens);
         for (size_t i = 0; i < candidates.size(); ++i)
-            pre_map[candidates[i]] = i;
+            pre_map.insert(candidates[i], i);
+    }
 
-    // re-initialize
-    saved.resize(pre_map.size(), config.hidden_size);
-    for (int i = 0; i < saved.nrows(); ++i)
-        for (int j = 0; j < saved.ncols(); ++j)
-            saved[i][j] = 0.0;
+    const int H = config.hidden_size;
+    if (refill
+            || saved.nrows() != pre_map.size()
+            || saved.ncols() != H)
+    {
+        // rows renumbered: all stale
+        saved.resize(pre_map.size(), H);
+        saved_version.assign(pre_map.size(), 0);
+    }
 
-    // #pragma omp parallel for
+    /**
+     * Rows to refresh, by token position: those computed before
+     *  the last change of their W1 columns or of their embedding row
+     */
+    const uint64_t version = param_version;
+    vector< vector<int> > by_pos(config.num_tokens);
+    int num_stale = 0;
     for (size_t i = 0; i < candidates.size(); ++i)
     {
-        int map_x = pre_map[candidates[i]];
-        int tok = candidates[i] / config.num_tokens;
-        int pos = candidates[i] % config.num_tokens;
+        int map_x = pre_map.find(candidates[i]);
+        if (saved_version[map_x] >= input_version(candidates[i]))
+            continue;
+        saved_version[map_x] = version;
+        by_pos[candidates[i] % config.num_tokens].push_back(candidates[i]);
+        ++num_stale;
+    }
+
+    /**
+     * saved[map_x] = E[tok] * W1[:, offset..offset + emb_size)^T,
+     *  one gemm per position, positions spread over threads
+     */
+    #pragma omp parallel for schedule(dynamic)
+    for (int pos = 0; pos < config.num_tokens; ++pos)
+    {
+        vector<int> & ids = by_pos[pos];
+        if (ids.empty())
+            continue;
+
         int feat_type = config.get_feat_type(pos);
+        assert (feat_type != Config::NONEXIST);
         int offset = config.get_offset(pos);
         int emb_size = config.get_embedding_size(feat_type);
 
-        // cerr << "\ri = " << i << ": " << candidates[i] << ". map_x = " << map_x << ". tok = " << tok << ". pos = " << pos;
-
-        int E_index = tok;
-        assert (feat_type != Config::NONEXIST);
-        if (feat_type == Config::DIST_FEAT)
-            E_index -= Eb.nrows();
-        else if (feat_type == Config::VALENCY_FEAT)
-            E_index -= Eb.nrows() + Ed.nrows();
-        else if (feat_type == Config::CLUSTER_FEAT)
-            E_index -= Eb.nrows() + Ed.nrows() + Ev.nrows();
-        else if (feat_type == Config::LENGTH_FEAT)
-            E_index -= Eb.nrows() + Ed.nrows() + Ev.nrows() + Ec.nrows();
-
-        // cerr << ". E_index = " << E_index;
-
-        for (int j = 0; j < config.hidden_size; ++j)
+        vector<const Real *> a_rows;
+        vector<Real *> c_rows;
+        for (size_t i = 0; i < ids.size(); ++i)
         {
-            if (feat_type == Config::BASIC_FEAT)
-                for (int k = 0; k < emb_size; ++k)
-                    saved[map_x][j] += Eb[E_index][k] * W1[j][offset + k];
-            else if (feat_type == Config::DIST_FEAT)
-                for (int k = 0; k < emb_size; ++k)
-                    saved[map_x][j] += Ed[E_index][k] * W1[j][offset + k];
-            else if (feat_type == Config::VALENCY_FEAT)
-                for (int k = 0; k < emb_size; ++k)
-                    saved[map_x][j] += Ev[E_index][k] * W1[j][offset + k];
-            else if (feat_type == Config::CLUSTER_FEAT)
-                for (int k = 0; k < emb_size; ++k)
-                    saved[map_x][j] += Ec[E_index][k] * W1[j][offset + k];
-            else if (feat_type == Config::LENGTH_FEAT)
-                for (int k = 0; k < emb_size; ++k)
-                    saved[map_x][j] += El[E_index][k] * W1[j][offset + k];
+            Real * s = saved[pre_map.find(ids[i])];
+            for (int j = 0; j < H; ++j)
+                s[j] = 0.0;
+            if (feat_type == Config::CONST_FEAT)
+                continue; // no embedding
+            a_rows.push_back(get_embedding_row(feat_type, ids[i] / config.num_tokens));
+            c_rows.push_back(s);
         }
+
+        if (!a_rows.empty())
+            Kernels::gemm(&a_rows[0],
+                    W1[0] + offset,
+                    W1.ncols(),
+                    &c_rows[0],
+                    a_rows.size(),
+                    H,
+                    emb_size);
     }
 
+    if (quantized)
+        qsaved.quantize(saved);
+
     cerr << "Pre-computed "
-         << candidates.size()
+         << num_stale
+         << " (" << candidates.size() - num_stale << " up to date)"
          << endl;
 }
 
-void NNClassifier::compute_scores(
+template <typename Real>
+void NNClassifier<Real>::compute_scores(
         vector<int>& features,
-        vector<double>& scores)
+        vector<Real>& scores)
 {
+    if (quantized)
+    {
+        compute_scores_int8(features, scores);
+        return;
+    }
+
     scores.clear();
     scores.resize(num_labels, 0.0);
 
-    Vec<double> hidden(0.0, config.hidden_size);
+    Vec<Real> hidden(0.0, config.hidden_size);
     int offset = 0;
     for (size_t i = 0; i < features.size(); ++i)
     {
         int tok = features[i];
-        int E_index = tok;
-        int index = tok * config.num_tokens + i;
 
         int feat_type = config.get_feat_type(i);
         int emb_size = config.get_embedding_size(feat_type);
-
         assert (feat_type != Config::NONEXIST);
-        if (feat_type == Config::DIST_FEAT)
-            E_index -= Eb.nrows();
-        else if (feat_type == Config::VALENCY_FEAT)
-            E_index -= Eb.nrows() + Ed.nrows();
-        else if (feat_type == Config::CLUSTER_FEAT)
-            E_index -= Eb.nrows() + Ed.nrows() + Ev.nrows();
-        else if (feat_type == Config::LENGTH_FEAT)
-            E_index -= Eb.nrows() + Ed.nrows() + Ev.nrows() + Ec.nrows();
-
-        if (pre_map.find(index) != pre_map.end())
+
+        int id = pre_map.find(i, tok);
+        if (id >= 0)
         {
-            int id = pre_map[index];
-            for (int j = 0; j < config.hidden_size; ++j)
-                hidden[j] += saved[id][j];
+            Kernels::add(hidden.c_buf(), saved[id], config.hidden_size);
         }
-        else
+        else if (feat_type != Config::CONST_FEAT)
         {
-            for (int j = 0; j < config.hidden_size; ++j)
+            // W1[:, offset:offset+emb_size] * E[E_index]
+            Kernels::gemv(W1[0] + offset,
+                    W1.ncols(),
+                    config.hidden_size,
+                    emb_size,
+                    get_embedding_row(feat_type, tok),
+                    hidden.c_buf());
+        }
+        offset += emb_size;
+    }
+
+    Kernels::cube(hidden.c_buf(), b1.c_buf(), config.hidden_size);
+    if (calibrating)
+        record_activations(hidden.c_buf(), config.hidden_size);
+
+    // no need to calculate exp
+    Kernels::gemv(W2[0],
+            W2.ncols(),
+            num_labels,
+            config.hidden_size,
+            hidden.c_buf(),
+            &scores[0]);
+}
+
+template <typename Real>
+void NNClassifier<Real>::compute_scores_batch(
+        vector< vector<int> >& features,
+        vector< vector<Real> >& scores)
+{
+    int n = features.size();
+    scores.resize(n);
+    if (quantized)
+    {
+        for (int b = 0; b < n; ++b)
+            compute_scores_int8(features[b], scores[b]);
+        return;
+    }
+    for (int b = 0; b < n; ++b)
+        scores[b].assign(num_labels, 0.0);
+    if (n == 0)
+        return;
+
+    Mat<Real> hidden(0.0, n, config.hidden_size);
+
+    /**
+     * Token position by token position, the samples whose feature
+     *  is not pre-computed are gathered (as row pointers, no copy)
+     *  and multiplied with the W1 slice of that position in one gemm,
+     *  so that the slice is loaded once for the whole batch.
+     */
+    vector<const Real *> emb_rows;
+    vector<Real *> hidden_rows;
+    emb_rows.reserve(n);
+    hidden_rows.reserve(n);
+
+    int offset = 0;
+    for (int i = 0; i < config.num_tokens; ++i)
+    {
+        int feat_type = config.get_feat_type(i);
+        int emb_size = config.get_embedding_size(feat_type);
+        assert (feat_type != Config::NONEXIST);
+
+        emb_rows.clear();
+        hidden_rows.clear();
+        for (int b = 0; b < n; ++b)
+        {
+            int tok = features[b][i];
+
+            int id = pre_map.find(i, tok);
+            if (id >= 0)
+                Kernels::add(hidden[b], saved[id], config.hidden_size);
+            else if (feat_type != Config::CONST_FEAT)
             {
-                if (feat_type == Config::BASIC_FEAT)
-                    for (int k = 0; k < emb_size; ++k)
-                        hidden[j] += Eb[E_index][k] * W1[j][offset + k];
-                else if (feat_type == Config::DIST_FEAT)
-                    for (int k = 0; k < emb_size; ++k)
-                        hidden[j] += Ed[E_index][k] * W1[j][offset + k];
-                else if (feat_type == Config::VALENCY_FEAT)
-                    for (int k = 0; k < emb_size; ++k)
-                        hidden[j] += Ev[E_index][k] * W1[j][offset + k];
-                else if (feat_type == Config::CLUSTER_FEAT)
-                    for (int k = 0; k < emb_size; ++k)
-                        hidden[j] += Ec[E_index][k] * W1[j][offset + k];
-                else if (feat_type == Config::LENGTH_FEAT)
-                    for (int k = 0; k < emb_size; ++k)
-                        hidden[j] += El[E_index][k] * W1[j][offset + k];
+                emb_rows.push_back(get_embedding_row(feat_type, tok));
+                hidden_rows.push_back(hidden[b]);
             }
         }
+
+        if (!emb_rows.empty())
+            Kernels::gemm(&emb_rows[0],
+                    W1[0] + offset,
+                    W1.ncols(),
+                    &hidden_rows[0],
+                    emb_rows.size(),
+                    config.hidden_size,
+                    emb_size);
         offset += emb_size;
     }
 
-    for (int i = 0; i < config.hidden_size; ++i)
+    vector<const Real *> act_rows(n);
+    vector<Real *> score_rows(n);
+    for (int b = 0; b < n; ++b)
+    {
+        Kernels::cube(hidden[b], b1.c_buf(), config.hidden_size);
+        if (calibrating)
+            record_activations(hidden[b], config.hidden_size);
+        act_rows[b] = hidden[b];
+        score_rows[b] = &scores[b][0];
+    }
+
+    Kernels::gemm(&act_rows[0],
+            W2[0],
+            W2.ncols(),
+            &score_rows[0],
+            n,
+            num_labels,
+            config.hidden_size);
+}
+
+template <typename Real>
+Real * NNClassifier<Real>::get_embedding_row(int feat_type, int tok)
+{
+    int E_index = get_embedding_index(feat_type, tok);
+    switch (feat_type)
+    {
+        case Config::DIST_FEAT:    return Ed[E_index];
+        case Config::VALENCY_FEAT: return Ev[E_index];
+        case Config::CLUSTER_FEAT: return Ec[E_index];
+        case Config::LENGTH_FEAT:  return El[E_index];
+        default:                   return Eb[E_index]; // BASIC_FEAT
+    }
+}
+
+template <typename Real>
+int NNClassifier<Real>::get_embedding_index(int feat_type, int tok)
+{
+    switch (feat_type)
     {
-        hidden[i] += b1[i];
-        hidden[i] = hidden[i] * hidden[i] * hidden[i];
+        case Config::DIST_FEAT:
+            return tok - Eb.nrows();
+        case Config::VALENCY_FEAT:
+            return tok - Eb.nrows() - Ed.nrows();
+        case Config::CLUSTER_FEAT:
+            return tok - Eb.nrows() - Ed.nrows() - Ev.nrows();
+        case Config::LENGTH_FEAT:
+            return tok - Eb.nrows() - Ed.nrows() - Ev.nrows() - Ec.nrows();
+        default: // BASIC_FEAT
+            return tok;
     }
+}
 
+template <typename Real>
+void NNClassifier<Real>::touch_all_params()
+{
+    const uint64_t version = ++param_version;
+    W1_version.assign(config.num_tokens, version);
+    Mat<Real> * E[] = {&Eb, &Ed, &Ev, &Ec, &El};
+    for (int t = 0; t < 5; ++t)
+        E_version[t].assign(E[t]->nrows(), version);
+}
+
+template <typename Real>
+uint64_t NNClassifier<Real>::input_version(int feature_id)
+{
+    int pos = feature_id % config.num_tokens;
+    int tok = feature_id / config.num_tokens;
+    if (pos >= (int)W1_version.size())
+        return UINT64_MAX; // unknown: always stale
+
+    int feat_type = config.get_feat_type(pos);
+    if (feat_type == Config::CONST_FEAT)
+        return W1_version[pos]; // no embedding
+
+    // tables in the order Eb, Ed, Ev, Ec, El
+    int t = (feat_type == Config::LENGTH_FEAT) ? 4 : feat_type;
+    int i = get_embedding_index(feat_type, tok);
+    if (i < 0 || i >= (int)E_version[t].size())
+        return UINT64_MAX;
+    return max(W1_version[pos], E_version[t][i]);
+}
+
+template <typename Real>
+void NNClassifier<Real>::start_calibration()
+{
+    calib_acts.clear();
+    calibrating = true;
+}
+
+template <typename Real>
+void NNClassifier<Real>::record_activations(const Real * h, int n)
+{
+    // a few million samples are plenty for a percentile
+    if (calib_acts.size() >= (1u << 22))
+        return;
+    for (int j = 0; j < n; ++j)
+        calib_acts.push_back(fabs(h[j]));
+}
+
+template <typename Real>
+void NNClassifier<Real>::quantize()
+{
+    calibrating = false;
+
+    /**
+     * Clip hidden activations at a high percentile of the
+     *  calibration samples rather than at their max, the cube
+     *  activation has long tails which would waste the 8 bits.
+     *  Without calibration, every vector is scaled by its own max.
+     */
+    act_scale = 0;
+    if (!calib_acts.empty())
+    {
+        size_t k = (size_t)(calib_acts.size() * 0.9999);
+        if (k >= calib_acts.size())
+            k = calib_acts.size() - 1;
+        nth_element(calib_acts.begin(), calib_acts.begin() + k, calib_acts.end());
+        act_scale = calib_acts[k] / 127.0;
+        cerr << "Calibrated activation range: "
+             << calib_acts[k]
+             << " (" << calib_acts.size() << " samples)"
+             << endl;
+    }
+    else
+        cerr << "No calibration data, dynamic activation range" << endl;
+    calib_acts.clear();
+    calib_acts.shrink_to_fit();
+
+    qW1.quantize(W1);
+    qW2.quantize(W2);
+    qEb.quantize(Eb);
+    qEd.quantize(Ed);
+    qEv.quantize(Ev);
+    qEc.quantize(Ec);
+    qEl.quantize(El);
+    qsaved.quantize(saved);
+
+    quantized = true;
+}
+
+template <typename Real>
+void NNClassifier<Real>::set_quantized(bool on)
+{
+    quantized = on;
+}
+
+template <typename Real>
+bool NNClassifier<Real>::is_quantized()
+{
+    return quantized;
+}
+
+template <typename Real>
+bool NNClassifier<Real>::is_calibrating()
+{
+    return calibrating;
+}
+
+template <typename Real>
+size_t NNClassifier<Real>::scoring_bytes(bool int8)
+{
+    if (int8)
+        return qW1.bytes() + qW2.bytes() + qsaved.bytes()
+            + qEb.bytes() + qEd.bytes() + qEv.bytes()
+            + qEc.bytes() + qEl.bytes()
+            + b1.size() * sizeof(Real);
+
+    size_t n = (size_t)W1.total_size() + W2.total_size() + saved.total_size()
+        + Eb.total_size() + Ed.total_size() + Ev.total_size()
+        + Ec.total_size() + El.total_size()
+        + b1.size();
+    return n * sizeof(Real);
+}
+
+template <typename Real>
+void NNClassifier<Real>::compute_scores_int8(
+        vector<int>& features,
+        vector<Real>& scores)
+{
+    int H = config.hidden_size;
+    scores.assign(num_labels, 0.0);
+
+    vector<Real> hidden(H, 0.0);
+    vector<int32_t> acc(max(H, num_labels));
+    int offset = 0;
+    for (size_t i = 0; i < features.size(); ++i)
+    {
+        int tok = features[i];
+        int feat_type = config.get_feat_type(i);
+        int emb_size = config.get_embedding_size(feat_type);
+
+        int id = pre_map.find(i, tok);
+        if (id >= 0)
+        {
+            Kernels::axpy_i8(&hidden[0], (Real)qsaved.scale[id], qsaved.q[id], H);
+        }
+        else if (feat_type != Config::CONST_FEAT)
+        {
+            QuantMat * E = &qEb;
+            if (feat_type == Config::DIST_FEAT)
+                E = &qEd;
+            else if (feat_type == Config::VALENCY_FEAT)
+                E = &qEv;
+            else if (feat_type == Config::CLUSTER_FEAT)
+                E = &qEc;
+            else if (feat_type == Config::LENGTH_FEAT)
+                E = &qEl;
+            int E_index = get_embedding_index(feat_type, tok);
+
+            // W1[:, offset:offset+emb_size] * E[E_index]
+            Kernels::gemv_i8(qW1.q[0] + offset,
+                    qW1.q.ncols(),
+                    H,
+                    emb_size,
+                    E->q[E_index],
+                    &acc[0]);
+            Real s = E->scale[E_index];
+            for (int j = 0; j < H; ++j)
+                hidden[j] += s * qW1.scale[j] * acc[j];
+        }
+        offset += emb_size;
+    }
+
+    Kernels::cube(&hidden[0], b1.c_buf(), H);
+
+    Real s_act = act_scale;
+    if (s_act <= 0)
+    {
+        Real max_abs = 0;
+        for (int j = 0; j < H; ++j)
+            max_abs = max(max_abs, (Real)fabs(hidden[j]));
+        s_act = max_abs / 127.0;
+    }
+    Real inv = (s_act > 0) ? 1.0 / s_act : 0.0;
+
+    vector<int8_t> hq(H);
+    for (int j = 0; j < H; ++j)
+        hq[j] = quantize_value(hidden[j], inv);
+
+    Kernels::gemv_i8(qW2.q[0], qW2.q.ncols(), num_labels, H, &hq[0], &acc[0]);
     for (int i = 0; i < num_labels; ++i)
-        for (int j = 0; j < config.hidden_size; ++j)
-            // no need to calculate exp
-            scores[i] += W2[i][j] * hidden[j];
+        scores[i] = qW2.scale[i] * s_act * acc[i];
 }
 
-void NNClassifier::clear_gradient_histories()
+template <typename Real>
+void NNClassifier<Real>::clear_gradient_histories()
 {
     init_gradient_histories();
 }
 
-void NNClassifier::init_gradient_histories()
+template <typename Real>
+void NNClassifier<Real>::init_gradient_histories()
 {
+    // the pending decay goes by the histories about to be reset
+    apply_pending_l2();
+
     eg2W1.resize(W1.nrows(), W1.ncols()); eg2W1 = .0;
     eg2W2.resize(W2.nrows(), W2.ncols()); eg2W2 = .0;
     eg2Eb.resize(Eb.nrows(), Eb.ncols()); eg2Eb = .0;
@@ -1527,23 +2559,25 @@ void NNClassifier::init_gradient_histories()
     eg2b1.resize(b1.size()); eg2b1 = .0;
 }
 
-void NNClassifier::finalize_training()
+template <typename Real>
+void NNClassifier<Real>::finalize_training()
 {
-    // reset
+    apply_pending_l2();
 }
 
-void Cost::merge(const Cost & c, bool & debug)
+template <typename Real>
+void Cost<Real>::merge(const Cost & c, bool & debug)
 {
     loss += c.loss;
     percent_correct += c.percent_correct;
     Util::mat_inc(grad_W1, c.grad_W1);
     Util::vec_inc(grad_b1, c.grad_b1);
     Util::mat_inc(grad_W2, c.grad_W2);
-    Util::mat_inc(grad_Eb, c.grad_Eb);
-    Util::mat_inc(grad_Ed, c.grad_Ed);
-    Util::mat_inc(grad_Ev, c.grad_Ev);
-    Util::mat_inc(grad_Ec, c.grad_Ec);
-    Util::mat_inc(grad_El, c.grad_El);
+    grad_Eb.merge(c.grad_Eb);
+    grad_Ed.merge(c.grad_Ed);
+    grad_Ev.merge(c.grad_Ev);
+    grad_Ec.merge(c.grad_Ec);
+    grad_El.merge(c.grad_El);
 
     if (debug)
         dropout_histories.insert(
@@ -1552,7 +2586,21 @@ void Cost::merge(const Cost & c, bool & debug)
                 c.dropout_histories.end());
 }
 
-void NNClassifier::print_info()
+template <typename Real>
+SparseRows<Real> & Cost<Real>::grad_E(int feat_type)
+{
+    switch (feat_type)
+    {
+        case Config::BASIC_FEAT:    return grad_Eb;
+        case Config::DIST_FEAT:     return grad_Ed;
+        case Config::VALENCY_FEAT:  return grad_Ev;
+        case Config::CLUSTER_FEAT:  return grad_Ec;
+        default:                    return grad_El;
+    }
+}
+
+template <typename Real>
+void NNClassifier<Real>::print_info()
 {
     cerr << "\tW1: " << W1.nrows() << " * " << W1.ncols() << endl
          << "\tW2: " << W2.nrows() << " * " << W2.ncols() << endl
@@ -1561,6 +2609,11 @@ void NNClassifier::print_info()
          << "\tEd: " << Ed.nrows() << " * " << Ed.ncols() << endl
          << "\tEv: " << Ev.nrows() << " * " << Ev.ncols() << endl
          << "\tEc: " << Ec.nrows() << " * " << Ec.ncols() << endl
-         << "\tEl: " << El.nrows() << " * " << El.ncols() << endl;
+         << "\tEl: " << El.nrows() << " * " << El.ncols() << endl
+         << "\tSIMD kernels: " << Kernels::isa() << endl;
 }
 
+template class Cost<float>;
+template class Cost<double>;
+template class NNClassifier<float>;
+template class NNClassifier<double>;
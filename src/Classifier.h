@@ -3,24 +3,36 @@
 
 #include "Config.h"
 #include "Dataset.h"
+#include "PreComputeIndex.h"
+#include "Quantize.h"
+#include "SparseRows.h"
 #include "math/mat.h"
 // #include <map>
 #include <unordered_map>
+#include <memory>
+#include <atomic>
 
+class ThreadPool;
+
+/**
+ * @Real: floating point type of parameters and gradients
+ */
+template <typename Real>
 class Cost
 {
     public:
         double loss;
         double percent_correct;
 
-        Mat<double> grad_W1;
-        Vec<double> grad_b1;
-        Mat<double> grad_W2;
-        Mat<double> grad_Eb;
-        Mat<double> grad_Ed;
-        Mat<double> grad_Ev;
-        Mat<double> grad_Ec;
-        Mat<double> grad_El;
+        Mat<Real> grad_W1;
+        Vec<Real> grad_b1;
+        Mat<Real> grad_W2;
+        // embedding gradients, touched rows only
+        SparseRows<Real> grad_Eb;
+        SparseRows<Real> grad_Ed;
+        SparseRows<Real> grad_Ev;
+        SparseRows<Real> grad_Ec;
+        SparseRows<Real> grad_El;
 
         std::vector< std::vector<int>> dropout_histories;
 
@@ -71,14 +83,14 @@ class Cost
 
         Cost(double _loss,
                 double _percent_correct,
-                Mat<double>& _grad_W1,
-                Vec<double>& _grad_b1,
-                Mat<double>& _grad_W2,
-                Mat<double>& _grad_Eb,
-                Mat<double>& _grad_Ed,
-                Mat<double>& _grad_Ev,
-                Mat<double>& _grad_Ec,
-                Mat<double>& _grad_El,
+                Mat<Real>& _grad_W1,
+                Vec<Real>& _grad_b1,
+                Mat<Real>& _grad_W2,
+                SparseRows<Real>& _grad_Eb,
+                SparseRows<Real>& _grad_Ed,
+                SparseRows<Real>& _grad_Ev,
+                SparseRows<Real>& _grad_Ec,
+                SparseRows<Real>& _grad_El,
                 std::vector< std::vector<int>>& _dropout_histories)
         {
             loss = _loss;
@@ -98,6 +110,11 @@ class Cost
 
         void merge(const Cost & c, bool & debug);
 
+        /**
+         * gradient of the embedding table of @feat_type
+         */
+        SparseRows<Real> & grad_E(int feat_type);
+
         double get_loss()
         {
             return loss;
@@ -106,40 +123,41 @@ class Cost
         {
             return percent_correct;
         }
-        Mat<double> get_grad_W1()
+        Mat<Real> get_grad_W1()
         {
             return grad_W1;
         }
-        Vec<double> get_grad_b1()
+        Vec<Real> get_grad_b1()
         {
             return grad_b1;
         }
-        Mat<double> get_grad_W2()
+        Mat<Real> get_grad_W2()
         {
             return grad_W2;
         }
-        Mat<double> get_grad_Eb()
+        SparseRows<Real> get_grad_Eb()
         {
             return grad_Eb;
         }
-        Mat<double> get_grad_Ed()
+        SparseRows<Real> get_grad_Ed()
         {
             return grad_Ed;
         }
-        Mat<double> get_grad_Ev()
+        SparseRows<Real> get_grad_Ev()
         {
             return grad_Ev;
         }
-        Mat<double> get_grad_Ec()
+        SparseRows<Real> get_grad_Ec()
         {
             return grad_Ec;
         }
-        Mat<double> get_grad_El()
+        SparseRows<Real> get_grad_El()
         {
             return grad_El;
         }
 };
 
+template <typename Real>
 class NNClassifier
 {
     public:
@@ -147,25 +165,25 @@ class NNClassifier
         NNClassifier(
                 const Config& _config,
                 const Dataset& _dataset,
-                const Mat<double>& _Eb,
-                const Mat<double>& _Ed,
-                const Mat<double>& _Ev,
-                const Mat<double>& _Ec,
-                const Mat<double>& _El,
-                const Mat<double>& _W1,
-                const Vec<double>& _b1,
-                const Mat<double>& _W2,
+                const Mat<Real>& _Eb,
+                const Mat<Real>& _Ed,
+                const Mat<Real>& _Ev,
+                const Mat<Real>& _Ec,
+                const Mat<Real>& _El,
+                const Mat<Real>& _W1,
+                const Vec<Real>& _b1,
+                const Mat<Real>& _W2,
                 const std::vector<int>& pre_computed_ids);
         NNClassifier(
                 const Config& _config,
-                const Mat<double>& _Eb,
-                const Mat<double>& _Ed,
-                const Mat<double>& _Ev,
-                const Mat<double>& _Ec,
-                const Mat<double>& _El,
-                const Mat<double>& _W1,
-                const Vec<double>& _b1,
-                const Mat<double>& _W2,
+                const Mat<Real>& _Eb,
+                const Mat<Real>& _Ed,
+                const Mat<Real>& _Ev,
+                const Mat<Real>& _Ec,
+                const Mat<Real>& _El,
+                const Mat<Real>& _W1,
+                const Vec<Real>& _b1,
+                const Mat<Real>& _W2,
                 const std::vector<int>& pre_computed_ids);
         NNClassifier(const NNClassifier & classifier);
 
@@ -180,44 +198,108 @@ class NNClassifier
 
         void compute_cost_function();
 
-        Cost thread_proc(
-                std::vector<Sample> & chunk,
-                size_t batch_size);
+        /**
+         * Asynchronous (Hogwild) alternative to compute_cost_function()
+         *  + take_ada_gradient_step(): the worker threads take slices
+         *  of config.hogwild_batch_size samples off the mini-batch and
+         *  apply sparse AdaGrad updates to the shared weights right
+         *  away, without locks and without waiting for each other.
+         *  The pre-computed table is bypassed as the weights keep moving.
+         *
+         * get_loss() / get_accuracy() then average over the slices
+         *  (loss without the L2 penalty).
+         */
+        void train_hogwild(int Eb_start_pos = 0);
+
+        /**
+         * forward/backward pass over samples[begin, end)
+         *  of the current mini-batch
+         *  - saved_grad: the calling thread's own buffer for the
+         *    gradients of pre-computed hidden units, which are taken
+         *    from @saved; rows as in @grad_saved (see @saved_slot).
+         *    If NULL, @saved is not used
+         */
+        Cost<Real> thread_proc(
+                size_t begin,
+                size_t end,
+                size_t batch_size,
+                Mat<Real> * saved_grad);
+
+        /**
+         * the same, adding the gradients to those of @c (loss and
+         *  accuracy are set); the hidden units active in some
+         *  sample are or-ed into the bit mask @touched, if not NULL
+         */
+        void thread_proc(
+                size_t begin,
+                size_t end,
+                size_t batch_size,
+                Mat<Real> * saved_grad,
+                Cost<Real> & c,
+                std::vector<uint64_t> * touched);
+
+        /**
+         * thread_proc(...) on blocks of samples at a time, with the
+         *  hidden layer, output layer and all gradients as blocked
+         *  gemms. Dropout is a 0/1 mask on the hidden units, which
+         *  gives the same gradients (up to summation order).
+         *  Needs @W1T for the current weights.
+         */
+        Cost<Real> thread_proc_batch(
+                size_t begin,
+                size_t end,
+                size_t batch_size,
+                Mat<Real> * saved_grad);
 
         /**
          * Gradient Checking
          */
         void check_gradient();
         void compute_numerical_gradients(
-                Mat<double> & num_grad_W1,
-                Vec<double> & num_grad_b1,
-                Mat<double> & num_grad_W2,
-                Mat<double> & num_grad_Eb,
-                Mat<double> & num_grad_Ed,
-                Mat<double> & num_grad_Ev,
-                Mat<double> & num_grad_Ec,
-                Mat<double> & num_grad_El);
+                Mat<Real> & num_grad_W1,
+                Vec<Real> & num_grad_b1,
+                Mat<Real> & num_grad_W2,
+                Mat<Real> & num_grad_Eb,
+                Mat<Real> & num_grad_Ed,
+                Mat<Real> & num_grad_Ev,
+                Mat<Real> & num_grad_Ec,
+                Mat<Real> & num_grad_El);
         double compute_cost();
 
         void take_ada_gradient_step(int Eb_start_pos = 0);
 
-        void dropout(
-                int size,
-                double prob,
-                std::vector<int>& active_units);
+        /**
+         * dropout mask of samples[i] of the current mini-batch:
+         *  bit k of @mask is set iff hidden unit k is kept
+         *  (probability 1 - config.dropout_prob). The bits come from
+         *  the counter-based stream (seed, round, i), so they do not
+         *  depend on which thread asks, nor on the number of threads.
+         */
+        void dropout(size_t i, std::vector<uint64_t> & mask);
 
         void back_prop_saved(
-                Cost & cost,
+                Cost<Real> & cost,
                 std::vector<int> & features_seen);
 
-        void add_l2_regularization(Cost & cost);
+        /**
+         * add the L2 penalty to cost.loss. Its gradient is not added
+         *  to @cost: the AdaGrad step applies it (see apply_ada_gradient)
+         */
+        void add_l2_regularization(Cost<Real> & cost);
+
+        /**
+         * bring every embedding row up to date with the L2 decay
+         *  deferred by the AdaGrad step, before the embeddings are
+         *  read as a whole (saving, dev evaluation)
+         */
+        void apply_pending_l2();
 
         void clear_gradient_histories();
 
         void finalize_training();
 
         std::vector<int> get_pre_computed_ids(
-                std::vector<Sample>& samples);
+                std::vector<Sample*>& samples);
 
         void pre_compute();
         /**
@@ -231,57 +313,183 @@ class NNClassifier
                 std::vector<int>& candidates,
                 bool refill = false);
 
+        /**
+         * use @table as the pre-computed table of the feature IDs
+         *  @ids (row i for ids[i]) instead of computing it; a view
+         *  @table (see Mat::borrow) is shared, not copied.
+         *  false if its shape does not fit
+         */
+        bool adopt_pre_computed(
+                const std::vector<int>& ids,
+                const Mat<Real>& table);
+
+        /**
+         * the pre-computed table, brought up to date, and the
+         *  feature ID of each of its rows
+         */
+        Mat<Real>& get_pre_computed(std::vector<int>& ids);
+
         void compute_scores(std::vector<int>& features,
-                std::vector<double>& scores);
+                std::vector<Real>& scores);
+
+        /**
+         * compute_scores(...) for a batch of feature vectors at once
+         *  - the hidden and output layers are blocked gemms, hence
+         *    the weights are streamed once per batch, not per vector
+         *  - scores[b] is bit-identical to compute_scores(features[b])
+         */
+        void compute_scores_batch(
+                std::vector< std::vector<int> >& features,
+                std::vector< std::vector<Real> >& scores);
+
+        /**
+         * int8 inference
+         *  - start_calibration(): later compute_scores(...) calls
+         *    record the hidden activations (the output layer input)
+         *  - quantize(): build int8 tables with per-row scales for
+         *    W1, W2, the embeddings and the pre-computed table, and
+         *    score with them (int32 accumulation) from then on
+         *  - set_quantized(false) switches back to full precision
+         */
+        void start_calibration();
+        void quantize();
+        void set_quantized(bool on);
+        bool is_quantized();
+        bool is_calibrating();
+
+        /**
+         * bytes of the parameters used for scoring (W1, b1, W2,
+         *  embeddings, pre-computed table), in int8 or in Real
+         */
+        size_t scoring_bytes(bool int8);
 
         double get_loss();
         double get_accuracy();
 
-        Mat<double>& get_W1();
-        Mat<double>& get_W2();
-        Vec<double>& get_b1();
-        Mat<double>& get_Eb();
-        Mat<double>& get_Ed();
-        Mat<double>& get_Ev();
-        Mat<double>& get_Ec();
-        Mat<double>& get_El();
+        Mat<Real>& get_W1();
+        Mat<Real>& get_W2();
+        Vec<Real>& get_b1();
+        Mat<Real>& get_Eb();
+        Mat<Real>& get_Ed();
+        Mat<Real>& get_Ev();
+        Mat<Real>& get_Ec();
+        Mat<Real>& get_El();
 
         void print_info();
 
     private:
+        // next mini-batch of config.batch_size samples into @samples
+        void next_minibatch();
+
+        /**
+         * L2 + AdaGrad update with the gradients in @c, in one pass
+         *  over each parameter row, rows spread over OpenMP threads.
+         *  Embedding rows not touched by @c are left alone; they get
+         *  the L2 decay of the steps they missed when next touched.
+         *  With @units (a Hogwild step), the same goes for the hidden
+         *  units: only those listed are updated, and the entries of
+         *  @c read are reset to zero.
+         */
+        void apply_ada_gradient(
+                Cost<Real> & c,
+                int Eb_start_pos,
+                const std::vector<int> * units = NULL);
+
+        // zero gradients of the shape of the parameters into @c
+        void alloc_gradients(Cost<Real> & c);
+
+        /**
+         * embedding row of token @tok (a global feature value,
+         *  offset by the sizes of the preceding embedding matrices)
+         */
+        Real * get_embedding_row(int feat_type, int tok);
+        int get_embedding_index(int feat_type, int tok);
+
+        // all of W1 and the embeddings changed (new weights)
+        void touch_all_params();
+        // last change of the inputs of the pre-computed row of @feature_id
+        uint64_t input_version(int feature_id);
+
+        void compute_scores_int8(
+                std::vector<int>& features,
+                std::vector<Real>& scores);
+        void record_activations(const Real * h, int n);
+
         /**
          * Eb: Embedding matrix for basic features
          * Ed: Embedding matrix for distance features
          * Ev: Embedding matrix for valency features
          * Ec: Embedding matrix for cluster features
          */
-        static Mat<double> W1, W2, Eb, Ed, Ev, Ec, El;
-        static Vec<double> b1;
+        static Mat<Real> W1, W2, Eb, Ed, Ev, Ec, El;
+        static Vec<Real> b1;
 
         /*
-        Mat<double> grad_W1;
-        Vec<double> grad_b1;
-        Mat<double> grad_W2;
-        Mat<double> grad_E;
+        Mat<Real> grad_W1;
+        Vec<Real> grad_b1;
+        Mat<Real> grad_W2;
+        Mat<Real> grad_E;
 
         double loss;
         double accuracy;
         */
-        Cost cost;
+        Cost<Real> cost;
 
+        /**
+         * AdaGrad histories are kept in double for any Real,
+         *  the sums of squared gradients lose precision in float
+         */
         Mat<double> eg2W1, eg2W2, eg2Eb, eg2Ed, eg2Ev, eg2Ec, eg2El;
         Vec<double> eg2b1;
 
         /**
-         * global grad saved
+         * lazy L2 on the embeddings: number of AdaGrad steps taken,
+         *  and for each row of Eb, Ed, Ev, Ec, El (in this order) the
+         *  step it is up to date with
+         */
+        std::atomic<int> ada_step;
+        std::vector<int> l2_step[5];
+        // the same for each hidden unit (W1 row, b1, W2 column)
+        std::vector<int> unit_l2_step;
+        int Eb_fixed_rows; // rows of Eb kept fixed (fix_word_embeddings)
+
+        // sum of squares of the embeddings, for the L2 penalty
+        double emb_sq;
+        bool emb_sq_valid;
+
+        /**
+         * global grad saved: one row per pre-computed feature of
+         *  the mini-batch, in the order of get_pre_computed_ids(...)
+         */
+        static Mat<Real> grad_saved;
+        // per-chunk parts of @grad_saved, summed after each pass
+        std::vector< Mat<Real> > grad_saved_parts;
+        // gradient buffers of the Hogwild workers, see train_hogwild(...)
+        std::vector< Cost<Real> > hogwild_parts;
+        // row of @saved -> row of @grad_saved, -1 if not in the mini-batch
+        std::vector<int> saved_slot;
+        // transposed W1 for thread_proc_batch(...)
+        Mat<Real> W1T;
+        static Mat<Real> saved; // pre_computed;
+
+        /**
+         * @param_version is a clock, advanced by each change of W1 or
+         *  of the embeddings. W1_version[pos] is the time the W1
+         *  columns of token position pos last changed, E_version[t][i]
+         *  that of row i of embedding table t (Eb, Ed, Ev, Ec, El).
+         *  saved_version[i] is the time row i of @saved was computed
+         *  (0: never); it is stale once its W1 columns or its
+         *  embedding row changed, see pre_compute(...)
          */
-        static Mat<double> grad_saved;
-        static Mat<double> saved; // pre_computed;
+        static std::atomic<uint64_t> param_version;
+        static std::vector<uint64_t> W1_version;
+        static std::vector<uint64_t> E_version[5];
+        static std::vector<uint64_t> saved_version;
 
         /**
          * map feature ID to index in pre_computed data
          */
-        static std::unordered_map<int, int> pre_map;
+        static PreComputeIndex pre_map;
 
         bool is_training;
         int num_labels; // number of transitions
@@ -289,11 +497,41 @@ class NNClassifier
         Config config;
         static Dataset dataset; // entire dataset
 
-        std::vector<Sample> samples; // a mini-batch
+        // a mini-batch, pointing into @dataset
+        std::vector<Sample*> samples;
         // std::vector< std::vector<int>> dropout_histories;
 
         int cursor; // for sampling minibatch
+
+        /**
+         * dropout streams: @rng_seed is config.seed (or the clock),
+         *  @dropout_round counts the passes over mini-batches
+         */
+        uint64_t rng_seed;
+        uint64_t dropout_round;
+
+        // training threads, kept alive across iterations
+        std::shared_ptr<ThreadPool> workers;
+
+        /**
+         * int8 inference
+         */
+        bool calibrating;
+        bool quantized;
+        std::vector<float> calib_acts; // |activation| samples
+        float act_scale; // 0: scale each hidden vector by its max
+        QuantMat qW1, qW2, qsaved, qEb, qEd, qEv, qEc, qEl;
 };
 
+/**
+ * Floating point type of the parser model, selected at build time
+ *  (cmake -DNNDEP_FLOAT=ON for float32). Both instantiations are
+ *  compiled; model files are the same text format for either.
+ */
+#ifdef NNDEP_FLOAT
+typedef float nn_real;
+#else
+typedef double nn_real;
+#endif
 
 #endif
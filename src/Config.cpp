@@ -40,10 +40,14 @@ void Config::init()
     max_iter                = 20000;
     finetune_iter           = 5000;
     batch_size              = 10000;
+    hogwild                 = false;
+    hogwild_batch_size      = 100;
+    batched_training        = true;
     ada_eps                 = 1.0e-6;
     ada_alpha               = 0.010;
     reg_parameter           = 1.0e-8;
     dropout_prob            = 0.50;
+    seed                    = 0;
     hidden_size             = 200;
     phidden_size            = 50;
     embedding_size          = 50;
@@ -63,6 +67,12 @@ void Config::init()
 
     num_pre_computed        = 100000;
     eval_per_iter           = 100;
+    binary_model            = false;
+    save_pre_computed       = false;
+    lockstep_decoding       = true;
+    decode_batch_size       = 64;
+    decode_threads          = 0;
+    stream_window           = 0;
     clear_gradient_per_iter = 0;
     save_intermediate       = true;
     fix_word_embeddings     = false;
@@ -129,6 +139,7 @@ void Config::set_properties(const char * filename)
     cfg_set_int(props, "max_iter",                  max_iter);
     cfg_set_int(props, "finetune_iter",             finetune_iter);
     cfg_set_int(props, "batch_size",                batch_size);
+    cfg_set_int(props, "hogwild_batch_size",        hogwild_batch_size);
     cfg_set_int(props, "hidden_size",               hidden_size);
     cfg_set_int(props, "phidden_size",              phidden_size);
     cfg_set_int(props, "embedding_size",            embedding_size);
@@ -146,7 +157,11 @@ void Config::set_properties(const char * filename)
 
     cfg_set_int(props, "num_pre_computed",          num_pre_computed);
     cfg_set_int(props, "eval_per_iter",             eval_per_iter);
+    cfg_set_int(props, "decode_batch_size",         decode_batch_size);
+    cfg_set_int(props, "decode_threads",            decode_threads);
+    cfg_set_int(props, "stream_window",             stream_window);
     cfg_set_int(props, "clear_gradient_per_iter",   clear_gradient_per_iter);
+    cfg_set_int(props, "seed",                      seed);
     cfg_set_int(props, "distance_embedding_size",   distance_embedding_size);
     cfg_set_int(props, "valency_embedding_size",    valency_embedding_size);
     cfg_set_int(props, "cluster_embedding_size",    cluster_embedding_size);
@@ -162,6 +177,11 @@ void Config::set_properties(const char * filename)
     cfg_set_double(props, "reg_parameter",          reg_parameter);
     cfg_set_double(props, "dropout_prob",           dropout_prob);
 
+    cfg_set_boolean(props, "hogwild",               hogwild);
+    cfg_set_boolean(props, "binary_model",          binary_model);
+    cfg_set_boolean(props, "save_pre_computed",     save_pre_computed);
+    cfg_set_boolean(props, "lockstep_decoding",     lockstep_decoding);
+    cfg_set_boolean(props, "batched_training",      batched_training);
     cfg_set_boolean(props, "save_intermediate",     save_intermediate);
     cfg_set_boolean(props, "fix_word_embeddings",   fix_word_embeddings);
     cfg_set_boolean(props, "delexicalized",         delexicalized);
@@ -255,10 +275,14 @@ void Config::print_info()
     cerr << "max_iter                = " << max_iter                << endl;
     cerr << "finetune_iter           = " << finetune_iter           << endl;
     cerr << "batch_size              = " << batch_size              << endl;
+    cerr << "hogwild                 = " << hogwild                 << endl;
+    cerr << "hogwild_batch_size      = " << hogwild_batch_size      << endl;
+    cerr << "batched_training        = " << batched_training        << endl;
     cerr << "ada_eps                 = " << ada_eps                 << endl;
     cerr << "ada_alpha               = " << ada_alpha               << endl;
     cerr << "reg_parameter           = " << reg_parameter           << endl;
     cerr << "dropout_prob            = " << dropout_prob            << endl;
+    cerr << "seed                    = " << seed                    << endl;
     cerr << "hidden_size             = " << hidden_size             << endl;
     cerr << "phidden_size            = " << phidden_size            << endl;
     cerr << "embedding_size          = " << embedding_size          << endl;
@@ -270,6 +294,12 @@ void Config::print_info()
     cerr << "num_length_tokens      = " << num_length_tokens      << endl;
     cerr << "num_pre_computed        = " << num_pre_computed        << endl;
     cerr << "eval_per_iter           = " << eval_per_iter           << endl;
+    cerr << "binary_model            = " << binary_model            << endl;
+    cerr << "save_pre_computed       = " << save_pre_computed       << endl;
+    cerr << "lockstep_decoding       = " << lockstep_decoding       << endl;
+    cerr << "decode_batch_size       = " << decode_batch_size       << endl;
+    cerr << "decode_threads          = " << decode_threads          << endl;
+    cerr << "stream_window           = " << stream_window           << endl;
     cerr << "save_intermediate       = " << save_intermediate       << endl;
     cerr << "clear_gradient_per_iter = " << clear_gradient_per_iter << endl;
     cerr << "fix_word_embeddings     = " << fix_word_embeddings     << endl;
@@ -39,6 +39,19 @@ class Config
 
         int batch_size;
 
+        /**
+         * asynchronous (Hogwild) training: every thread updates the
+         *  shared weights after each @hogwild_batch_size samples
+         */
+        bool hogwild;
+        int hogwild_batch_size;
+
+        /**
+         * run the synchronous training passes as blocked gemms over
+         *  blocks of samples rather than sample by sample
+         */
+        bool batched_training;
+
         /**
          * hyper-parameters for AdaGrad
          */
@@ -48,6 +61,12 @@ class Config
 
         double dropout_prob;
 
+        /**
+         * seed of the random numbers (weight initialization,
+         *  dropout masks); 0: seeded from the clock
+         */
+        int seed;
+
         int hidden_size;
         int embedding_size;
 
@@ -75,6 +94,43 @@ class Config
 
         int eval_per_iter;
 
+        /**
+         * save models in the binary format (see ModelFile)
+         *  rather than as text
+         */
+        bool binary_model;
+
+        /**
+         * also save the pre-computed table in binary models, so that
+         *  loading them does not compute it again
+         */
+        bool save_pre_computed;
+
+        /**
+         * decode sentences in lockstep in predict_graph, scoring the
+         *  feature vectors of decode_batch_size of them in one
+         *  batched call; otherwise one sentence at a time
+         */
+        bool lockstep_decoding;
+
+        /**
+         * number of sentences decoded in lockstep by predict_graph,
+         *  whose feature vectors are scored in one batched call
+         */
+        int decode_batch_size;
+
+        /**
+         * threads decoding sentences in predict_graph,
+         *  0 for all processors
+         */
+        int decode_threads;
+
+        /**
+         * sentences read but not written yet by -stream (bounding
+         *  its memory), 0 for 4 * decode_batch_size * threads
+         */
+        int stream_window;
+
         /**
          * clear adagrad gradient histories after every iteration
          * (confused)
@@ -18,6 +18,15 @@ Configuration::Configuration(Configuration& c)
     rvalency = c.rvalency;
     lhvalency = c.lvalency;
     rhvalency = c.rvalency;
+
+    lchild = c.lchild;
+    rchild = c.rchild;
+    lhead = c.lhead;
+    rhead = c.rhead;
+
+    anc_words = c.anc_words;
+    ancestors = c.ancestors;
+    anc_up.resize(anc_words);
 }
 
 Configuration::Configuration(DependencySent& s)
@@ -38,12 +47,10 @@ void Configuration::init(DependencySent& s)
     rhvalency.clear();
 
     sent = s;
+    graph.init(sent.n);
     for (int i = 1; i <= sent.n; ++i)
     {
-        vector<int> head;
-        vector<string> label;
         vector<Snd_head> snd_head;
-        graph.add(head, label);
         buffer.push_back(i);
         snd_heads.push_back(snd_head);
     }
@@ -53,6 +60,15 @@ void Configuration::init(DependencySent& s)
     lhvalency.resize(sent.n + 1, 0);
     rhvalency.resize(sent.n + 1, 0);
 
+    lchild.assign(sent.n + 1, Config::NONEXIST);
+    rchild.assign(sent.n + 1, Config::NONEXIST);
+    lhead.assign(sent.n + 1, Config::NONEXIST);
+    rhead.assign(sent.n + 1, Config::NONEXIST);
+
+    anc_words = (sent.n + 1 + 63) / 64;
+    ancestors.assign((size_t)(sent.n + 1) * anc_words, 0);
+    anc_up.resize(anc_words);
+
     //changed here to generate transition sequence for lstm parser
     //need to change back to push root to stack
     //stack.push_back(0);
@@ -143,23 +159,30 @@ int Configuration::get_sent_size()
 
 void Configuration::save_2nd_head(std::string trans, int score) //node k is stored at k-1
 {
-    Snd_head snd_head;
     if (trans.length() < 4)
         return;
-    snd_head.label = trans.substr(3, trans.length() - 4);
+    if (startswith(trans, "L"))
+        save_2nd_head(1, DependencyGraph::label_id(trans.substr(3, trans.length() - 4)), score);
+    else if (startswith(trans, "R"))
+        save_2nd_head(-1, DependencyGraph::label_id(trans.substr(3, trans.length() - 4)), score);
+    else
+        cerr << "error: save 2nd head:" << trans << endl;
+}
+
+void Configuration::save_2nd_head(int dir, int label, int score)
+{
+    Snd_head snd_head;
+    snd_head.label = label;
     snd_head.score = score;
     int k,h;
-    if (startswith(trans, "L")){
+    if (dir > 0){
         k = get_stack(0);
         h = get_buffer(0);
     }
-    else if (startswith(trans, "R")){
+    else{
         k = get_buffer(0);
         h = get_stack(0);
     }
-    else{
-        cerr << "error: save 2nd head:" << trans << endl;
-    }
     snd_head.head = h;
   //  cerr << "save head :" << k << endl;
     snd_heads[k-1].push_back(snd_head);
@@ -186,7 +209,7 @@ bool Configuration::find_2nd_head(int k) //node k is stored at k-1
     return false;
 }
 
-std::vector<int> Configuration::get_head(int k)
+DependencyGraph::Span Configuration::get_head(int k)
 {
     return graph.get_head(k);
 }
@@ -206,7 +229,7 @@ bool Configuration::has_head(int k, int h)//return if node k has head h
     return graph.has_head(k, h);
 }
 
-const std::vector<std::string>  Configuration::get_label(int k)
+DependencyGraph::Span Configuration::get_label(int k)
 {
     return graph.get_label(k);
 }
@@ -216,6 +239,11 @@ const string & Configuration::get_arc_label(int k, int h)
     return graph.get_arc_label(k, h);
 }
 
+int Configuration::get_arc_label_id(int k, int h)
+{
+    return graph.get_arc_label_id(k, h);
+}
+
 /**
  * k starts from 0 (top-stack)
  */
@@ -277,11 +305,28 @@ int Configuration::encode_distance(const int & h, const int & m)
 
 string Configuration::encode_valency(const string & typ, const int & k)
 {
-    int v = k;
+    return typ + to_str(valency_bucket(k));
+}
+
+int Configuration::valency_bucket(int v)
+{
     if (v > 10) v = 6;
     else if (v > 5) v = 5;
+    return v;
+}
+
+int Configuration::get_valency_bucket(int typ, int k)
+{
+    if (k < 0 || k > graph.n)
+        return -1;
 
-    return typ + to_str(v);
+    switch (typ)
+    {
+        case VALENCY_LC: return valency_bucket(lvalency[k]);
+        case VALENCY_RC: return valency_bucket(rvalency[k]);
+        case VALENCY_LH: return valency_bucket(lhvalency[k]);
+        default:         return valency_bucket(rhvalency[k]);
+    }
 }
 
 /**
@@ -341,9 +386,55 @@ string Configuration::get_cluster_prefix(int k, int p)
                 //         : get_brown_prefix(sent.clusters[k], p));
 }
 
+/**
+ * k starts from 0 (root); out of range nodes map to the NIL slot [0]
+ */
+int Configuration::get_word_id(int k)
+{
+    return sent.word_ids[(k < 0 || k > sent.n) ? 0 : k + 1];
+}
+
+int Configuration::get_pos_id(int k)
+{
+    return sent.pos_ids[(k < 0 || k > sent.n) ? 0 : k + 1];
+}
+
+int Configuration::get_cluster_id(int k)
+{
+    return sent.cluster_ids[(k < 0 || k > sent.n) ? 0 : k + 1];
+}
+
 void Configuration::add_arc(int h, int m, const string & l)// h -> m
+{
+    add_arc(h, m, DependencyGraph::label_id(l));
+}
+
+void Configuration::add_arc(int h, int m, int l)// h -> m
 {
     graph.set(m, h, l);
+
+    if (m < h && (lchild[h] == Config::NONEXIST || m < lchild[h]))
+        lchild[h] = m;
+    if (m > h && m > rchild[h]) // NONEXIST is below any node
+        rchild[h] = m;
+
+    if (lhead[m] == Config::NONEXIST || h < lhead[m])
+        lhead[m] = h;
+    if (h > rhead[m])
+        rhead[m] = h;
+    // m and every node below it gain h and the ancestors of h
+    uint64_t * up = &anc_up[0];
+    copy(ancestors.begin() + (size_t)h * anc_words,
+         ancestors.begin() + (size_t)(h + 1) * anc_words, up);
+    up[h >> 6] |= 1ULL << (h & 63);
+    for (int d = 1; d <= graph.n; ++d)
+    {
+        uint64_t * row = &ancestors[(size_t)d * anc_words];
+        if (d != m && !((row[m >> 6] >> (m & 63)) & 1))
+            continue;
+        for (int w = 0; w < anc_words; ++w)
+            row[w] |= up[w];
+    }
 }
 
 string Configuration::get_lvalency(int k)
@@ -362,7 +453,7 @@ string Configuration::get_lvalency_fc(int k)
 
     int cnt = 0;
     for (int i = 1; i < k; ++i){
-        vector<int> h = graph.get_head(i);
+        DependencyGraph::Span h = graph.get_head(i);
         for (int j = 0; j < (int)h.size(); j++){
             if (h[j] == k)
                 cnt += 1;
@@ -387,7 +478,7 @@ string Configuration::get_rvalency_fc(int k)
 
     int cnt = 0;
     for (int i = graph.n; i > k; --i){
-        vector<int> h = graph.get_head(i);
+        DependencyGraph::Span h = graph.get_head(i);
         for (int j = 0; j < (int)h.size(); j++){
             if (h[j] == k)
                 cnt += 1;
@@ -412,13 +503,19 @@ string Configuration::get_rhvalency(int k)
     return encode_valency("RH", rhvalency[k]);
 }
 
+/**
+ * cnt-th child of k from the left (among the children left of k);
+ *  the first one is kept up to date by add_arc
+ */
 int Configuration::get_left_child(int k, int cnt)
 {
     if (k < 0 || k > graph.n)
         return Config::NONEXIST;
+    if (cnt == 1)
+        return lchild[k];
     int c = 0;
     for (int i = 1; i < k; ++i){
-        vector<int> h = graph.get_head(i);
+        DependencyGraph::Span h = graph.get_head(i);
         for (int j = 0; j < (int)h.size(); j++){
             if (h[j] == k)
                 if ((++c) == cnt)
@@ -437,10 +534,12 @@ int Configuration::get_right_child(int k, int cnt)
 {
     if (k < 0 || k > graph.n)
         return Config::NONEXIST;
+    if (cnt == 1)
+        return rchild[k];
 
     int c = 0;
     for (int i = graph.n; i > k; --i){
-        vector<int> h = graph.get_head(i);
+        DependencyGraph::Span h = graph.get_head(i);
         for (int j = 0; j < (int)h.size(); j++){
             if (h[j] == k)
                 if ((++c) == cnt)
@@ -455,14 +554,20 @@ int Configuration::get_right_child(int k)
     return get_right_child(k, 1);
 }
 //-------------------------get head------------------------
+/**
+ * cnt-th smallest head of k; the smallest one is kept
+ *  up to date by add_arc
+ */
 int Configuration::get_left_head(int k, int cnt)
 {
     if (k < 0 || k > graph.n)
         return Config::NONEXIST;
-    int c = 0;
-    vector<int> h = graph.get_head(k);
+    if (cnt == 1)
+        return lhead[k];
+    DependencyGraph::Span heads = graph.get_head(k);
+    vector<int> h(heads.begin(), heads.end());
     sort(h.begin(), h.end());
-    if (h.size() >= cnt)
+    if ((int)h.size() >= cnt)
         return h[cnt-1];
     return Config::NONEXIST;
 }
@@ -472,14 +577,17 @@ int Configuration::get_left_head(int k)
     return get_left_head(k, 1);
 }
 
+// cnt-th largest head of k
 int Configuration::get_right_head(int k, int cnt)
 {
     if (k < 0 || k > graph.n)
         return Config::NONEXIST;
-    int c = 0;
-    vector<int> h = graph.get_head(k);
+    if (cnt == 1)
+        return rhead[k];
+    DependencyGraph::Span heads = graph.get_head(k);
+    vector<int> h(heads.begin(), heads.end());
     sort(h.begin(), h.end());
-    if (h.size() >= cnt)
+    if ((int)h.size() >= cnt)
         return h[h.size() - cnt];
     return Config::NONEXIST;
 }
@@ -491,10 +599,10 @@ int Configuration::get_right_head(int k)
 //-----------------
 bool Configuration::multi_head_in_buffer(int k, DependencyGraph& gold_graph)//check if k is a node with multihead in buffer
 {
-    vector<int> gold_head = gold_graph.get_head(k);
+    DependencyGraph::Span gold_head = gold_graph.get_head(k);
     if (gold_head.size()==1)
         return false;
-    vector<int> head = graph.get_head(k);
+    DependencyGraph::Span head = graph.get_head(k);
     if (head.size()+1 >= gold_head.size())
         return false;
     for (int i = 0; i < gold_head.size(); i++){
@@ -511,8 +619,8 @@ bool Configuration::multi_head_in_buffer(int k, DependencyGraph& gold_graph)//ch
 
 bool Configuration::lack_head(int k, DependencyGraph& gold_graph) // return if add head of k is in graph
 {
-    vector<int> gh = gold_graph.get_head(k);
-    vector<int> h = graph.get_head(k);
+    DependencyGraph::Span gh = gold_graph.get_head(k);
+    DependencyGraph::Span h = graph.get_head(k);
     if ((int)gh.size() > (int)h.size())
         return true;
     return false;
@@ -520,8 +628,8 @@ bool Configuration::lack_head(int k, DependencyGraph& gold_graph) // return if a
 
 bool Configuration::has_other_head(int k, DependencyGraph& gold_graph) // return if all head of k except 1 is in graph 
 {
-    vector<int> gh = gold_graph.get_head(k);
-    vector<int> h = graph.get_head(k);
+    DependencyGraph::Span gh = gold_graph.get_head(k);
+    DependencyGraph::Span h = graph.get_head(k);
     if ((int)gh.size() > (int)h.size()+1)
         return true;
     /*
@@ -538,13 +646,15 @@ bool Configuration::has_other_head(int k, DependencyGraph& gold_graph) // return
 }
 
 bool Configuration::has_path_to(int k, int h) //return if node k has path to head h
-{    
-    return search_path(k, h);
+{
+    if (h <= 0 || h > graph.n || k < 0 || k > graph.n)
+        return false;
+    return (ancestors[(size_t)h * anc_words + (k >> 6)] >> (k & 63)) & 1;
 }
 
 bool Configuration::search_path(int k, int h) // return if k has path to h
 {
-    std::vector<int> heads = graph.get_head(h);
+    DependencyGraph::Span heads = graph.get_head(h);
     if (heads.size() == 0 
         || (heads.size() == 1 && heads[0] == Config::NONEXIST))
         return false;
@@ -561,8 +671,8 @@ bool Configuration::has_other_child_in_stack(int k, DependencyGraph& gold_graph)
 {
     int n_stack = get_stack_size();
     for (int i = 1; i < n_stack; ++i){ //for every word in stack
-        vector<int> gh = gold_graph.get_head(get_stack(i));
-        vector<int> h = graph.get_head(get_stack(i));
+        DependencyGraph::Span gh = gold_graph.get_head(get_stack(i));
+        DependencyGraph::Span h = graph.get_head(get_stack(i));
         for (int j = 0; j < (int)gh.size(); j++){
             if (gh[j] == k){
                 bool find_flag = false;
@@ -591,8 +701,8 @@ bool Configuration::node_in_stack(int k)
 
 bool Configuration::has_other_head_in_stack(int k, DependencyGraph& gold_graph) //except top stack  in stack[0]
 {
-    vector<int> gh = gold_graph.get_head(k);
-    vector<int> h = graph.get_head(k);
+    DependencyGraph::Span gh = gold_graph.get_head(k);
+    DependencyGraph::Span h = graph.get_head(k);
     for (int i = 0; i < gh.size(); i++){
         if (node_in_stack(gh[i])){ // if the gold head is in stack
             bool find_flag = false;
@@ -609,8 +719,8 @@ bool Configuration::has_other_head_in_stack(int k, DependencyGraph& gold_graph)
 bool Configuration::has_other_child(int k, DependencyGraph& gold_graph)
 {
     for (int i = 1; i <= graph.n; ++i){
-        vector<int> gh = gold_graph.get_head(i);
-        vector<int> h = graph.get_head(i);
+        DependencyGraph::Span gh = gold_graph.get_head(i);
+        DependencyGraph::Span h = graph.get_head(i);
         for (int j = 0; j < (int)gh.size(); j++){
             if (gh[j] == k){
                 bool find_flag = false;
@@ -632,7 +742,7 @@ int Configuration::get_left_valency(int k)
         return Config::NONEXIST;
     int cnt = 0;
     for (int i = 0; i < k; ++k){
-        vector<int> h = graph.get_head(i);
+        DependencyGraph::Span h = graph.get_head(i);
         for (int j = 0; j < (int)h.size(); j++){
             if (h[j] == k)
                 ++ cnt;
@@ -647,7 +757,7 @@ int Configuration::get_right_valency(int k)
         return Config::NONEXIST;
     int cnt = 0;
     for (int i = k + 1; i <= graph.n; ++k){
-        vector<int> h = graph.get_head(i);
+        DependencyGraph::Span h = graph.get_head(i);
         for (int j = 0; j < (int)h.size(); j++){
             if (h[j] == k)
                 ++ cnt;
@@ -665,7 +775,7 @@ bool  Configuration::is_graph()
 {
     int root_num = 0;
     for (int i = 1; i <= graph.n; i++){
-        vector<int> h = graph.get_head(i);
+        DependencyGraph::Span h = graph.get_head(i);
         if (h.size() < 1){
             cerr << "headless node " <<endl;
             return false;
@@ -680,7 +790,7 @@ bool  Configuration::is_graph()
         cerr << "no root" << endl;
         for (int i = 1; i <= graph.n; i++){
             cerr << endl << "node:" <<i <<"head:";
-            vector<int> h = graph.get_head(i);
+            DependencyGraph::Span h = graph.get_head(i);
             for (int j = 0; j < h.size(); j++){
                 cerr<< h[j] <<" ";
             }
@@ -2,6 +2,7 @@
 #define __NNDEP_CONFIGURATION_H__
 
 #include <vector>
+#include <stdint.h>
 
 //#include "DependencyTree.h"
 #include "DependencyGraph.h"
@@ -44,16 +45,22 @@ class Configuration
         int get_sent_size();
 
         void save_2nd_head(std::string trans, int score);
+        /**
+         * @dir is 1 for an arc from the buffer front to the stack
+         *  top, -1 for the reverse (ParsingSystem::trans_dirs)
+         */
+        void save_2nd_head(int dir, int label, int score); // @label is a label id
         bool find_2nd_head(int k);
 
-        std::vector<int> get_head(int k);
+        DependencyGraph::Span get_head(int k);
 
         bool has_head(int k); // return if node k has any head
         bool has_head(int k, int h);//return if node k has head h
         
-        const std::vector<std::string>  get_label(int k);
+        DependencyGraph::Span get_label(int k); // label ids
 
         const std::string & get_arc_label(int k, int h);//get the label of node k to head h
+        int get_arc_label_id(int k, int h); // -1 if no such arc
 
         int get_stack(int k);
 
@@ -74,6 +81,18 @@ class Configuration
         std::string get_rhvalency(int k);
         std::string get_lhvalency(int k);
 
+        // valency types, the prefixes "LC", "RC", "LH", "RH"
+        enum { VALENCY_LC = 0, VALENCY_RC, VALENCY_LH, VALENCY_RH, N_VALENCY_TYPES };
+        // buckets of valency_bucket
+        static const int N_VALENCY_BUCKETS = 7;
+
+        /**
+         * the number encoded by get_*valency for valency type @typ
+         *  of node k, -1 (for Config::UNKNOWN) if k is out of range
+         */
+        int get_valency_bucket(int typ, int k);
+        static int valency_bucket(int v);
+
         std::string get_word(int k);
 
         std::string get_pos(int k);
@@ -82,7 +101,18 @@ class Configuration
 
         std::string get_cluster_prefix(int k, int p);
 
+        /**
+         * ids of get_word / get_pos / get_cluster,
+         *  read from the interned sentence (DependencySent::interned)
+         */
+        int get_word_id(int k);
+
+        int get_pos_id(int k);
+
+        int get_cluster_id(int k);
+
         void add_arc(int h, int m, const std::string & l);
+        void add_arc(int h, int m, int l); // @l is a label id
 
         int get_left_child(int k, int cnt);
 
@@ -154,6 +184,27 @@ class Configuration
         std::vector<int> rvalency;
         std::vector<int> lhvalency;
         std::vector<int> rhvalency;
+
+        /**
+         * leftmost/rightmost child and smallest/largest head of
+         *  every node (0 = root), Config::NONEXIST if none.
+         *  Maintained by add_arc, so that the structural features
+         *  are looked up in O(1) instead of scanning the graph.
+         */
+        std::vector<int> lchild;
+        std::vector<int> rchild;
+        std::vector<int> lhead;
+        std::vector<int> rhead;
+
+        /**
+         * ancestor sets: bit a of row k (anc_words 64-bit words per
+         *  row, nodes 0..n) is set iff a path of arcs leads from a
+         *  down to k. Maintained by add_arc, so that has_path_to
+         *  is a bit test instead of a search of the graph.
+         */
+        int anc_words;
+        std::vector<uint64_t> ancestors;
+        std::vector<uint64_t> anc_up; // add_arc scratch, anc_words
 };
 
 #endif
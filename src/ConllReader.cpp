@@ -0,0 +1,265 @@
+#include "ConllReader.h"
+#include "Config.h"
+
+#include <iostream>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+ConllReader::ConllReader(bool labeled)
+    : labeled(labeled), data(NULL), size(0), pos(0), input(NULL),
+      unknown_label(-1), n_non_local(0)
+{
+}
+
+bool ConllReader::open(const char * filename)
+{
+    close();
+
+    if (strcmp(filename, "-") == 0)
+    {
+        input = &cin;
+        return true;
+    }
+
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        cerr << "# fail to open conll file: " << filename << endl;
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+    {
+        if (st.st_size == 0)
+        {
+            ::close(fd);
+            data = (char *)""; // empty: nothing to map
+            return true;
+        }
+
+        void * p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED)
+        {
+            ::close(fd);
+            madvise(p, st.st_size, MADV_SEQUENTIAL);
+            data = (char *)p;
+            size = st.st_size;
+            return true;
+        }
+    }
+    ::close(fd);
+
+    // not mappable (pipe, FIFO...): read it line by line
+    file.open(filename);
+    if (file.fail())
+    {
+        cerr << "# fail to open conll file: " << filename << endl;
+        return false;
+    }
+    input = &file;
+    return true;
+}
+
+void ConllReader::open(istream & in)
+{
+    close();
+    input = &in;
+}
+
+void ConllReader::close()
+{
+    if (data != NULL && size > 0)
+        munmap(data, size);
+    data = NULL;
+    size = 0;
+    pos = 0;
+
+    if (file.is_open())
+        file.close();
+    file.clear();
+    input = NULL;
+    n_non_local = 0;
+}
+
+bool ConllReader::read_line(size_t & b, size_t & e)
+{
+    if (data != NULL)
+    {
+        if (pos >= size)
+            return false;
+        const char * nl = (const char *)memchr(data + pos, '\n', size - pos);
+        b = pos;
+        e = (nl != NULL) ? nl - data : size;
+        pos = (nl != NULL) ? e + 1 : size;
+        return true;
+    }
+
+    if (input == NULL || !getline(*input, line))
+        return false;
+    b = block.size();
+    block += line;
+    e = block.size();
+    return true;
+}
+
+static inline bool is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+int ConllReader::split_line(size_t b, size_t e, Token & t) const
+{
+    // fields 0, 1, 3, 5, 6, 7: id, word, pos, cluster, head, label
+    static const int slot[8] = {0, 1, -1, 2, -1, 3, 4, 5};
+    Field * fields[6] = {&t.id, &t.word, &t.pos, &t.cluster, &t.head, &t.label};
+
+    const char * s = base();
+    int n_fields = 0;
+    size_t i = b;
+    while (true)
+    {
+        while (i < e && is_space(s[i]))
+            ++i;
+        if (i == e)
+            break;
+        size_t j = i;
+        while (j < e && !is_space(s[j]))
+            ++j;
+        if (n_fields < 8 && slot[n_fields] >= 0)
+        {
+            fields[slot[n_fields]]->off = i;
+            fields[slot[n_fields]]->len = j - i;
+        }
+        ++n_fields;
+        i = j;
+    }
+    return n_fields;
+}
+
+// as to_int of strutils.h
+int ConllReader::to_int(const Field & f) const
+{
+    const char * s = base() + f.off;
+    int ret = 0;
+    int sign = 1;
+    int i = 0;
+    if (s[0] == '-')
+    {
+        sign = -1;
+        i = 1;
+    }
+    for (; i < f.len; ++i)
+    {
+        ret *= 10;
+        ret += s[i] - '0';
+    }
+    return sign * ret;
+}
+
+int ConllReader::label_id(const Field & f)
+{
+    if (!labeled) // currently unused
+    {
+        if (unknown_label < 0)
+            unknown_label = DependencyGraph::label_id(Config::UNKNOWN);
+        return unknown_label;
+    }
+
+    key.assign(base() + f.off, f.len);
+    unordered_map<string, int>::iterator it = label_ids.find(key);
+    if (it != label_ids.end())
+        return it->second;
+    int id = DependencyGraph::label_id(key);
+    label_ids[key] = id;
+    return id;
+}
+
+bool ConllReader::next(DependencySent & sent, DependencyGraph & graph)
+{
+    tokens.clear();
+    block.clear();
+
+    size_t b, e;
+    Token t;
+    while (read_line(b, e))
+    {
+        if (split_line(b, e, t) < 10) // end of a sentence
+        {
+            build(sent, graph);
+            return true;
+        }
+        tokens.push_back(t);
+    }
+    return false;
+}
+
+void ConllReader::build(DependencySent & sent, DependencyGraph & graph)
+{
+    int n = 0;
+    for (size_t i = 0; i < tokens.size(); ++i)
+        if (to_int(tokens[i].id) == n + 1)
+            ++n;
+
+    sent.init();
+    sent.words.reserve(n);
+    sent.poss.reserve(n);
+    sent.clusters.reserve(n);
+    graph.init(n);
+
+    const char * s = base();
+    for (size_t i = 0; i < tokens.size(); ++i)
+    {
+        const Token & t = tokens[i];
+        int id = to_int(t.id);
+        if (id == sent.n + 1)
+        {
+            ++sent.n;
+            sent.words.push_back(string(s + t.word.off, t.word.len));
+            sent.poss.push_back(string(s + t.pos.off, t.pos.len));
+            sent.clusters.push_back(string(s + t.cluster.off, t.cluster.len));
+            graph.set(id, to_int(t.head), label_id(t.label));
+        }
+        else if (id == sent.n)
+        {
+            ++n_non_local;
+            graph.set(id, to_int(t.head), label_id(t.label));
+        }
+        else
+            cerr << "# error loading graph!" << endl;
+    }
+}
+
+void ConllReader::load(
+        const char * filename,
+        vector<DependencySent> & sents,
+        vector<DependencyGraph> & graphs,
+        bool labeled)
+{
+    ConllReader reader(labeled);
+    if (!reader.open(filename))
+        return;
+
+    while (true)
+    {
+        sents.push_back(DependencySent());
+        graphs.push_back(DependencyGraph());
+        if (!reader.next(sents.back(), graphs.back()))
+        {
+            sents.pop_back();
+            graphs.pop_back();
+            break;
+        }
+        if (sents.size() % 1000 == 0)
+            cerr << "\r" << sents.size();
+    }
+    cerr << "\r" << sents.size() << endl;
+    cerr << "sentences number:" << sents.size()
+         << "  non-local arc number:" << reader.non_local_arcs() << endl;
+}
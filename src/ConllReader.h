@@ -0,0 +1,114 @@
+#ifndef __NNDEP_CONLL_READER_H__
+#define __NNDEP_CONLL_READER_H__
+
+#include <cstddef>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <unordered_map>
+
+#include "DependencySent.h"
+#include "DependencyGraph.h"
+
+/**
+ * Reader of CoNLL files, giving the same sentences and graphs as
+ *  Util::load_conll_file_graph used to:
+ *  - a line of less than 10 fields ends a sentence (even an empty
+ *    one), the lines after the last such line are dropped
+ *  - a token whose id is the previous one adds a head to it
+ *
+ * A regular file is mapped and scanned in place: fields are views
+ *  (offset, length) into the file, the lines of a sentence are
+ *  tokenized once and the sentence is built at its final size, and
+ *  arc labels go to DependencyGraph ids through a local cache, with
+ *  no string per arc nor lock. Other inputs (stdin, pipes) are read
+ *  line by line into a buffer reused for every sentence.
+ */
+class ConllReader
+{
+    public:
+        ConllReader(bool labeled = true);
+        ~ConllReader() { close(); }
+
+        /**
+         * open @filename, "-" for stdin;
+         *  false (with a message on cerr) if it cannot be read
+         */
+        bool open(const char * filename);
+        // read @in (kept by the caller until close), line by line
+        void open(std::istream & in);
+        void close();
+
+        /**
+         * read the next sentence into @sent and @graph,
+         *  false at the end of the input
+         */
+        bool next(DependencySent & sent, DependencyGraph & graph);
+
+        // lines with the id of the previous token, so far
+        int non_local_arcs() const { return n_non_local; }
+
+        /**
+         * append all the sentences of @filename to @sents and
+         *  @graphs, with a progress line every 1000 sentences
+         */
+        static void load(
+                const char * filename,
+                std::vector<DependencySent> & sents,
+                std::vector<DependencyGraph> & graphs,
+                bool labeled);
+
+    private:
+        // not copyable: the mapping is owned
+        ConllReader(const ConllReader &);
+        ConllReader & operator=(const ConllReader &);
+
+        // view of a field, from base()
+        struct Field
+        {
+            size_t off;
+            int len;
+        };
+
+        // the fields used of a token line
+        struct Token
+        {
+            Field id, word, pos, cluster, head, label;
+        };
+
+        const char * base() const { return data != NULL ? data : block.data(); }
+
+        // the next line is [@b, @e) from base(); false at the end
+        bool read_line(size_t & b, size_t & e);
+
+        // fields of the line [@b, @e) into @t, returns their number
+        int split_line(size_t b, size_t e, Token & t) const;
+
+        // build @sent and @graph from @tokens
+        void build(DependencySent & sent, DependencyGraph & graph);
+
+        int to_int(const Field & f) const;
+        int label_id(const Field & f);
+
+        bool labeled;
+
+        // mapped file
+        char * data;
+        size_t size;
+        size_t pos;
+
+        // line by line input
+        std::ifstream file;
+        std::istream * input;
+        std::string line;
+        std::string block; // lines of the current sentence
+
+        std::vector<Token> tokens; // of the current sentence
+        std::unordered_map<std::string, int> label_ids;
+        std::string key;
+        int unknown_label;
+
+        int n_non_local;
+};
+
+#endif
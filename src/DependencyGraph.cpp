@@ -2,9 +2,62 @@
 #include "Config.h"
 
 #include <iostream>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
 
 using namespace std;
 
+namespace {
+
+// process-wide label table behind DependencyGraph::label_id
+struct LabelTable
+{
+    std::mutex lock;
+    unordered_map<string, int> ids;
+    deque<string> names; // references stay valid as it grows
+};
+
+LabelTable & label_table()
+{
+    static LabelTable table;
+    return table;
+}
+
+const int NONEXIST_HEAD = Config::NONEXIST;
+const int NIL_LABEL = -1;
+
+}
+
+int DependencyGraph::label_id(const string & l)
+{
+    LabelTable & table = label_table();
+    lock_guard<mutex> guard(table.lock);
+    unordered_map<string, int>::iterator it = table.ids.find(l);
+    if (it != table.ids.end())
+        return it->second;
+    int id = table.names.size();
+    table.names.push_back(l);
+    table.ids[l] = id;
+    return id;
+}
+
+const string & DependencyGraph::label_name(int id)
+{
+    if (id < 0)
+        return Config::NIL;
+    LabelTable & table = label_table();
+    lock_guard<mutex> guard(table.lock);
+    return table.names[id];
+}
+
+int DependencyGraph::num_labels()
+{
+    LabelTable & table = label_table();
+    lock_guard<mutex> guard(table.lock);
+    return table.names.size();
+}
+
 DependencyGraph::DependencyGraph()
 {
     init();
@@ -12,99 +65,140 @@ DependencyGraph::DependencyGraph()
 
 void DependencyGraph::init()
 {
-    n = 0;
-    heads.clear();
-    labels.clear();
-    std::vector<int> h;
-    std::vector<std::string> l;
-    h.push_back(Config::NONEXIST);
-    l.push_back(Config::UNKNOWN);
-    heads.push_back(h);
-    labels.push_back(l);
+    init(0);
 }
 
-DependencyGraph::DependencyGraph(const DependencyGraph& graph)
+void DependencyGraph::init(int n)
 {
-    n = graph.n;
-    heads = graph.heads;
-    labels = graph.labels;
+    this->n = n;
+    arc_n = 0;
+    nodes.assign(n + 1, Node());
+    for (int k = 0; k <= n; ++k)
+    {
+        nodes[k].size = 0;
+        nodes[k].cap = 0;
+        nodes[k].spill = 0;
+    }
+    spill_heads.clear();
+    spill_labels.clear();
+
+    // the root has the single head NONEXIST
+    nodes[0].size = 1;
+    nodes[0].heads[0] = Config::NONEXIST;
+    nodes[0].labels[0] = NIL_LABEL;
 }
 
 void DependencyGraph::add(const std::vector<int> & h, const std::vector<std::string> & l)
 {
     ++n;
-    arc_n += (int)h.size();
-    heads.push_back(h);
-    labels.push_back(l);
+    Node node;
+    node.size = 0;
+    node.cap = 0;
+    node.spill = 0;
+    nodes.push_back(node);
+    for (size_t i = 0; i < h.size(); ++i)
+        set(n, h[i], l[i]);
 }
 
 void DependencyGraph::set(int k, int h, const std::string & l)
 {
-    arc_n += 1;
-    heads[k].push_back(h);
-    labels[k].push_back(l);
+    set(k, h, label_id(l));
 }
 
-const vector<int> DependencyGraph::get_head(int k) const
+void DependencyGraph::set(int k, int h, int l)
 {
-    if (k <= 0 || k > n){
-        std::vector<int> h;
-        h.push_back(Config::NONEXIST);
-        return h;
+    arc_n += 1;
+    Node & node = nodes[k];
+    if (node.cap == 0 && node.size < INLINE_HEADS)
+    {
+        node.heads[node.size] = h;
+        node.labels[node.size] = l;
+        ++ node.size;
+        return;
     }
-    return heads[k];
+
+    if (node.size == node.cap || node.cap == 0)
+    {
+        // move to a block twice as large at the end of the pool
+        int cap = 2 * node.size;
+        int off = spill_heads.size();
+        spill_heads.resize(off + cap);
+        spill_labels.resize(off + cap);
+        for (int i = 0; i < node.size; ++i)
+        {
+            spill_heads[off + i] = node.cap ? spill_heads[node.spill + i] : node.heads[i];
+            spill_labels[off + i] = node.cap ? spill_labels[node.spill + i] : node.labels[i];
+        }
+        node.spill = off;
+        node.cap = cap;
+    }
+    spill_heads[node.spill + node.size] = h;
+    spill_labels[node.spill + node.size] = l;
+    ++ node.size;
+}
+
+DependencyGraph::Span DependencyGraph::get_head(int k) const
+{
+    if (k <= 0 || k > n)
+        return Span(&NONEXIST_HEAD, 1);
+    const Node & node = nodes[k];
+    return Span(node.cap ? &spill_heads[node.spill] : node.heads, node.size);
 }
 
 int DependencyGraph::get_head_num(int k)
 {
     if (k <= 0 || k > n)
         return Config::NONEXIST;
-    return heads[k].size();
+    return nodes[k].size;
 }
 
 bool DependencyGraph::has_head(int k)
 {
-    return (heads[k].size() > 0);
+    return (nodes[k].size > 0);
 }
 
 bool DependencyGraph::has_head(int k, int h)
 {
     if (k <= 0 || k > n)
         return false;
-    std::vector<int> head = get_head(k);
-    for (int i = 0; i < (int)head.size(); i++){
+    Span head = get_head(k);
+    for (int i = 0; i < head.size(); i++){
         if (head[i] == h)
             return true;
     }
     return false;
 }
 
-const std::vector<std::string> DependencyGraph::get_label(int k)
+DependencyGraph::Span DependencyGraph::get_label(int k) const
 {
-    if (k <= 0 || k > n){
-        std::vector<std::string> l;
-        l.push_back(Config::NIL);
-        return l;
-    }
-    return labels[k];   
+    if (k <= 0 || k > n)
+        return Span(&NIL_LABEL, 1);
+    const Node & node = nodes[k];
+    return Span(node.cap ? &spill_labels[node.spill] : node.labels, node.size);
 }
 
-const string & DependencyGraph::get_arc_label(int k, int h) // get label between node k and its head h
+int DependencyGraph::get_arc_label_id(int k, int h) const // label id between node k and its head h
 {
     if (k <= 0 || k > n)
-        return Config::NIL;
-    for (int i = 0; i < (int)heads[k].size(); i++){
-        if (heads[k][i] == h){
-            return labels[k][i];
+        return NIL_LABEL;
+    Span heads = get_head(k);
+    for (int i = 0; i < heads.size(); i++){
+        if (heads[i] == h){
+            return get_label(k)[i];
         }
     }
-    return Config::NIL;
+    return NIL_LABEL;
+}
+
+const string & DependencyGraph::get_arc_label(int k, int h) // get label between node k and its head h
+{
+    return label_name(get_arc_label_id(k, h));
 }
 
 int DependencyGraph::get_root()
 {
     for (int k = 1; k <= n; ++k){
-        vector<int> heads = get_head(k);
+        Span heads = get_head(k);
         for (int j = 0; j < (int)heads.size(); j++){
             if (heads[j] == 0)
                 return k;
@@ -117,8 +211,9 @@ bool DependencyGraph::is_root(int k)
 {
     if (k <=0 || k > n)
         return false;
-    for(int i = 0; i < heads[k].size(); i++)
-        if (heads[k][i] == 0)
+    Span heads = get_head(k);
+    for(int i = 0; i < heads.size(); i++)
+        if (heads[i] == 0)
             return true;
     return false;
 }
@@ -127,7 +222,7 @@ bool DependencyGraph::is_single_root()
 {
     int roots = 0;
     for (int k = 1; k <= n; ++k){
-        vector<int> heads = get_head(k);
+        Span heads = get_head(k);
         for (int j = 0; j < (int)heads.size(); j++){
             if (heads[j] == 0)
                 roots += 1;
@@ -151,7 +246,7 @@ bool DependencyGraph::is_tree()
     }
     for (int k = 1; k <= n ; ++k)
     {
-        vector<int> heads = get_head(k);
+        Span heads = get_head(k);
         if ((int)heads.size() > 1)
             return false;
         for (int j = 0; j < (int)heads.size(); j++){
@@ -213,7 +308,7 @@ void DependencyGraph::print()
 {
     for (int i = 0; i <= n; ++i){
         cerr << i << ":" ;
-        vector<int> h = get_head(i);
+        Span h = get_head(i);
         for(int j = 0; j < h.size(); j++)
              cerr<< h[j]<<"-" << get_arc_label(i, h[j]) << " ";
          cerr<<endl;
@@ -5,25 +5,64 @@
 #include <string>
 #include <tuple>
 
+/**
+ * Dependency graph over nodes 0 (root) .. n.
+ *
+ * The heads of a node and the labels of these arcs are kept inline
+ *  for up to INLINE_HEADS heads (the common case), and only nodes
+ *  with more heads move to a shared spill pool, so a graph is a
+ *  handful of flat vectors: copying it or adding an arc does not
+ *  allocate per node.
+ *
+ * Labels are ids of a process-wide table (label_id / label_name);
+ *  -1 stands for Config::NIL (no label).
+ */
 class DependencyGraph
 {
+    public:
+        // read-only view of the heads (or label ids) of a node
+        class Span
+        {
+            public:
+                Span(const int * p, int n) : p(p), n(n) {}
+
+                int size() const { return n; }
+                bool empty() const { return n == 0; }
+                int operator[](int i) const { return p[i]; }
+                const int * begin() const { return p; }
+                const int * end() const { return p + n; }
+
+            private:
+                const int * p;
+                int n;
+        };
+
+        static const int INLINE_HEADS = 2;
+
     public:
         DependencyGraph();
-        DependencyGraph(const DependencyGraph& graph);
-        ~DependencyGraph() {}
 
         void init();
+        // @n nodes without any head
+        void init(int n);
 
         void add(const std::vector<int> & h, const std::vector<std::string> & l);
         void set(int k, int h, const std::string & l);
+        void set(int k, int h, int l); // @l is a label id
 
-        const std::vector<int> get_head(int k) const;
+        /**
+         * heads of node k, in the order they were added;
+         *  {Config::NONEXIST} out of [1, n]
+         */
+        Span get_head(int k) const;
         int get_head_num(int k);
-        const std::vector<std::string>  get_label(int k);
+        // label ids of the arcs of get_head(k); {-1} out of [1, n]
+        Span get_label(int k) const;
 
         bool has_head(int k); //return if node k has any head
         bool has_head(int k, int h);//return if node k has head h
         const std::string & get_arc_label(int k, int h);//get the label of node k to head h
+        int get_arc_label_id(int k, int h) const; // -1 if no such arc
 
         int get_root();
         bool is_single_root();
@@ -48,14 +87,34 @@ class DependencyGraph
 
        void print();
 
+        /**
+         * id of label @l, added to the table on first use
+         *  (thread-safe; ids are stable for the whole process)
+         */
+        static int label_id(const std::string & l);
+        static const std::string & label_name(int id);
+        static int num_labels();
+
    // private:
       //  bool visit_tree(int w);
 
+    private:
+        struct Node
+        {
+            int size;   // number of heads
+            int cap;    // capacity of the spilled block, 0 while inline
+            int spill;  // offset of the block in spill_heads/spill_labels
+            int heads[INLINE_HEADS];
+            int labels[INLINE_HEADS];
+        };
+
+        std::vector<Node> nodes; // [0] is the root, with head NONEXIST
+        std::vector<int> spill_heads;
+        std::vector<int> spill_labels;
+
     public:
         int n;
         int arc_n;//denote the arc number
-        std::vector<std::vector<int>> heads;
-        std::vector<std::vector<std::string>> labels;
 
         std::vector<int> proj_order;
 
@@ -14,9 +14,18 @@
 #include "DependencyParser.h"
 #include "Util.h"
 #include "Config.h"
+#include "Random.h"
+#include "ModelFile.h"
+#include "ConllReader.h"
 #include "time.h"
 
 #include <omp.h>
+#include <cstring>
+#include <map>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 // #include "../utils/io.h"
 // #include "../utils/logging.h"
 
@@ -25,11 +34,15 @@ using namespace std;
 DependencyParser::DependencyParser(const char * cfg_filename)
 {
     config.set_properties(cfg_filename);
+    if (config.seed != 0)
+        srand(config.seed);
 }
 
 DependencyParser::DependencyParser(string& cfg_filename)
 {
     config.set_properties(cfg_filename.c_str());
+    if (config.seed != 0)
+        srand(config.seed);
 }
 
 DependencyParser::~DependencyParser()
@@ -162,8 +175,16 @@ void DependencyParser::train(
          * Compute current cost
          * and all gradients
          */
+        // fix all words, except -UNKNOWN-, -NULL-, and -ROOT-
+        int E_start_pos = 0;
+        if (config.fix_word_embeddings && !config.delexicalized)
+            E_start_pos = known_words.size() - 3;
+
         double before = get_time();
-        classifier->compute_cost_function();
+        if (config.hogwild)
+            classifier->train_hogwild(E_start_pos); // updates as it goes
+        else
+            classifier->compute_cost_function();
         double after = get_time();
         // double cost = classifier->get_cost();
         cerr << "#Iteration " << iter << ": "
@@ -174,14 +195,12 @@ void DependencyParser::train(
         /**
          * update gradient using AdaGrad
          */
-        // fix all words, except -UNKNOWN-, -NULL-, and -ROOT-
-        if (config.fix_word_embeddings && !config.delexicalized)
-            classifier->take_ada_gradient_step(known_words.size() - 3);
-        else
-            classifier->take_ada_gradient_step();
+        if (!config.hogwild)
+            classifier->take_ada_gradient_step(E_start_pos);
 
         if (dev_file[0] != 0 && iter % config.eval_per_iter == 0)
         {
+            classifier->apply_pending_l2();
             classifier->pre_compute(); // with updated weights
             vector<DependencyGraph> predicted;
             predict_graph(dev_sents, predicted);
@@ -325,11 +344,16 @@ void DependencyParser::finetune(
     //
     // Besides, fix_word_embeddings should be true
     cerr << "Load model trained from source language." << endl;
-    if (config.delexicalized)   load_model(premodel_file);
-    else                        load_model_cl(premodel_file, emb_file);
+    if (config.delexicalized)
+    {
+        if (!load_model(premodel_file))
+            exit(1);
+    }
+    else
+        load_model_cl(premodel_file, emb_file);
 
     Dataset dataset = gen_train_samples_graph(train_sents, train_graphs);
-    // classifier = new NNClassifier(config, dataset, Eb, Ed, Ev, Ec, W1, b1, W2, pre_computed_ids);
+    // classifier = new NNClassifier<nn_real>(config, dataset, Eb, Ed, Ev, Ec, W1, b1, W2, pre_computed_ids);
     // if (classifier) delete classifier;
     classifier->set_dataset(dataset, pre_computed_ids);
     config.print_info();
@@ -339,7 +363,10 @@ void DependencyParser::finetune(
     for (int iter = 1; iter <= config.finetune_iter; ++iter)
     {
         double before = get_time();
-        classifier->compute_cost_function();
+        if (config.hogwild)
+            classifier->train_hogwild(known_words.size() - 3);
+        else
+            classifier->compute_cost_function();
         double after = get_time();
         cerr << "#Iteration " << (iter + 1) << ": "
              << "Cost = " << classifier->get_loss()
@@ -347,7 +374,8 @@ void DependencyParser::finetune(
              << " (" << (after - before) << ")"
              << endl;
 
-        classifier->take_ada_gradient_step(known_words.size() - 3);
+        if (!config.hogwild)
+            classifier->take_ada_gradient_step(known_words.size() - 3);
         if (iter % 50 == 0)
             save_model(string(model_file) + "." + to_str(iter));
     }
@@ -495,14 +523,14 @@ void DependencyParser::gen_dictionaries_graph(
         {
             for (int j = 1; j <= graphs[i].n; ++j)
             {
-                vector<int> h = graphs[i].get_head(j);
-                vector<std::string> l = graphs[i].get_label(j);
+                DependencyGraph::Span h = graphs[i].get_head(j);
+                DependencyGraph::Span l = graphs[i].get_label(j);
                 for (int k = 0; k < (int)h.size(); k++){
                     if (h[k] == 0){
-                        root_label = l[k];
+                        root_label = DependencyGraph::label_name(l[k]);
                     } 
                     else{
-                        string label = l[k];
+                        const string & label = DependencyGraph::label_name(l[k]);
                         if (label != root_label)
                             all_labels.push_back(label);
                     }
@@ -674,6 +702,17 @@ void DependencyParser::collect_dynamic_features(
     known_lengths = Util::generate_dict(all_lengths);
 }
 
+/**
+ * uniform in [-range, range] for entry (i, j) of the matrix numbered
+ *  @m: a counter-based stream per row, so the parallel loops below
+ *  share no random state and a fixed config.seed gives the same
+ *  weights for any number of threads
+ */
+static inline double init_value(uint64_t seed, int m, int i, int j, double range)
+{
+    return (Random::uniform(Random::stream_key(seed, m, i), j) * 2 - 1) * range;
+}
+
 void DependencyParser::setup_classifier_for_training(
         vector<DependencySent> & sents,
         vector<DependencyGraph> & graphs,
@@ -699,11 +738,11 @@ void DependencyParser::setup_classifier_for_training(
     if (config.use_length)
         El_entries = known_lengths.size();
 
-    Mat<double> Eb(0.0, Eb_entries, config.embedding_size);
-    Mat<double> Ed(0.0, Ed_entries, config.distance_embedding_size);
-    Mat<double> Ev(0.0, Ev_entries, config.valency_embedding_size);
-    Mat<double> Ec(0.0, Ec_entries, config.cluster_embedding_size);
-    Mat<double> El(0.0, El_entries, config.length_embedding_size);
+    Mat<nn_real> Eb(0.0, Eb_entries, config.embedding_size);
+    Mat<nn_real> Ed(0.0, Ed_entries, config.distance_embedding_size);
+    Mat<nn_real> Ev(0.0, Ev_entries, config.valency_embedding_size);
+    Mat<nn_real> Ec(0.0, Ec_entries, config.cluster_embedding_size);
+    Mat<nn_real> El(0.0, El_entries, config.length_embedding_size);
 
     int W1_ncol = config.embedding_size * config.num_basic_tokens;
     if (config.use_distance)
@@ -716,31 +755,32 @@ void DependencyParser::setup_classifier_for_training(
         W1_ncol += config.length_embedding_size * config.num_length_tokens;
 
     cerr << "W1_ncol = " << W1_ncol << endl;
-    Mat<double> W1(0.0, config.hidden_size, W1_ncol);
-    Vec<double> b1(0.0, config.hidden_size);
+    Mat<nn_real> W1(0.0, config.hidden_size, W1_ncol);
+    Vec<nn_real> b1(0.0, config.hidden_size);
     int n_actions = 0;
     if (config.oracle == "arceager")
         n_actions = (config.labeled) ? (known_labels.size() * 4 - 4) : 7;// attach system
     else if (config.oracle == "listsystem")
         n_actions = (config.labeled) ? (known_labels.size() * 3 - 3) : 5;// list system
-    Mat<double> W2(0.0, n_actions, config.hidden_size);
+    Mat<nn_real> W2(0.0, n_actions, config.hidden_size);
 
     // Randomly initialize weight matrices / vectors
+    uint64_t seed = Random::seed_or_clock(config.seed);
     double W1_init_range = sqrt(6.0 / (W1.nrows() + W1.ncols()));
     #pragma omp parallel for
     for (int i = 0; i < W1.nrows(); ++i)
         for (int j = 0; j < W1.ncols(); ++j)
-            W1[i][j] = (Util::rand_double() * 2 - 1) * W1_init_range;
+            W1[i][j] = init_value(seed, 0, i, j, W1_init_range);
 
     #pragma omp parallel for
     for (int i = 0; i < b1.size(); ++i)
-        b1[i] = (Util::rand_double() * 2 - 1) * W1_init_range;
+        b1[i] = init_value(seed, 1, 0, i, W1_init_range);
 
     double W2_init_range = sqrt(6.0 / (W2.nrows() + W2.ncols()));
     #pragma omp parallel for
     for (int i = 0; i < W2.nrows(); ++i)
         for (int j = 0; j < W2.ncols(); ++j)
-            W2[i][j] = (Util::rand_double() * 2 - 1) * W2_init_range;
+            W2[i][j] = init_value(seed, 2, i, j, W2_init_range);
 
     // Match the embedding vocabulary with words in dictionary
     int in_embed = 0;
@@ -750,7 +790,7 @@ void DependencyParser::setup_classifier_for_training(
         if (config.delexicalized)
         {
             for (int j = 0; j < Eb.ncols(); ++j)
-                Eb[i][j] = (Util::rand_double() * 2 - 1) * config.init_range;
+                Eb[i][j] = init_value(seed, 3, i, j, config.init_range);
             continue;
         }
 
@@ -782,25 +822,25 @@ void DependencyParser::setup_classifier_for_training(
         else
         {
             for (int j = 0; j < Eb.ncols(); ++j)
-                Eb[i][j] = (Util::rand_double() * 2 - 1) * config.init_range;
+                Eb[i][j] = init_value(seed, 3, i, j, config.init_range);
         }
     }
     #pragma omp parallel for
     for (int i = 0; i < Ed.nrows(); ++i)
         for (int j = 0; j < Ed.ncols(); ++j)
-            Ed[i][j] = (Util::rand_double() * 2 - 1) * config.init_range;
+            Ed[i][j] = init_value(seed, 4, i, j, config.init_range);
     #pragma omp parallel for
     for (int i = 0; i < Ev.nrows(); ++i)
         for (int j = 0; j < Ev.ncols(); ++j)
-            Ev[i][j] = (Util::rand_double() * 2 - 1) * config.init_range;
+            Ev[i][j] = init_value(seed, 5, i, j, config.init_range);
     #pragma omp parallel for
     for (int i = 0; i < Ec.nrows(); ++i)
         for (int j = 0; j < Ec.ncols(); ++j)
-            Ec[i][j] = (Util::rand_double() * 2 - 1) * config.init_range;
+            Ec[i][j] = init_value(seed, 6, i, j, config.init_range);
     #pragma omp parallel for
     for (int i = 0; i < El.nrows(); ++i)
         for (int j = 0; j < El.ncols(); ++j)
-            El[i][j] = (Util::rand_double() * 2 - 1) * config.init_range;
+            El[i][j] = init_value(seed, 7, i, j, config.init_range);
 
     cerr << "Found embeddings: "
          << in_embed
@@ -956,12 +996,13 @@ void DependencyParser::setup_classifier_for_training(
      * setup the classifier
      */
     cerr << "create classifier" << endl;
-    classifier = new NNClassifier(config, dataset, Eb, Ed, Ev, Ec, El, W1, b1, W2, pre_computed_ids);
+    classifier = new NNClassifier<nn_real>(config, dataset, Eb, Ed, Ev, Ec, El, W1, b1, W2, pre_computed_ids);
 }
 
 void DependencyParser::generate_ids()
 {
     int index = 0;
+    label_feats.clear();
 
     for (size_t i = 0; i < known_words.size(); ++i)
         word_ids[known_words[i]] = index++;
@@ -996,6 +1037,8 @@ void DependencyParser::generate_ids()
     if (config.use_length)
         for (size_t i = 0; i < known_lengths.size(); ++i)
             length_ids[known_lengths[i]] = index++;
+
+    generate_feature_tables();
     /* debug
     cerr << "word_ids" << endl;
     for (map<string, int>::iterator iter = word_ids.begin();
@@ -1017,6 +1060,40 @@ void DependencyParser::generate_ids()
     */
 }
 
+void DependencyParser::generate_feature_tables()
+{
+    static const char * valency_types[Configuration::N_VALENCY_TYPES] =
+            {"LC", "RC", "LH", "RH"};
+    int n_slots = Configuration::N_VALENCY_BUCKETS + 1;
+    valency_feats.resize(Configuration::N_VALENCY_TYPES * n_slots);
+    for (int t = 0; t < Configuration::N_VALENCY_TYPES; ++t)
+    {
+        valency_feats[t * n_slots] = get_valency_id(Config::UNKNOWN);
+        for (int b = 0; b < Configuration::N_VALENCY_BUCKETS; ++b)
+            valency_feats[t * n_slots + b + 1] =
+                get_valency_id(valency_types[t] + to_str(b));
+    }
+
+    // encoded distances are in [0, 6], see Configuration::encode_distance
+    distance_feats.resize(7);
+    for (size_t d = 0; d < distance_feats.size(); ++d)
+        distance_feats[d] = get_distance_id(d);
+
+    int max_length = 0;
+    for (size_t i = 0; i < known_lengths.size(); ++i)
+        max_length = max(max_length, known_lengths[i]);
+    length_feats.resize(max_length + 2);
+    for (int l = 0; l <= max_length; ++l)
+        length_feats[l] = get_length_id(l);
+    length_feats.back() = get_length_id(Config::UNKNOWN_INT);
+}
+
+int DependencyParser::get_valency_feat(Configuration& c, int typ, int k)
+{
+    return valency_feats[typ * (Configuration::N_VALENCY_BUCKETS + 1)
+                         + c.get_valency_bucket(typ, k) + 1];
+}
+
 Dataset DependencyParser::gen_train_samples_graph(
         vector<DependencySent> & sents,
         vector<DependencyGraph> & graphs)
@@ -1027,6 +1104,8 @@ Dataset DependencyParser::gen_train_samples_graph(
     cerr << Config::SEPERATOR << endl;
     cerr << "Generating training examples..." << endl;
     unordered_map<int, int> tokpos_count;
+    intern(sents);
+    vector<char> legal;
 
     int error_cnt = 0;
     for (size_t i = 0; i < sents.size(); ++i)
@@ -1071,12 +1150,13 @@ Dataset DependencyParser::gen_train_samples_graph(
                 }
                 vector<int> features = get_features(c);
                 // int label = system->get_transition_id(oracle);
+                int oracle_id = system->find_transition(oracle);
+                system->legal_mask(c, legal);
                 vector<int> label(num_trans, -1);
                 for (int j = 0; j < num_trans; ++j)
                 {
-                    string action = system->transitions[j];
-                    if (action == oracle) label[j] = 1;
-                    else if (system->can_apply(c, action)) label[j] = 0;
+                    if (j == oracle_id) label[j] = 1;
+                    else if (legal[j]) label[j] = 0;
                     // else label.push_back(-1);
                 }
 
@@ -1125,6 +1205,7 @@ void DependencyParser::scan_test_samples(
 {
     unordered_map<int, int> tokpos_count;
     precompute_ids.clear();
+    intern(sents);
 
     for (size_t i = 0; i < sents.size(); ++i)
     {
@@ -1232,19 +1313,28 @@ void DependencyParser::save_model(const string & filename)
 }
 
 void DependencyParser::save_model(const char * filename)
+{
+    if (config.binary_model)
+        save_model_binary(filename);
+    else
+        save_model_text(filename);
+}
+
+void DependencyParser::save_model_text(const char * filename)
 {
     /**
      * write model file along with pre-computed matrix
      * into the specified file.
      */
-    Mat<double>& W1 = classifier->get_W1();
-    Mat<double>& W2 = classifier->get_W2();
-    Vec<double>& b1 = classifier->get_b1();
-    Mat<double>& Eb = classifier->get_Eb();
-    Mat<double>& Ed = classifier->get_Ed();
-    Mat<double>& Ev = classifier->get_Ev();
-    Mat<double>& Ec = classifier->get_Ec();
-    Mat<double>& El = classifier->get_El();
+    classifier->apply_pending_l2();
+    Mat<nn_real>& W1 = classifier->get_W1();
+    Mat<nn_real>& W2 = classifier->get_W2();
+    Vec<nn_real>& b1 = classifier->get_b1();
+    Mat<nn_real>& Eb = classifier->get_Eb();
+    Mat<nn_real>& Ed = classifier->get_Ed();
+    Mat<nn_real>& Ev = classifier->get_Ev();
+    Mat<nn_real>& Ec = classifier->get_Ec();
+    Mat<nn_real>& El = classifier->get_El();
 
     ofstream output(filename);
     output << "dict=" << known_words.size() << "\n"
@@ -1371,8 +1461,119 @@ void DependencyParser::save_model(const char * filename)
     output.close();
 }
 
+void DependencyParser::save_model_binary(const char * filename)
+{
+    classifier->apply_pending_l2();
+
+    ModelFileWriter output;
+    if (!output.open(filename))
+    {
+        cerr << "ERROR: cannot write model file " << filename << endl;
+        return;
+    }
+
+    output.add_strings(ModelFile::WORDS,     known_words);
+    output.add_strings(ModelFile::POSS,      known_poss);
+    output.add_strings(ModelFile::LABELS,    known_labels);
+    output.add_strings(ModelFile::VALENCIES, known_valencies);
+    output.add_strings(ModelFile::CLUSTERS,  known_clusters);
+    output.add_ints(ModelFile::DISTANCES,    known_distances);
+    output.add_ints(ModelFile::LENGTHS,      known_lengths);
+    output.add_ints(ModelFile::PRE_COMPUTED, pre_computed_ids);
+
+    output.add_matrix(ModelFile::EB, classifier->get_Eb());
+    output.add_matrix(ModelFile::ED, classifier->get_Ed());
+    output.add_matrix(ModelFile::EV, classifier->get_Ev());
+    output.add_matrix(ModelFile::EC, classifier->get_Ec());
+    output.add_matrix(ModelFile::EL, classifier->get_El());
+    output.add_matrix(ModelFile::W1, classifier->get_W1());
+    output.add_vector(ModelFile::B1, classifier->get_b1());
+    output.add_matrix(ModelFile::W2, classifier->get_W2());
+
+    if (config.save_pre_computed)
+    {
+        vector<int> ids;
+        Mat<nn_real>& saved = classifier->get_pre_computed(ids);
+        output.add_ints(ModelFile::SAVED_IDS, ids);
+        output.add_matrix(ModelFile::SAVED, saved);
+
+        // over the same bytes as in load_model_binary
+        vector<int32_t> ids32(ids.begin(), ids.end());
+        uint64_t h = ModelFile::checksum(0,
+                ids32.empty() ? NULL : &ids32[0], ids32.size() * sizeof(int32_t));
+        Mat<nn_real> * weights[] = {
+            &classifier->get_Eb(), &classifier->get_Ed(), &classifier->get_Ev(),
+            &classifier->get_Ec(), &classifier->get_El(), &classifier->get_W1()};
+        for (int i = 0; i < 6; ++i)
+            h = ModelFile::checksum(h, weights[i]->c_buf(),
+                    (uint64_t)weights[i]->total_size() * sizeof(nn_real));
+        output.add_uint64(ModelFile::SAVED_CHECKSUM, h);
+    }
+
+    if (!output.finish())
+        cerr << "ERROR: failed to write model file " << filename << endl;
+}
+
+bool DependencyParser::convert_model(const char * from, const char * to)
+{
+    bool binary = ModelFile::is_binary(from);
+    // the pre-computed table is only needed to save it
+    if (!load_model(from, !(config.save_pre_computed && !binary)))
+        return false;
+    if (binary)
+        save_model_text(to);
+    else
+        save_model_binary(to);
+    cerr << "Converted " << from << " to the "
+         << (binary ? "text" : "binary") << " model " << to << endl;
+    return true;
+}
+
+void DependencyParser::intern(DependencySent& sent)
+{
+    intern_labels();
+
+    sent.word_ids.resize(sent.n + 2);
+    sent.pos_ids.resize(sent.n + 2);
+    sent.cluster_ids.resize(sent.n + 2);
+
+    sent.word_ids[0] = get_word_id(Config::NIL);
+    sent.pos_ids[0] = get_pos_id(Config::NIL);
+    sent.cluster_ids[0] = get_cluster_id(Config::NIL);
+
+    sent.word_ids[1] = get_word_id(Config::ROOT);
+    sent.pos_ids[1] = get_pos_id(Config::ROOT);
+    sent.cluster_ids[1] = get_cluster_id(Config::ROOT);
+
+    for (int i = 0; i < sent.n; ++i)
+    {
+        sent.word_ids[i + 2] = get_word_id(sent.words[i]);
+        sent.pos_ids[i + 2] = get_pos_id(sent.poss[i]);
+        sent.cluster_ids[i + 2] = get_cluster_id(sent.clusters[i]);
+    }
+}
+
+void DependencyParser::intern(vector<DependencySent>& sents)
+{
+    for (size_t i = 0; i < sents.size(); ++i)
+        if (!sents[i].interned())
+            intern(sents[i]);
+    intern_labels();
+}
+
+void DependencyParser::intern_labels()
+{
+    if (label_feats.empty())
+        label_feats.push_back(get_label_id(Config::NIL));
+    int n_labels = DependencyGraph::num_labels();
+    for (int l = label_feats.size() - 1; l < n_labels; ++l)
+        label_feats.push_back(get_label_id(DependencyGraph::label_name(l)));
+}
+
 vector<int> DependencyParser::get_features(Configuration& c)
 {
+    assert (c.sent.interned());
+
     vector<int> f_word;
     vector<int> f_pos;
     vector<int> f_label;
@@ -1381,96 +1582,96 @@ vector<int> DependencyParser::get_features(Configuration& c)
     for (int i = 1; i >= 0; --i) // S0-S4:w,p
     {
         int index = c.get_stack(i);
-        f_word.push_back(get_word_id(c.get_word(index)));
-        f_pos.push_back(get_pos_id(c.get_pos(index)));
-        f_cluster.push_back(get_cluster_id(c.get_cluster(index)));
+        f_word.push_back(c.get_word_id(index));
+        f_pos.push_back(c.get_pos_id(index));
+        f_cluster.push_back(c.get_cluster_id(index));
     }
     for (int i = 0; i <= 1; ++i) // N0,N1:w,p
     {
         int index = c.get_buffer(i);
-        f_word.push_back(get_word_id(c.get_word(index)));
-        f_pos.push_back(get_pos_id(c.get_pos(index)));
-        f_cluster.push_back(get_cluster_id(c.get_cluster(index)));
+        f_word.push_back(c.get_word_id(index));
+        f_pos.push_back(c.get_pos_id(index));
+        f_cluster.push_back(c.get_cluster_id(index));
     }
 
     int index = c.get_pass_buffer(0); // pass buffer 0:w,p,c
-    f_word.push_back(get_word_id(c.get_word(index)));
-    f_pos.push_back(get_pos_id(c.get_pos(index)));
-    f_cluster.push_back(get_cluster_id(c.get_cluster(index)));
+    f_word.push_back(c.get_word_id(index));
+    f_pos.push_back(c.get_pos_id(index));
+    f_cluster.push_back(c.get_cluster_id(index));
 
     int k = c.get_stack(0);
     index = c.get_left_child(k); // S0l:wpl
-    f_word.push_back(get_word_id(c.get_word(index)));
-    f_pos.push_back(get_pos_id(c.get_pos(index)));
-    f_label.push_back(get_label_id(c.get_arc_label(index, k)));
-    f_cluster.push_back(get_cluster_id(c.get_cluster(index)));
+    f_word.push_back(c.get_word_id(index));
+    f_pos.push_back(c.get_pos_id(index));
+    f_label.push_back(get_label_id(c.get_arc_label_id(index, k)));
+    f_cluster.push_back(c.get_cluster_id(index));
 
     index = c.get_right_child(k); //S0r:wpl
-    f_word.push_back(get_word_id(c.get_word(index)));
-    f_pos.push_back(get_pos_id(c.get_pos(index)));
-    f_label.push_back(get_label_id(c.get_arc_label(index, k)));
-    f_cluster.push_back(get_cluster_id(c.get_cluster(index)));
+    f_word.push_back(c.get_word_id(index));
+    f_pos.push_back(c.get_pos_id(index));
+    f_label.push_back(get_label_id(c.get_arc_label_id(index, k)));
+    f_cluster.push_back(c.get_cluster_id(index));
 
     index = c.get_left_child(c.get_left_child(k)); //S0ll:wpl
-    f_word.push_back(get_word_id(c.get_word(index)));
-    f_pos.push_back(get_pos_id(c.get_pos(index)));
-    f_label.push_back(get_label_id(c.get_arc_label(index, c.get_left_child(k))));
-    f_cluster.push_back(get_cluster_id(c.get_cluster(index)));
+    f_word.push_back(c.get_word_id(index));
+    f_pos.push_back(c.get_pos_id(index));
+    f_label.push_back(get_label_id(c.get_arc_label_id(index, c.get_left_child(k))));
+    f_cluster.push_back(c.get_cluster_id(index));
 
     index = c.get_right_child(c.get_right_child(k)); //S0rr:wpl
-    f_word.push_back(get_word_id(c.get_word(index)));
-    f_pos.push_back(get_pos_id(c.get_pos(index)));
-    f_label.push_back(get_label_id(c.get_arc_label(index, c.get_right_child(k))));
-    f_cluster.push_back(get_cluster_id(c.get_cluster(index)));
+    f_word.push_back(c.get_word_id(index));
+    f_pos.push_back(c.get_pos_id(index));
+    f_label.push_back(get_label_id(c.get_arc_label_id(index, c.get_right_child(k))));
+    f_cluster.push_back(c.get_cluster_id(index));
 
     index = c.get_left_head(k); //S0lh:wpl
-    f_word.push_back(get_word_id(c.get_word(index)));
-    f_pos.push_back(get_pos_id(c.get_pos(index)));
-    f_label.push_back(get_label_id(c.get_arc_label(index, k)));
-    f_cluster.push_back(get_cluster_id(c.get_cluster(index)));
+    f_word.push_back(c.get_word_id(index));
+    f_pos.push_back(c.get_pos_id(index));
+    f_label.push_back(get_label_id(c.get_arc_label_id(index, k)));
+    f_cluster.push_back(c.get_cluster_id(index));
 
     index = c.get_right_head(k); //S0rh:wpl
-    f_word.push_back(get_word_id(c.get_word(index)));
-    f_pos.push_back(get_pos_id(c.get_pos(index)));
-    f_label.push_back(get_label_id(c.get_arc_label(index, k)));
-    f_cluster.push_back(get_cluster_id(c.get_cluster(index)));
+    f_word.push_back(c.get_word_id(index));
+    f_pos.push_back(c.get_pos_id(index));
+    f_label.push_back(get_label_id(c.get_arc_label_id(index, k)));
+    f_cluster.push_back(c.get_cluster_id(index));
 
     index = c.get_left_head(c.get_left_head(k)); //S0llh:wpl
-    f_word.push_back(get_word_id(c.get_word(index)));
-    f_pos.push_back(get_pos_id(c.get_pos(index)));
-    f_label.push_back(get_label_id(c.get_arc_label(index, c.get_left_child(k))));
-    f_cluster.push_back(get_cluster_id(c.get_cluster(index)));
+    f_word.push_back(c.get_word_id(index));
+    f_pos.push_back(c.get_pos_id(index));
+    f_label.push_back(get_label_id(c.get_arc_label_id(index, c.get_left_child(k))));
+    f_cluster.push_back(c.get_cluster_id(index));
 
     index = c.get_right_head(c.get_right_head(k)); //S0rrh:wpl
-    f_word.push_back(get_word_id(c.get_word(index)));
-    f_pos.push_back(get_pos_id(c.get_pos(index)));
-    f_label.push_back(get_label_id(c.get_arc_label(index, c.get_right_child(k))));
-    f_cluster.push_back(get_cluster_id(c.get_cluster(index)));
+    f_word.push_back(c.get_word_id(index));
+    f_pos.push_back(c.get_pos_id(index));
+    f_label.push_back(get_label_id(c.get_arc_label_id(index, c.get_right_child(k))));
+    f_cluster.push_back(c.get_cluster_id(index));
 
     k = c.get_buffer(0);
     index = c.get_left_child(k); //N0lc:wpl
-    f_word.push_back(get_word_id(c.get_word(index)));
-    f_pos.push_back(get_pos_id(c.get_pos(index)));
-    f_label.push_back(get_label_id(c.get_arc_label(index, k)));
-    f_cluster.push_back(get_cluster_id(c.get_cluster(index)));
+    f_word.push_back(c.get_word_id(index));
+    f_pos.push_back(c.get_pos_id(index));
+    f_label.push_back(get_label_id(c.get_arc_label_id(index, k)));
+    f_cluster.push_back(c.get_cluster_id(index));
 
     index = c.get_left_head(k); //N0lh:wpl
-    f_word.push_back(get_word_id(c.get_word(index)));
-    f_pos.push_back(get_pos_id(c.get_pos(index)));
-    f_label.push_back(get_label_id(c.get_arc_label(index, k)));
-    f_cluster.push_back(get_cluster_id(c.get_cluster(index)));
+    f_word.push_back(c.get_word_id(index));
+    f_pos.push_back(c.get_pos_id(index));
+    f_label.push_back(get_label_id(c.get_arc_label_id(index, k)));
+    f_cluster.push_back(c.get_cluster_id(index));
 
     index = c.get_left_child(c.get_left_child(k)); //N0llc:wpl
-    f_word.push_back(get_word_id(c.get_word(index)));
-    f_pos.push_back(get_pos_id(c.get_pos(index)));
-    f_label.push_back(get_label_id(c.get_arc_label(index, c.get_left_child(k))));
-    f_cluster.push_back(get_cluster_id(c.get_cluster(index)));
+    f_word.push_back(c.get_word_id(index));
+    f_pos.push_back(c.get_pos_id(index));
+    f_label.push_back(get_label_id(c.get_arc_label_id(index, c.get_left_child(k))));
+    f_cluster.push_back(c.get_cluster_id(index));
 
     index = c.get_left_head(c.get_left_head(k)); //N0llh:wpl
-    f_word.push_back(get_word_id(c.get_word(index)));
-    f_pos.push_back(get_pos_id(c.get_pos(index)));
-    f_label.push_back(get_label_id(c.get_arc_label(index, c.get_right_child(k))));
-    f_cluster.push_back(get_cluster_id(c.get_cluster(index)));
+    f_word.push_back(c.get_word_id(index));
+    f_pos.push_back(c.get_pos_id(index));
+    f_label.push_back(get_label_id(c.get_arc_label_id(index, c.get_right_child(k))));
+    f_cluster.push_back(c.get_cluster_id(index));
 
     vector<int> features;
     if (!config.delexicalized)
@@ -1489,18 +1690,18 @@ vector<int> DependencyParser::get_features(Configuration& c)
                         f_label.end());
 
     if (config.use_distance)
-        features.push_back(get_distance_id(c.get_distance()));
+        features.push_back(distance_feats[c.get_distance()]);
     
     if (config.use_valency)
     {
         int index = c.get_stack(0);
-        features.push_back(get_valency_id(c.get_lvalency(index)));
-        features.push_back(get_valency_id(c.get_rvalency(index)));
-        features.push_back(get_valency_id(c.get_lhvalency(index)));
-        features.push_back(get_valency_id(c.get_rhvalency(index)));
+        features.push_back(get_valency_feat(c, Configuration::VALENCY_LC, index));
+        features.push_back(get_valency_feat(c, Configuration::VALENCY_RC, index));
+        features.push_back(get_valency_feat(c, Configuration::VALENCY_LH, index));
+        features.push_back(get_valency_feat(c, Configuration::VALENCY_RH, index));
         index = c.get_buffer(0);
-        features.push_back(get_valency_id(c.get_lvalency(index)));
-        features.push_back(get_valency_id(c.get_lhvalency(index)));
+        features.push_back(get_valency_feat(c, Configuration::VALENCY_LC, index));
+        features.push_back(get_valency_feat(c, Configuration::VALENCY_LH, index));
     }
     if (config.use_cluster)
     {
@@ -1510,7 +1711,12 @@ vector<int> DependencyParser::get_features(Configuration& c)
     }
 
     if (config.use_length)
-        features.push_back(get_length_id(c.get_pass_buffer_size()));
+    {
+        int l = c.get_pass_buffer_size();
+        features.push_back(l + 1 < (int)length_feats.size()
+                ? length_feats[l]
+                : length_feats.back());
+    }
 
     assert ((int)features.size() == config.num_tokens);
 
@@ -1550,105 +1756,285 @@ int DependencyParser::get_word_id(const string & s)
         return word_ids[sl];
 }
 
+/**
+ * The lookups below only read the dictionaries (an id absent from
+ *  them is 0), so that decoding threads can share them.
+ */
+static int find_id(const unordered_map<string, int> & ids, const string & s)
+{
+    unordered_map<string, int>::const_iterator it = ids.find(s);
+    return (it == ids.end()) ? 0 : it->second;
+}
+
+static int find_id(const unordered_map<int, int> & ids, int d)
+{
+    unordered_map<int, int>::const_iterator it = ids.find(d);
+    return (it == ids.end()) ? 0 : it->second;
+}
+
 int DependencyParser::get_pos_id(const string & s)
 {
     return (pos_ids.find(s) == pos_ids.end())
-                ? pos_ids[Config::UNKNOWN]
-                : pos_ids[s];
+                ? find_id(pos_ids, Config::UNKNOWN)
+                : find_id(pos_ids, s);
 }
 
 int DependencyParser::get_label_id(const string & s)
 {
-    return label_ids[s];
+    return find_id(label_ids, s);
+}
+
+int DependencyParser::get_label_id(int l)
+{
+    // labels interned after the last intern_labels take the slow path
+    return (l + 1 < (int)label_feats.size())
+                ? label_feats[l + 1]
+                : get_label_id(DependencyGraph::label_name(l));
 }
 
 int DependencyParser::get_distance_id(const int & d)
 {
     return (distance_ids.find(d) == distance_ids.end())
-                ? distance_ids[Config::UNKNOWN_INT]
-                : distance_ids[d];
+                ? find_id(distance_ids, Config::UNKNOWN_INT)
+                : find_id(distance_ids, d);
 }
 
 int DependencyParser::get_length_id(const int & d)
 {
     return (length_ids.find(d) == length_ids.end())
-                ? length_ids[Config::UNKNOWN_INT]
-                : length_ids[d];
+                ? find_id(length_ids, Config::UNKNOWN_INT)
+                : find_id(length_ids, d);
 }
 
 int DependencyParser::get_valency_id(const string & v)
 {
     return (valency_ids.find(v) == valency_ids.end())
-                ? valency_ids[Config::UNKNOWN]
-                : valency_ids[v];
+                ? find_id(valency_ids, Config::UNKNOWN)
+                : find_id(valency_ids, v);
 }
 
 int DependencyParser::get_cluster_id(const string & c)
 {
     return (cluster_ids.find(c) == cluster_ids.end())
-                ? cluster_ids[Config::UNKNOWN]
-                : cluster_ids[c];
+                ? find_id(cluster_ids, Config::UNKNOWN)
+                : find_id(cluster_ids, c);
 }
 
 void DependencyParser::predict_graph(
         DependencySent& sent,
         DependencyGraph& graph)
 {
-    int num_trans = system->transitions.size();
+    if (!sent.interned())
+        intern(sent);
+
     Configuration c(sent);
     while (!system->is_terminal(c))
     {
-        vector<double> scores;
+        vector<nn_real> scores;
         vector<int> features = get_features(c);
         classifier->compute_scores(features, scores);
-        double opt_score = -DBL_MAX;
-        string opt_trans = "";
+        if (!apply_best_transition(c, scores))
+            break;
+    }
+    finish_graph(c, graph);
+    // return c.tree;
+}
 
-        for (int i = 0; i < num_trans; ++i)
+// orders sentence indices by decreasing length
+struct LongerSent
+{
+    const vector<DependencySent> & sents;
+
+    LongerSent(const vector<DependencySent> & s) : sents(s) {}
+
+    bool operator()(int a, int b) const
+    {
+        return sents[a].n > sents[b].n;
+    }
+};
+
+void DependencyParser::predict_graph(
+        vector<DependencySent>& sents,
+        vector<DependencyGraph>& graphs)
+{
+    // vector<DependencyTree> result;
+    graphs.clear();
+    graphs.resize(sents.size());
+    intern(sents);
+
+    /**
+     * Sentences are sorted longest first and every thread takes the
+     *  next one from the shared cursor as soon as it has room: long
+     *  sentences start first and short ones fill in at the end, so
+     *  that no thread is left straggling with a long sentence.
+     *
+     * Scoring only reads the classifier, except when it records
+     *  calibration activations: these are recorded by a single
+     *  thread, in the order of the input.
+     */
+    bool calibrating = classifier->is_calibrating();
+    vector<int> order(sents.size());
+    for (size_t i = 0; i < order.size(); ++i)
+        order[i] = i;
+    if (!calibrating)
+        stable_sort(order.begin(), order.end(), LongerSent(sents));
+
+    int n_threads = config.decode_threads > 0
+                        ? config.decode_threads
+                        : omp_get_num_procs();
+    if (calibrating)
+        n_threads = 1;
+
+    int cursor = 0;
+    #pragma omp parallel num_threads(n_threads)
+    {
+        if (config.lockstep_decoding)
+            decode_lockstep(sents, order, cursor, graphs, true);
+        else
         {
-            if (scores[i] > opt_score)
+            int i;
+            while ((i = next_sent(order, cursor, true)) >= 0)
+                predict_graph(sents[i], graphs[i]);
+        }
+    }
+    cerr << "\r" << sents.size() << "    " << endl;
+    // return result;
+}
+
+int DependencyParser::next_sent(vector<int>& order, int& cursor, bool report)
+{
+    int i;
+    #pragma omp atomic capture
+    i = cursor++;
+
+    if (i >= (int)order.size())
+        return -1;
+    if (report && i % 100 == 0 && omp_get_thread_num() == 0)
+        cerr << "\r" << i << "    ";
+    return order[i];
+}
+
+void DependencyParser::decode_lockstep(
+        vector<DependencySent>& sents,
+        vector<int>& order,
+        int& cursor,
+        vector<DependencyGraph>& graphs,
+        bool report)
+{
+    /**
+     * decode_batch_size slots hold the configurations of different
+     *  sentences, which advance in lockstep: at every step, the
+     *  features of all slots are scored by one batched call, and
+     *  the slots whose sentence is finished take the next sentence
+     *  from the cursor, so that the batch stays full until the
+     *  input runs out.
+     *
+     * Every configuration is scored and updated as in the
+     *  sequential decoder, hence the same graphs.
+     */
+    int width = max(config.decode_batch_size, 1);
+    vector<Configuration *> slots(width, (Configuration *)NULL);
+    vector<int> slot_sents(width, -1);
+    vector<int> live; // slots holding a configuration
+    vector< vector<int> > features;
+    vector< vector<nn_real> > scores;
+
+    bool input_left = true;
+    while (true)
+    {
+        live.clear();
+        for (int k = 0; k < width; ++k)
+        {
+            while (slots[k] == NULL && input_left)
             {
-                if (system->can_apply(c, system->transitions[i]))
+                int i = next_sent(order, cursor, report);
+                if (i < 0)
                 {
-                    opt_score = scores[i];
-                    opt_trans = system->transitions[i];
+                    input_left = false;
+                    break;
                 }
-                /*
-                else
+                slots[k] = new Configuration(sents[i]);
+                slot_sents[k] = i;
+                // e.g. an empty sentence: nothing to score
+                if (system->is_terminal(*slots[k]))
                 {
-                    cerr << system->transitions[i] << " can not apply" << endl;
-                    cerr << "#configuration:" << endl
-                         << "stack = " << c.stack.size() << ", " << c.get_stack(0) << " | " << c.get_stack(1) << endl
-                         << "buffer = " << c.buffer.size() << ", " << c.get_buffer(0) << endl;
+                    finish_graph(*slots[k], graphs[i]);
+                    delete slots[k];
+                    slots[k] = NULL;
                 }
-                */
             }
+            if (slots[k] != NULL)
+                live.push_back(k);
         }
-        if (opt_trans == "NS"){
-            double snd_score = -DBL_MAX;
-            string snd_trans = "";
-            for (int i = 0; i < num_trans; ++i)
-                if (scores[i] > snd_score)
-                {
-                    if (system->can_apply(c, system->transitions[i])){
-                       // cerr <<"can apply:"<< system->transitions[i]<<endl;
-                        if ((startswith(system->transitions[i],"L") || startswith(system->transitions[i],"R"))){
-                        snd_trans = system->transitions[i];
-                        snd_score = scores[i];}
-                    }
-                }
-            c.save_2nd_head(snd_trans, snd_score);
-            //cerr << "second trans:"<< snd_trans << " ";
+        if (live.empty())
+            break;
+
+        features.resize(live.size());
+        for (size_t j = 0; j < live.size(); ++j)
+            features[j] = get_features(*slots[live[j]]);
+        classifier->compute_scores_batch(features, scores);
+
+        for (size_t j = 0; j < live.size(); ++j)
+        {
+            int k = live[j];
+            if (!apply_best_transition(*slots[k], scores[j])
+                    || system->is_terminal(*slots[k]))
+            {
+                finish_graph(*slots[k], graphs[slot_sents[k]]);
+                delete slots[k];
+                slots[k] = NULL;
+            }
         }
-        //cerr << opt_trans << "->" << endl;
-        //cerr << "true: " << opt_trans << endl;
-        system->apply(c, opt_trans);
+    }
+}
 
-        //cerr <<endl<< c.info() << endl;
-        
-        //cerr << c.info() << endl;
+bool DependencyParser::apply_best_transition(
+        Configuration& c,
+        vector<nn_real>& scores)
+{
+    int num_trans = system->transitions.size();
+    vector<char> legal;
+    system->legal_mask(c, legal);
+
+    double opt_score = -DBL_MAX;
+    int opt_trans = -1;
+    for (int i = 0; i < num_trans; ++i)
+    {
+        if (legal[i] && scores[i] > opt_score)
+        {
+            opt_score = scores[i];
+            opt_trans = i;
+        }
+    }
+    if (opt_trans >= 0 && opt_trans == system->no_shift){
+        // best legal arc, kept as a candidate second head
+        double snd_score = -DBL_MAX;
+        int snd_trans = -1;
+        for (int i = 0; i < num_trans; ++i)
+            if (legal[i] && system->trans_dirs[i] != 0 && scores[i] > snd_score)
+            {
+                snd_trans = i;
+                snd_score = scores[i];
+            }
+        if (snd_trans >= 0)
+            c.save_2nd_head(
+                    system->trans_dirs[snd_trans],
+                    system->arc_labels[system->trans_labels[snd_trans]],
+                    snd_score);
+    }
+    if (opt_trans < 0)
+    {
+        cerr << "error: no legal transition!" << endl;
+        return false;
     }
-    //c.graph.print();
+    system->apply(c, opt_trans);
+    return true;
+}
+
+void DependencyParser::finish_graph(
+        Configuration& c,
+        DependencyGraph& graph)
+{
     if (c.get_stack_size() > 1){
         process_headless(c);
     }
@@ -1657,34 +2043,36 @@ void DependencyParser::predict_graph(
         c.graph.print();
     }
     graph = c.graph;
-    // return c.tree;
 }
 
-void DependencyParser::predict_graph(
-        vector<DependencySent>& sents,
-        vector<DependencyGraph>& graphs)
+bool DependencyParser::load_model(
+        const char * filename,
+        bool re_precompute,
+        const char * calib_file)
 {
-    // vector<DependencyTree> result;
-    graphs.clear();
-    graphs.resize(sents.size());
-    // #pragma omp parallel for
-    for (size_t i = 0; i < sents.size(); ++i)
-    {
-        cerr << "\r" << i << "    ";
-        predict_graph(sents[i], graphs[i]);
-        // result.push_back(predict(sents[i]));
-    }
-    cerr << endl;
-    // return result;
+    bool ok = ModelFile::is_binary(filename)
+                ? load_model_binary(filename, re_precompute)
+                : load_model_text(filename, re_precompute);
+    if (!ok)
+        return false;
+
+    if (calib_file != NULL)
+        quantize(calib_file);
+    return true;
 }
 
-void DependencyParser::load_model(const char * filename, bool re_precompute)
+bool DependencyParser::load_model_text(const char * filename, bool re_precompute)
 {
     cerr << "Loading depparse model from " << filename << endl;
 
     double start = get_time();
 
     ifstream input(filename);
+    if (input.fail())
+    {
+        cerr << "ERROR: cannot open model file " << filename << endl;
+        return false;
+    }
 
     string s;
     getline(input, s); int n_dict = to_int(split_by_sep(s, "=")[1]);
@@ -1735,11 +2123,11 @@ void DependencyParser::load_model(const char * filename, bool re_precompute)
     int Ec_entries = n_cluster;
     int El_entries = n_length;
 
-    Mat<double> Eb(Eb_entries, Eb_size);
-    Mat<double> Ed(Ed_entries, Ed_size);
-    Mat<double> Ev(Ev_entries, Ev_size);
-    Mat<double> Ec(Ec_entries, Ec_size);
-    Mat<double> El(El_entries, El_size);
+    Mat<nn_real> Eb(Eb_entries, Eb_size);
+    Mat<nn_real> Ed(Ed_entries, Ed_size);
+    Mat<nn_real> Ev(Ev_entries, Ev_size);
+    Mat<nn_real> Ec(Ec_entries, Ec_size);
+    Mat<nn_real> El(El_entries, El_size);
 
     if (!config.delexicalized)
         for (int i = 0; i < n_dict; ++i)
@@ -1848,7 +2236,7 @@ void DependencyParser::load_model(const char * filename, bool re_precompute)
                 + Ec_size * n_cluster_tokens
                 + El_size * n_length_tokens;
 
-    Mat<double> W1(h_size, W1_ncol);
+    Mat<nn_real> W1(h_size, W1_ncol);
     for (int j = 0; j < W1.ncols(); ++j)
     {
         getline(input, s);
@@ -1859,7 +2247,7 @@ void DependencyParser::load_model(const char * filename, bool re_precompute)
             W1[i][j] = to_double_sci(sep[i]);
     }
 
-    Vec<double> b1(h_size);
+    Vec<nn_real> b1(h_size);
     getline(input, s);
     vector<string> sep = split(s);
     assert (sep.size() == h_size);
@@ -1874,7 +2262,7 @@ void DependencyParser::load_model(const char * filename, bool re_precompute)
     else if (config.oracle == "listsystem")
         n_actions = (config.labeled) ? (known_labels.size() * 3 - 3) : 5;// list system
 
-    Mat<double> W2(n_actions, h_size);
+    Mat<nn_real> W2(n_actions, h_size);
     for (int j = 0; j < W2.ncols(); ++j)
     {
         getline(input, s);
@@ -1894,10 +2282,111 @@ void DependencyParser::load_model(const char * filename, bool re_precompute)
     }
 
     input.close();
+    setup_loaded_model(Eb, Ed, Ev, Ec, El, W1, b1, W2, re_precompute);
+
+    double end = get_time();
+    cerr << "Elapsed " << (end - start) << "s\n";
+    return true;
+}
+
+bool DependencyParser::load_model_binary(const char * filename, bool re_precompute)
+{
+    cerr << "Loading binary depparse model from " << filename << endl;
+
+    double start = get_time();
+
+    ModelFile input;
+    if (!input.open(filename))
+        return false;
+
+    Mat<nn_real> Eb, Ed, Ev, Ec, El, W1, W2;
+    Vec<nn_real> b1;
+    bool ok = input.get_strings(ModelFile::WORDS,     known_words)
+           && input.get_strings(ModelFile::POSS,      known_poss)
+           && input.get_strings(ModelFile::LABELS,    known_labels)
+           && input.get_strings(ModelFile::VALENCIES, known_valencies)
+           && input.get_strings(ModelFile::CLUSTERS,  known_clusters)
+           && input.get_ints(ModelFile::DISTANCES,    known_distances)
+           && input.get_ints(ModelFile::LENGTHS,      known_lengths)
+           && input.get_ints(ModelFile::PRE_COMPUTED, pre_computed_ids)
+           && input.get_matrix(ModelFile::EB, Eb)
+           && input.get_matrix(ModelFile::ED, Ed)
+           && input.get_matrix(ModelFile::EV, Ev)
+           && input.get_matrix(ModelFile::EC, Ec)
+           && input.get_matrix(ModelFile::EL, El)
+           && input.get_matrix(ModelFile::W1, W1)
+           && input.get_vector(ModelFile::B1, b1)
+           && input.get_matrix(ModelFile::W2, W2);
+    if (!ok)
+    {
+        cerr << "ERROR: " << filename << ": missing or malformed section" << endl;
+        return false;
+    }
+
+    generate_ids();
+
+    /**
+     * Adopt the pre-computed table of the file, if any, when it was
+     *  computed from these weights (the checksum covers the bytes of
+     *  the sections, see save_model_binary); compute it otherwise.
+     */
+    vector<int> saved_ids;
+    Mat<nn_real> saved;
+    uint64_t checksum = 0;
+    bool has_saved = !re_precompute
+            && input.get_ints(ModelFile::SAVED_IDS, saved_ids)
+            && input.get_matrix(ModelFile::SAVED, saved)
+            && input.get_uint64(ModelFile::SAVED_CHECKSUM, checksum);
+    if (has_saved)
+    {
+        const uint32_t covered[] = {ModelFile::SAVED_IDS,
+            ModelFile::EB, ModelFile::ED, ModelFile::EV,
+            ModelFile::EC, ModelFile::EL, ModelFile::W1};
+        uint64_t h = 0;
+        for (int i = 0; i < 7; ++i)
+        {
+            const ModelFile::Section * s = input.find(covered[i]);
+            h = ModelFile::checksum(h, input.at(s), s->bytes);
+        }
+        if (h != checksum)
+        {
+            cerr << "WARNING: the pre-computed table does not match "
+                 << "the weights, computing it again" << endl;
+            has_saved = false;
+        }
+    }
+
+    setup_loaded_model(Eb, Ed, Ev, Ec, El, W1, b1, W2, re_precompute || has_saved);
+    if (has_saved && !classifier->adopt_pre_computed(saved_ids, saved))
+    {
+        cerr << "WARNING: malformed pre-computed table, computing it again" << endl;
+        if (config.num_pre_computed > 0)
+            classifier->pre_compute(pre_computed_ids, true);
+    }
+
+    // the classifier now views the weights of @input
+    model_file.swap(input);
+
+    double end = get_time();
+    cerr << "Elapsed " << (end - start) << "s\n";
+    return true;
+}
+
+void DependencyParser::setup_loaded_model(
+        Mat<nn_real>& Eb,
+        Mat<nn_real>& Ed,
+        Mat<nn_real>& Ev,
+        Mat<nn_real>& Ec,
+        Mat<nn_real>& El,
+        Mat<nn_real>& W1,
+        Vec<nn_real>& b1,
+        Mat<nn_real>& W2,
+        bool re_precompute)
+{
     if (re_precompute)
-        classifier = new NNClassifier(config, Eb, Ed, Ev, Ec, El, W1, b1, W2, vector<int>());
+        classifier = new NNClassifier<nn_real>(config, Eb, Ed, Ev, Ec, El, W1, b1, W2, vector<int>());
     else
-        classifier = new NNClassifier(config, Eb, Ed, Ev, Ec, El, W1, b1, W2, pre_computed_ids);
+        classifier = new NNClassifier<nn_real>(config, Eb, Ed, Ev, Ec, El, W1, b1, W2, pre_computed_ids);
 
     vector<string> ldict = known_labels;
     if (config.labeled) ldict.pop_back(); // remove the NIL label
@@ -1908,14 +2397,16 @@ void DependencyParser::load_model(const char * filename, bool re_precompute)
 
     if (!re_precompute && config.num_pre_computed > 0)
         classifier->pre_compute();
-
-    double end = get_time();
-    cerr << "Elapsed " << (end - start) << "s\n";
 }
 
-void DependencyParser::load_model(const string & filename, bool re_precompute)
+bool DependencyParser::load_model(
+        const string & filename,
+        bool re_precompute,
+        const string & calib_file)
 {
-    load_model(filename.c_str(), re_precompute);
+    return load_model(filename.c_str(),
+            re_precompute,
+            calib_file.empty() ? NULL : calib_file.c_str());
 }
 
 /**
@@ -1982,11 +2473,11 @@ void DependencyParser::load_model_cl(
     int Ec_entries = n_cluster;
     int El_entries = n_length;
 
-    Mat<double> Eb(Eb_entries, Eb_size);
-    Mat<double> Ed(Ed_entries, Ed_size);
-    Mat<double> Ev(Ev_entries, Ev_size);
-    Mat<double> Ec(Ec_entries, Ec_size);
-    Mat<double> El(El_entries, El_size);
+    Mat<nn_real> Eb(Eb_entries, Eb_size);
+    Mat<nn_real> Ed(Ed_entries, Ed_size);
+    Mat<nn_real> Ev(Ev_entries, Ev_size);
+    Mat<nn_real> Ec(Ec_entries, Ec_size);
+    Mat<nn_real> El(El_entries, El_size);
 
     // unordered_map<string, int>::iterator iter = embed_ids.begin();
     auto iter = embed_ids.begin();
@@ -2130,7 +2621,7 @@ void DependencyParser::load_model_cl(
                 + Ec_size * n_cluster_tokens
                 + El_size * n_length_tokens;
 
-    Mat<double> W1(h_size, W1_ncol);
+    Mat<nn_real> W1(h_size, W1_ncol);
     for (int j = 0; j < W1.ncols(); ++j)
     {
         getline(input, s);
@@ -2141,7 +2632,7 @@ void DependencyParser::load_model_cl(
             W1[i][j] = to_double_sci(sep[i]);
     }
 
-    Vec<double> b1(h_size);
+    Vec<nn_real> b1(h_size);
     getline(input, s);
     vector<string> sep = split(s);
 
@@ -2157,7 +2648,7 @@ void DependencyParser::load_model_cl(
     else if (config.oracle == "listsystem")
         n_actions = (config.labeled) ? (known_labels.size() * 3 - 3) : 5;// attach system
 
-    Mat<double> W2(n_actions, h_size);
+    Mat<nn_real> W2(n_actions, h_size);
     for (int j = 0; j < W2.ncols(); ++j)
     {
         getline(input, s);
@@ -2177,7 +2668,7 @@ void DependencyParser::load_model_cl(
     }
 
     input.close();
-    classifier = new NNClassifier(config, Eb, Ed, Ev, Ec, El, W1, b1, W2, vector<int>());
+    classifier = new NNClassifier<nn_real>(config, Eb, Ed, Ev, Ec, El, W1, b1, W2, vector<int>());
     vector<string> ldict = known_labels;
     if (config.labeled)
         ldict.pop_back(); // remove the NIL label
@@ -2203,7 +2694,8 @@ void DependencyParser::load_model_cl(const string & filename, const string & cle
 void DependencyParser::test(
         const char * test_file,
         const char * output_file,
-        bool re_precompute)
+        bool re_precompute,
+        const char * calib_file)
 {
     // predict
     cerr << "Test file: " << test_file << endl;
@@ -2229,8 +2721,33 @@ void DependencyParser::test(
     for (size_t i = 0; i < test_sents.size(); ++i)
         n_words += test_sents[i].n;
 
+    // full precision reference for the int8 report
+    map<string, double> ref_result;
+    double ref_time = 0;
+    size_t ref_bytes = 0;
+    if (calib_file != NULL)
+    {
+        classifier->set_quantized(false);
+        double ref_start = get_time();
+        vector<DependencyGraph> ref_predicted;
+        predict_graph(test_sents, ref_predicted);
+        ref_time = get_time() - ref_start;
+        system->evaluate(test_sents, ref_predicted, test_graphs, ref_result);
+        ref_bytes = classifier->scoring_bytes(false);
+
+        quantize(calib_file);
+    }
+
+    if (config.lockstep_decoding)
+        cerr << "Decoding in lockstep, "
+             << config.decode_batch_size << " sentences per batch" << endl;
+    else
+        cerr << "Decoding one sentence at a time" << endl;
+
     vector<DependencyGraph> predicted;
+    double decode_start = get_time();
     predict_graph(test_sents, predicted);
+    double decode_time = get_time() - decode_start;
 
     map<string, double> result;
     system->evaluate(test_sents, predicted, test_graphs, result);
@@ -2256,6 +2773,21 @@ void DependencyParser::test(
 
     fprintf(stderr, "%.1f words per second.\n", wordspersec);
     fprintf(stderr, "%.1f sents per second.\n", sentspersec);
+
+    if (calib_file != NULL)
+    {
+        size_t int8_bytes = classifier->scoring_bytes(true);
+        fprintf(stderr, "int8 vs %s:\n", sizeof(nn_real) == 4 ? "float" : "double");
+        fprintf(stderr, "  UF = %.4f%% -> %.4f%% (%+.4f)\n",
+                ref_result["UF"], UF, UF - ref_result["UF"]);
+        fprintf(stderr, "  LF = %.4f%% -> %.4f%% (%+.4f)\n",
+                ref_result["LF"], LF, LF - ref_result["LF"]);
+        fprintf(stderr, "  decoding = %.3fs -> %.3fs (%.2fx)\n",
+                ref_time, decode_time, ref_time / decode_time);
+        fprintf(stderr, "  scoring parameters = %.2fMB -> %.2fMB (%.2fx smaller)\n",
+                ref_bytes / 1048576.0, int8_bytes / 1048576.0,
+                (double)ref_bytes / int8_bytes);
+    }
     
     if (output_file != NULL)
         Util::write_conll_file_graph(output_file, test_sents, predicted);
@@ -2264,9 +2796,228 @@ void DependencyParser::test(
 void DependencyParser::test(
         string & test_file,
         string & output_file,
-        bool re_precompute)
+        bool re_precompute,
+        const string & calib_file)
+{
+    test(test_file.c_str(),
+            output_file.c_str(),
+            re_precompute,
+            calib_file.empty() ? NULL : calib_file.c_str());
+}
+
+/**
+ * State shared by the stages of parse_stream: the reader thread, the
+ *  worker threads and the writer (the calling thread).
+ */
+struct StreamItem
 {
-    test(test_file.c_str(), output_file.c_str(), re_precompute);
+    long seq; // position in the input
+    DependencySent sent;
+    DependencyGraph graph;
+};
+
+struct StreamState
+{
+    mutex lock;
+    condition_variable changed;
+
+    deque<StreamItem *> queue;       // read, not taken by a worker
+    map<long, StreamItem *> parsed;  // parsed, not written yet
+    long n_read;
+    long n_written;
+    bool eof;
+    long window; // bound on n_read - n_written
+
+    StreamState() : n_read(0), n_written(0), eof(false), window(1) {}
+};
+
+void DependencyParser::parse_stream(const char * input_file, const char * output_file)
+{
+    ConllReader reader(false); // gold arcs are not needed
+    if (!reader.open(input_file))
+        return;
+
+    ofstream file;
+    bool to_stdout = output_file == NULL || strcmp(output_file, "-") == 0;
+    if (!to_stdout)
+    {
+        file.open(output_file);
+        if (file.fail())
+        {
+            cerr << "# fail to open output file: " << output_file << endl;
+            return;
+        }
+    }
+    ostream & output = to_stdout ? cout : file;
+
+    int n_threads = config.decode_threads > 0
+                        ? config.decode_threads
+                        : omp_get_num_procs();
+    int width = max(config.decode_batch_size, 1);
+
+    StreamState state;
+    state.window = config.stream_window > 0
+                        ? config.stream_window
+                        : 4L * width * n_threads;
+
+    /**
+     * the unlabeled reader gives every arc the UNKNOWN label: intern
+     *  it now, so that label_feats is not extended by the workers
+     */
+    DependencyGraph::label_id(Config::UNKNOWN);
+    intern_labels();
+
+    cerr << "Streaming with " << n_threads << " threads, at most "
+         << state.window << " sentences in flight" << endl;
+
+    double start = get_time();
+    thread read_thread(&DependencyParser::stream_read, this, &state, &reader);
+    vector<thread> workers;
+    for (int t = 0; t < n_threads; ++t)
+        workers.push_back(thread(&DependencyParser::stream_parse, this, &state));
+
+    // write the sentences in input order, each as soon as it is parsed
+    long n_words = 0;
+    while (true)
+    {
+        StreamItem * item = NULL;
+        {
+            unique_lock<mutex> guard(state.lock);
+            while (true)
+            {
+                map<long, StreamItem *>::iterator it = state.parsed.find(state.n_written);
+                if (it != state.parsed.end())
+                {
+                    item = it->second;
+                    state.parsed.erase(it);
+                    break;
+                }
+                if (state.eof && state.n_written == state.n_read)
+                    break;
+
+                // nothing to write: let the reader of the output see it
+                guard.unlock();
+                output.flush();
+                guard.lock();
+                if (state.parsed.count(state.n_written) == 0
+                        && !(state.eof && state.n_written == state.n_read))
+                    state.changed.wait(guard);
+            }
+        }
+        if (item == NULL)
+            break;
+
+        Util::write_conll_graph(output, item->sent, item->graph);
+        n_words += item->sent.n;
+        delete item;
+
+        lock_guard<mutex> guard(state.lock);
+        ++state.n_written;
+        state.changed.notify_all();
+    }
+    output.flush();
+
+    read_thread.join();
+    for (size_t t = 0; t < workers.size(); ++t)
+        workers[t].join();
+
+    double elapsed = get_time() - start;
+    cerr << "Parsed " << state.n_written << " sentences, "
+         << n_words / max(elapsed, 1e-9) << " words per second" << endl;
+}
+
+void DependencyParser::stream_read(StreamState * state, ConllReader * reader)
+{
+    for (long seq = 0; ; ++seq)
+    {
+        {
+            unique_lock<mutex> guard(state->lock);
+            while (state->n_read - state->n_written >= state->window)
+                state->changed.wait(guard);
+        }
+
+        StreamItem * item = new StreamItem();
+        item->seq = seq;
+        bool ok = reader->next(item->sent, item->graph);
+
+        lock_guard<mutex> guard(state->lock);
+        if (!ok)
+        {
+            delete item;
+            state->eof = true;
+            state->changed.notify_all();
+            return;
+        }
+        state->queue.push_back(item);
+        ++state->n_read;
+        state->changed.notify_all();
+    }
+}
+
+void DependencyParser::stream_parse(StreamState * state)
+{
+    /**
+     * take the sentences waiting, up to decode_batch_size of them,
+     *  without waiting for more: a slow input still gets each
+     *  sentence parsed as soon as it is read
+     */
+    size_t width = max(config.decode_batch_size, 1);
+    vector<StreamItem *> items;
+    vector<DependencySent> sents;
+    vector<DependencyGraph> graphs;
+    vector<int> order;
+    while (true)
+    {
+        items.clear();
+        {
+            unique_lock<mutex> guard(state->lock);
+            while (state->queue.empty() && !state->eof)
+                state->changed.wait(guard);
+            if (state->queue.empty())
+                return;
+            while (!state->queue.empty() && items.size() < width)
+            {
+                items.push_back(state->queue.front());
+                state->queue.pop_front();
+            }
+        }
+
+        sents.resize(items.size());
+        graphs.resize(items.size());
+        order.resize(items.size());
+        for (size_t i = 0; i < items.size(); ++i)
+        {
+            swap(sents[i], items[i]->sent);
+            intern(sents[i]);
+            order[i] = i;
+        }
+        int cursor = 0;
+        decode_lockstep(sents, order, cursor, graphs, false);
+
+        lock_guard<mutex> guard(state->lock);
+        for (size_t i = 0; i < items.size(); ++i)
+        {
+            swap(items[i]->sent, sents[i]);
+            swap(items[i]->graph, graphs[i]);
+            state->parsed[items[i]->seq] = items[i];
+        }
+        state->changed.notify_all();
+    }
+}
+
+void DependencyParser::quantize(const char * calib_file)
+{
+    cerr << "Calibration file: " << calib_file << endl;
+
+    vector<DependencySent> calib_sents;
+    vector<DependencyGraph> calib_graphs;
+    Util::load_conll_file_graph(calib_file, calib_sents, calib_graphs);
+
+    classifier->set_quantized(false);
+    classifier->start_calibration();
+    vector<DependencyGraph> predicted;
+    predict_graph(calib_sents, predicted);
+    classifier->quantize();
 }
 
 void DependencyParser::process_headless(Configuration& c)
@@ -2305,7 +3056,7 @@ void DependencyParser::process_headless_search_all(int k, vector<Snd_head>& cand
         else
             c.reset(i, k);
         double opt_score;
-        string opt_label;
+        int opt_label;
         get_best_label(c, opt_label, opt_score, dir);
         Snd_head snd_head;
         snd_head.head = i; snd_head.label = opt_label; snd_head.score = opt_score;
@@ -2313,24 +3064,26 @@ void DependencyParser::process_headless_search_all(int k, vector<Snd_head>& cand
     }
 }
 
-void DependencyParser::get_best_label(Configuration c, string & opt_label, double & opt_score, int arc_dir)
+void DependencyParser::get_best_label(Configuration c, int & opt_label, double & opt_score, int arc_dir)
 {
-    string prefix = arc_dir > 0 ? "L" : "R";
+    int dir = arc_dir > 0 ? 1 : -1;
     int num_trans = system->transitions.size();
-    vector<double> scores;
+    vector<nn_real> scores;
     vector<int> features = get_features(c);
     classifier->compute_scores(features, scores);
 
     opt_score = -DBL_MAX;
-    string opt_trans = "";
+    int opt_trans = -1;
 
     for (int i = 0; i < num_trans; ++i){
-        if (startswith(system->transitions[i], prefix) //ensure the arc is in right direction
+        if (system->trans_dirs[i] == dir //ensure the arc is in right direction
             &&scores[i] > opt_score){
             opt_score = scores[i];
-            opt_trans = system->transitions[i];
+            opt_trans = i;
         }
     }
 
-    opt_label = opt_trans.substr(3, opt_trans.length() - 4);
+    opt_label = (opt_trans < 0)
+                    ? -1
+                    : system->arc_labels[system->trans_labels[opt_trans]];
 }
\ No newline at end of file
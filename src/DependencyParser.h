@@ -10,6 +10,10 @@
 #include "ParsingSystem.h"
 #include "Classifier.h"
 #include "Configuration.h"
+#include "ModelFile.h"
+
+class ConllReader;
+struct StreamState;
 
 class DependencyParser
 {
@@ -53,17 +57,28 @@ class DependencyParser
 
         /**
          * if re_precompute is true, then do precomputing
-         *  based on test data, ignore that in the readin model
+         *  based on test data, ignore that in the readin model;
+         *  if calib_file is given, parse with int8 quantized scoring
+         *  calibrated on calib_file (CoNLL), and report UF/LF, speed
+         *  and memory against the full precision model
          */
         void test(
                 const char * test_file,
                 const char * output_file,
-                bool re_precompute = false);
+                bool re_precompute = false,
+                const char * calib_file = NULL);
 
         void test(
                 std::string & test_file,
                 std::string & output_file,
-                bool re_precompute = false);
+                bool re_precompute = false,
+                const std::string & calib_file = "");
+
+        /**
+         * collect activation ranges on @calib_file with the full
+         *  precision model, then switch the classifier to int8
+         */
+        void quantize(const char * calib_file);
 
         void gen_dictionaries_graph(
                 std::vector<DependencySent> & sents,
@@ -90,11 +105,38 @@ class DependencyParser
                 std::vector<DependencyGraph> & graphs,
                 std::vector<int> & precompute_ids);
 
+        /**
+         * save in the binary format (see ModelFile) if
+         *  config.binary_model, in the text format otherwise
+         */
         void save_model(const char * filename);
         void save_model(const std::string & filename);
+        void save_model_text(const char * filename);
+        void save_model_binary(const char * filename);
 
-        void load_model(const char * filename, bool re_precompute = false);
-        void load_model(const std::string & filename, bool re_precompute = false);
+        /**
+         * load a model of either format; the weights of a binary
+         *  model are used in place, from the mapped file. If
+         *  @calib_file is given, the model then scores in int8,
+         *  calibrated on @calib_file (see quantize). False (with a
+         *  message on cerr) if the file cannot be read or is malformed
+         */
+        bool load_model(
+                const char * filename,
+                bool re_precompute = false,
+                const char * calib_file = NULL);
+        bool load_model(
+                const std::string & filename,
+                bool re_precompute = false,
+                const std::string & calib_file = "");
+        bool load_model_text(const char * filename, bool re_precompute = false);
+        bool load_model_binary(const char * filename, bool re_precompute = false);
+
+        /**
+         * load the model @from and save it to @to in the other format,
+         *  false if @from cannot be loaded
+         */
+        bool convert_model(const char * from, const char * to);
 
         void load_model_cl(const char * filename, const char * clemb);
         void load_model_cl(
@@ -108,12 +150,71 @@ class DependencyParser
                 DependencySent& sent,
                 DependencyGraph& graph);
 
+        /**
+         * decode sentences of @sents taken from @order through
+         *  the shared @cursor (see next_sent), keeping
+         *  decode_batch_size of them in lockstep; each graph goes to
+         *  the matching entry of @graphs
+         */
+        void decode_lockstep(
+                std::vector<DependencySent>& sents,
+                std::vector<int>& order,
+                int& cursor,
+                std::vector<DependencyGraph>& graphs,
+                bool report);
+
+        /**
+         * index of the next sentence to decode, order[cursor++]
+         *  (atomically), or -1 when all are taken; the progress goes
+         *  to cerr if @report
+         */
+        int next_sent(std::vector<int>& order, int& cursor, bool report);
+
+        /**
+         * parse the CoNLL sentences of @input_file ("-" for stdin)
+         *  as they are read, and write each parsed sentence to
+         *  @output_file ("-" for stdout) as soon as the ones before
+         *  it are written. A reader thread, decode_threads workers
+         *  (decoding in lockstep what is ready, see decode_lockstep)
+         *  and the writer keep at most stream_window sentences in
+         *  memory, whatever the size of the input.
+         */
+        void parse_stream(const char * input_file, const char * output_file);
+
+
+        /**
+         * pick the best applicable transition given @scores
+         *  (saving the second head on "NS") and apply it to @c;
+         *  false if no transition is legal (@c is left as it is)
+         */
+        bool apply_best_transition(
+                Configuration& c,
+                std::vector<nn_real>& scores);
+
+        /**
+         * attach headless nodes of a terminal @c and copy its graph
+         */
+        void finish_graph(
+                Configuration& c,
+                DependencyGraph& graph);
+
+        /**
+         * fill the word/pos/cluster ids of @sent (see
+         *  DependencySent::word_ids) from the current dictionaries
+         */
+        void intern(DependencySent& sent);
+        // intern the sentences that are not interned yet
+        void intern(std::vector<DependencySent>& sents);
+        // extend @label_feats to the labels of DependencyGraph's table
+        void intern_labels();
+
         std::vector<int> get_features(Configuration& c);
         // Vec<int> get_features_array(Configuration& c);
 
         int get_word_id(const std::string & s);
         int get_pos_id(const std::string & s);
         int get_label_id(const std::string & s);
+        int get_label_id(int l); // for a DependencyGraph label id
 
         int get_distance_id(const int & d);
         int get_valency_id(const std::string & v);
@@ -123,10 +224,33 @@ class DependencyParser
 
         void process_headless(Configuration& c);
         void process_headless_search_all(int k, std::vector<Snd_head>& cand_2nd_heads, Configuration& c, int dir);
-        void get_best_label(Configuration c, std::string & opt_label, double & opt_score, int arc_dir); // arc_dir is the arc direction
+        void get_best_label(Configuration c, int & opt_label, double & opt_score, int arc_dir); // arc_dir is the arc direction, @opt_label a label id
 
     private:
         void generate_ids();
+        // fill valency_feats, distance_feats and length_feats
+        void generate_feature_tables();
+
+        int get_valency_feat(Configuration& c, int typ, int k);
+
+        // stages of parse_stream
+        void stream_read(StreamState * state, ConllReader * reader);
+        void stream_parse(StreamState * state);
+
+        /**
+         * create the classifier from the loaded weights (pre-computing
+         *  unless @re_precompute) and the parsing system
+         */
+        void setup_loaded_model(
+                Mat<nn_real>& Eb,
+                Mat<nn_real>& Ed,
+                Mat<nn_real>& Ev,
+                Mat<nn_real>& Ec,
+                Mat<nn_real>& El,
+                Mat<nn_real>& W1,
+                Vec<nn_real>& b1,
+                Mat<nn_real>& W2,
+                bool re_precompute);
 
     private:
         std::vector<std::string> known_words;
@@ -148,10 +272,32 @@ class DependencyParser
 
         std::unordered_map<std::string, int> cluster_ids;
 
+        /**
+         * label_feats[l + 1] = get_label_id of DependencyGraph label
+         *  id l (l = -1 for no arc), filled by intern_labels
+         */
+        std::vector<int> label_feats;
+
+        /**
+         * ids of the small integer features, filled by generate_ids:
+         *  - valency_feats[t * (N_VALENCY_BUCKETS + 1) + b + 1] for
+         *    valency type t and bucket b (see
+         *    Configuration::get_valency_bucket, b = -1 for UNKNOWN)
+         *  - distance_feats[d] for an encoded distance d
+         *  - length_feats[l] for a length l, the last entry for
+         *    lengths beyond the known ones
+         */
+        std::vector<int> valency_feats;
+        std::vector<int> distance_feats;
+        std::vector<int> length_feats;
+
         std::vector<int> pre_computed_ids;
-        NNClassifier * classifier;
+        NNClassifier<nn_real> * classifier;
         ParsingSystem * system;
 
+        // mapped binary model whose weights the classifier views
+        ModelFile model_file;
+
         Mat<double> embeddings;
         std::unordered_map<std::string, int> embed_ids;
 
@@ -8,15 +8,6 @@ DependencySent::DependencySent()
     init();
 }
 
-DependencySent::DependencySent(const DependencySent& s)
-{
-    n = s.n;
-    words = s.words;
-    poss = s.poss;
-    clusters = s.clusters;
-    // pposs = s.pposs;
-}
-
 void DependencySent::add(string& word, string& pos, string& cluster)
 {
     ++ n;
@@ -33,6 +24,14 @@ void DependencySent::init()
     poss.clear();
     clusters.clear();
     // pposs.clear();
+    word_ids.clear();
+    pos_ids.clear();
+    cluster_ids.clear();
+}
+
+bool DependencySent::interned() const
+{
+    return (int)word_ids.size() == n + 2;
 }
 
 void DependencySent::print_info()
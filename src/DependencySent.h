@@ -8,8 +8,6 @@ class DependencySent
 {
     public:
         DependencySent();
-        DependencySent(const DependencySent& s);
-        ~DependencySent() {}
 
         void add(std::string& word, std::string& pos, std::string& cluster);
 
@@ -17,12 +15,25 @@ class DependencySent
 
         void print_info();
 
+        // true if the id arrays below are filled for the current words
+        bool interned() const;
+
     public:
         int n;
         std::vector<std::string> words;
         std::vector<std::string> poss;
         std::vector<std::string> clusters;
         // std::vector<std::string> pposs; #TODO
+
+        /**
+         * Feature ids of the tokens, filled once by
+         *  DependencyParser::intern so that feature extraction
+         *  only indexes arrays. Node k (0 = root) is at [k + 1],
+         *  [0] holds the id of a non-existent node (NIL).
+         */
+        std::vector<int> word_ids;
+        std::vector<int> pos_ids;
+        std::vector<int> cluster_ids;
 };
 
 #endif
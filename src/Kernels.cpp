@@ -0,0 +1,1191 @@
+#include "Kernels.h"
+#include "Random.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define NNDEP_X86
+#include <immintrin.h>
+#endif
+
+/**
+ * Every implementation below computes each output element as
+ *  one dot product accumulated in the same order, whether it is
+ *  reached through dot(), gemv() or inside a gemm() tile (tails
+ *  are handled with masked loads, not scalar loops). Hence batched
+ *  and single-vector scores are bit-identical on a given CPU.
+ *
+ * The vector code is written once per instruction set, templated
+ *  on a register traits class (double or float lanes).
+ */
+
+/**
+ * Block of B rows kept hot in cache while all rows of A sweep it.
+ */
+static const int GEMM_NB = 32;
+
+/**
+ * Scalar reference implementation
+ */
+template <typename Real>
+static Real dot_scalar(const Real * x, const Real * y, int n)
+{
+    Real s = 0;
+    for (int i = 0; i < n; ++i)
+        s += x[i] * y[i];
+    return s;
+}
+
+template <typename Real>
+static void gemm_scalar(
+        const Real * const * A,
+        const Real * B,
+        int ldb,
+        Real * const * C,
+        int m,
+        int n,
+        int k)
+{
+    for (int jb = 0; jb < n; jb += GEMM_NB)
+    {
+        int je = (jb + GEMM_NB < n) ? jb + GEMM_NB : n;
+        for (int i = 0; i < m; ++i)
+            for (int j = jb; j < je; ++j)
+                C[i][j] += dot_scalar(A[i], B + (long)j * ldb, k);
+    }
+}
+
+template <typename Real>
+static void gemm_nn_scalar(
+        const Real * const * A,
+        const Real * const * B,
+        Real * const * C,
+        int m,
+        int n,
+        int k)
+{
+    for (int i = 0; i < m; ++i)
+        for (int p = 0; p < k; ++p)
+        {
+            Real a = A[i][p];
+            if (a == 0)
+                continue;
+            for (int j = 0; j < n; ++j)
+                C[i][j] += a * B[p][j];
+        }
+}
+
+template <typename Real>
+static void add_scalar(Real * y, const Real * x, int n)
+{
+    for (int i = 0; i < n; ++i)
+        y[i] += x[i];
+}
+
+template <typename Real>
+static void cube_scalar(Real * h, const Real * b, int n)
+{
+    for (int i = 0; i < n; ++i)
+    {
+        h[i] += b[i];
+        h[i] = h[i] * h[i] * h[i];
+    }
+}
+
+template <typename Real>
+static void axpy_i8_scalar(Real * y, Real a, const int8_t * x, int n)
+{
+    for (int i = 0; i < n; ++i)
+        y[i] += a * x[i];
+}
+
+static void gemv_i8_scalar(
+        const int8_t * A,
+        int lda,
+        int m,
+        int n,
+        const int8_t * x,
+        int32_t * y)
+{
+    for (int i = 0; i < m; ++i)
+    {
+        const int8_t * a = A + (long)i * lda;
+        int32_t s = 0;
+        for (int j = 0; j < n; ++j)
+            s += (int32_t)a[j] * x[j];
+        y[i] = s;
+    }
+}
+
+static void bernoulli_mask_scalar(
+        uint32_t key,
+        uint32_t threshold,
+        uint64_t * bits,
+        int n)
+{
+    for (int w = 0; w * 64 < n; ++w)
+    {
+        uint64_t word = 0;
+        for (int i = 0; i < 64 && w * 64 + i < n; ++i)
+            if (Random::at(key, w * 64 + i) >= threshold)
+                word |= 1ULL << i;
+        bits[w] = word;
+    }
+}
+
+#ifdef NNDEP_X86
+
+/**
+ * AVX2 + FMA, 256-bit registers
+ */
+#define NNDEP_AVX2 __attribute__((target("avx2,fma")))
+
+/**
+ * Random::at on 8 counters at a time; unsigned compare
+ *  as max(x, t) == x, one bit per lane via movemask
+ */
+NNDEP_AVX2
+static void bernoulli_mask_avx2(
+        uint32_t key,
+        uint32_t threshold,
+        uint64_t * bits,
+        int n)
+{
+    const __m256i vkey = _mm256_set1_epi32(key);
+    const __m256i vt = _mm256_set1_epi32(threshold);
+    const __m256i golden = _mm256_set1_epi32(0x9E3779B9U);
+    const __m256i m1 = _mm256_set1_epi32(0x7FEB352DU);
+    const __m256i m2 = _mm256_set1_epi32(0x846CA68BU);
+    const __m256i step = _mm256_set1_epi32(8);
+    __m256i ctr = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+    for (int w = 0; w * 64 < n; ++w)
+    {
+        uint64_t word = 0;
+        for (int i = 0; i < 64; i += 8)
+        {
+            __m256i x = _mm256_add_epi32(_mm256_mullo_epi32(ctr, golden), vkey);
+            x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 16));
+            x = _mm256_mullo_epi32(x, m1);
+            x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 15));
+            x = _mm256_mullo_epi32(x, m2);
+            x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 16));
+            __m256i ge = _mm256_cmpeq_epi32(_mm256_max_epu32(x, vt), x);
+            uint64_t b = (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(ge));
+            word |= b << i;
+            ctr = _mm256_add_epi32(ctr, step);
+        }
+        int rest = n - w * 64;
+        if (rest < 64)
+            word &= (1ULL << rest) - 1;
+        bits[w] = word;
+    }
+}
+
+/**
+ * int8 products: sign-extend 16 bytes to int16,
+ *  then multiply and add pairs into 8 int32 lanes
+ */
+NNDEP_AVX2
+static void gemv_i8_avx2(
+        const int8_t * A,
+        int lda,
+        int m,
+        int n,
+        const int8_t * x,
+        int32_t * y)
+{
+    for (int i = 0; i < m; ++i)
+    {
+        const int8_t * a = A + (long)i * lda;
+        __m256i acc = _mm256_setzero_si256();
+        int j = 0;
+        for (; j + 16 <= n; j += 16)
+        {
+            __m256i va = _mm256_cvtepi8_epi16(
+                    _mm_loadu_si128((const __m128i *)(a + j)));
+            __m256i vx = _mm256_cvtepi8_epi16(
+                    _mm_loadu_si128((const __m128i *)(x + j)));
+            acc = _mm256_add_epi32(acc, _mm256_madd_epi16(va, vx));
+        }
+        __m128i s = _mm_add_epi32(_mm256_castsi256_si128(acc),
+                                  _mm256_extracti128_si256(acc, 1));
+        s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4E));
+        s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xB1));
+        int32_t r = _mm_cvtsi128_si32(s);
+        for (; j < n; ++j)
+            r += (int32_t)a[j] * x[j];
+        y[i] = r;
+    }
+}
+
+struct Avx2Double
+{
+    typedef double real;
+    typedef __m256d reg;
+    typedef __m256i mask;
+    static const int width = 4;
+
+    // first r (< width) lanes
+    NNDEP_AVX2 static inline mask tail(int r)
+    {
+        return _mm256_setr_epi64x(r > 0 ? -1 : 0,
+                                  r > 1 ? -1 : 0,
+                                  r > 2 ? -1 : 0,
+                                  0);
+    }
+    NNDEP_AVX2 static inline reg zero() { return _mm256_setzero_pd(); }
+    NNDEP_AVX2 static inline reg set1(real a) { return _mm256_set1_pd(a); }
+    NNDEP_AVX2 static inline reg load(const real * p) { return _mm256_loadu_pd(p); }
+    NNDEP_AVX2 static inline reg load_i8(const int8_t * p)
+    {
+        int32_t b;
+        memcpy(&b, p, sizeof(b));
+        return _mm256_cvtepi32_pd(_mm_cvtepi8_epi32(_mm_cvtsi32_si128(b)));
+    }
+    NNDEP_AVX2 static inline reg load(const real * p, mask m) { return _mm256_maskload_pd(p, m); }
+    NNDEP_AVX2 static inline void store(real * p, reg v) { _mm256_storeu_pd(p, v); }
+    NNDEP_AVX2 static inline void store(real * p, reg v, mask m) { _mm256_maskstore_pd(p, m, v); }
+    NNDEP_AVX2 static inline reg add(reg a, reg b) { return _mm256_add_pd(a, b); }
+    NNDEP_AVX2 static inline reg mul(reg a, reg b) { return _mm256_mul_pd(a, b); }
+    NNDEP_AVX2 static inline reg fmadd(reg a, reg b, reg c) { return _mm256_fmadd_pd(a, b, c); }
+    NNDEP_AVX2 static inline real hsum(reg v)
+    {
+        __m128d lo = _mm256_castpd256_pd128(v);
+        __m128d hi = _mm256_extractf128_pd(v, 1);
+        lo = _mm_add_pd(lo, hi);
+        hi = _mm_unpackhi_pd(lo, lo);
+        return _mm_cvtsd_f64(_mm_add_sd(lo, hi));
+    }
+};
+
+struct Avx2Float
+{
+    typedef float real;
+    typedef __m256 reg;
+    typedef __m256i mask;
+    static const int width = 8;
+
+    NNDEP_AVX2 static inline mask tail(int r)
+    {
+        return _mm256_cmpgt_epi32(_mm256_set1_epi32(r),
+                                  _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    }
+    NNDEP_AVX2 static inline reg zero() { return _mm256_setzero_ps(); }
+    NNDEP_AVX2 static inline reg set1(real a) { return _mm256_set1_ps(a); }
+    NNDEP_AVX2 static inline reg load(const real * p) { return _mm256_loadu_ps(p); }
+    NNDEP_AVX2 static inline reg load_i8(const int8_t * p)
+    {
+        return _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(
+                    _mm_loadl_epi64((const __m128i *)p)));
+    }
+    NNDEP_AVX2 static inline reg load(const real * p, mask m) { return _mm256_maskload_ps(p, m); }
+    NNDEP_AVX2 static inline void store(real * p, reg v) { _mm256_storeu_ps(p, v); }
+    NNDEP_AVX2 static inline void store(real * p, reg v, mask m) { _mm256_maskstore_ps(p, m, v); }
+    NNDEP_AVX2 static inline reg add(reg a, reg b) { return _mm256_add_ps(a, b); }
+    NNDEP_AVX2 static inline reg mul(reg a, reg b) { return _mm256_mul_ps(a, b); }
+    NNDEP_AVX2 static inline reg fmadd(reg a, reg b, reg c) { return _mm256_fmadd_ps(a, b, c); }
+    NNDEP_AVX2 static inline real hsum(reg v)
+    {
+        __m128 lo = _mm256_castps256_ps128(v);
+        __m128 hi = _mm256_extractf128_ps(v, 1);
+        lo = _mm_add_ps(lo, hi);
+        hi = _mm_movehl_ps(hi, lo);
+        lo = _mm_add_ps(lo, hi);
+        hi = _mm_shuffle_ps(lo, lo, 1);
+        return _mm_cvtss_f32(_mm_add_ss(lo, hi));
+    }
+};
+
+template <typename V>
+NNDEP_AVX2
+static typename V::real dot_avx2(
+        const typename V::real * x,
+        const typename V::real * y,
+        int n)
+{
+    typename V::reg acc = V::zero();
+    int i = 0;
+    for (; i + V::width <= n; i += V::width)
+        acc = V::fmadd(V::load(x + i), V::load(y + i), acc);
+    if (i < n)
+    {
+        typename V::mask mk = V::tail(n - i);
+        acc = V::fmadd(V::load(x + i, mk), V::load(y + i, mk), acc);
+    }
+    return V::hsum(acc);
+}
+
+// one row of A against four rows of B (the matrix-vector case)
+template <typename V>
+NNDEP_AVX2
+static void tile_1x4_avx2(
+        const typename V::real * a,
+        const typename V::real * B,
+        int ldb,
+        typename V::real * c,
+        int k)
+{
+    typedef typename V::reg reg;
+    const typename V::real * b0 = B;
+    const typename V::real * b1 = b0 + ldb;
+    const typename V::real * b2 = b1 + ldb;
+    const typename V::real * b3 = b2 + ldb;
+
+    reg acc0 = V::zero(), acc1 = V::zero(), acc2 = V::zero(), acc3 = V::zero();
+    int l = 0;
+    for (; l + V::width <= k; l += V::width)
+    {
+        reg av = V::load(a + l);
+        acc0 = V::fmadd(av, V::load(b0 + l), acc0);
+        acc1 = V::fmadd(av, V::load(b1 + l), acc1);
+        acc2 = V::fmadd(av, V::load(b2 + l), acc2);
+        acc3 = V::fmadd(av, V::load(b3 + l), acc3);
+    }
+    if (l < k)
+    {
+        typename V::mask mk = V::tail(k - l);
+        reg av = V::load(a + l, mk);
+        acc0 = V::fmadd(av, V::load(b0 + l, mk), acc0);
+        acc1 = V::fmadd(av, V::load(b1 + l, mk), acc1);
+        acc2 = V::fmadd(av, V::load(b2 + l, mk), acc2);
+        acc3 = V::fmadd(av, V::load(b3 + l, mk), acc3);
+    }
+    c[0] += V::hsum(acc0);
+    c[1] += V::hsum(acc1);
+    c[2] += V::hsum(acc2);
+    c[3] += V::hsum(acc3);
+}
+
+// four rows of A against two rows of B: every load of B is used 4x
+template <typename V>
+NNDEP_AVX2
+static void tile_4x2_avx2(
+        const typename V::real * const * A,
+        const typename V::real * B,
+        int ldb,
+        typename V::real * const * C,
+        int j,
+        int k)
+{
+    typedef typename V::reg reg;
+    const typename V::real * a0 = A[0];
+    const typename V::real * a1 = A[1];
+    const typename V::real * a2 = A[2];
+    const typename V::real * a3 = A[3];
+    const typename V::real * b0 = B + (long)j * ldb;
+    const typename V::real * b1 = b0 + ldb;
+
+    reg acc00 = V::zero(), acc01 = V::zero();
+    reg acc10 = V::zero(), acc11 = V::zero();
+    reg acc20 = V::zero(), acc21 = V::zero();
+    reg acc30 = V::zero(), acc31 = V::zero();
+    int l = 0;
+    for (; l + V::width <= k; l += V::width)
+    {
+        reg bv0 = V::load(b0 + l);
+        reg bv1 = V::load(b1 + l);
+        reg av = V::load(a0 + l);
+        acc00 = V::fmadd(av, bv0, acc00);
+        acc01 = V::fmadd(av, bv1, acc01);
+        av = V::load(a1 + l);
+        acc10 = V::fmadd(av, bv0, acc10);
+        acc11 = V::fmadd(av, bv1, acc11);
+        av = V::load(a2 + l);
+        acc20 = V::fmadd(av, bv0, acc20);
+        acc21 = V::fmadd(av, bv1, acc21);
+        av = V::load(a3 + l);
+        acc30 = V::fmadd(av, bv0, acc30);
+        acc31 = V::fmadd(av, bv1, acc31);
+    }
+    if (l < k)
+    {
+        typename V::mask mk = V::tail(k - l);
+        reg bv0 = V::load(b0 + l, mk);
+        reg bv1 = V::load(b1 + l, mk);
+        reg av = V::load(a0 + l, mk);
+        acc00 = V::fmadd(av, bv0, acc00);
+        acc01 = V::fmadd(av, bv1, acc01);
+        av = V::load(a1 + l, mk);
+        acc10 = V::fmadd(av, bv0, acc10);
+        acc11 = V::fmadd(av, bv1, acc11);
+        av = V::load(a2 + l, mk);
+        acc20 = V::fmadd(av, bv0, acc20);
+        acc21 = V::fmadd(av, bv1, acc21);
+        av = V::load(a3 + l, mk);
+        acc30 = V::fmadd(av, bv0, acc30);
+        acc31 = V::fmadd(av, bv1, acc31);
+    }
+    C[0][j] += V::hsum(acc00); C[0][j + 1] += V::hsum(acc01);
+    C[1][j] += V::hsum(acc10); C[1][j + 1] += V::hsum(acc11);
+    C[2][j] += V::hsum(acc20); C[2][j + 1] += V::hsum(acc21);
+    C[3][j] += V::hsum(acc30); C[3][j + 1] += V::hsum(acc31);
+}
+
+template <typename V>
+NNDEP_AVX2
+static void gemm_avx2(
+        const typename V::real * const * A,
+        const typename V::real * B,
+        int ldb,
+        typename V::real * const * C,
+        int m,
+        int n,
+        int k)
+{
+    for (int jb = 0; jb < n; jb += GEMM_NB)
+    {
+        int je = (jb + GEMM_NB < n) ? jb + GEMM_NB : n;
+        int i = 0;
+        for (; i + 4 <= m; i += 4)
+        {
+            int j = jb;
+            for (; j + 2 <= je; j += 2)
+                tile_4x2_avx2<V>(A + i, B, ldb, C + i, j, k);
+            for (; j < je; ++j)
+                for (int r = i; r < i + 4; ++r)
+                    C[r][j] += dot_avx2<V>(A[r], B + (long)j * ldb, k);
+        }
+        for (; i < m; ++i)
+        {
+            int j = jb;
+            for (; j + 4 <= je; j += 4)
+                tile_1x4_avx2<V>(A[i], B + (long)j * ldb, ldb, C[i] + j, k);
+            for (; j < je; ++j)
+                C[i][j] += dot_avx2<V>(A[i], B + (long)j * ldb, k);
+        }
+    }
+}
+
+/**
+ * gemm_nn: @R rows of C, two registers wide, held in registers
+ *  while the rows of B stream by; a row p of B is skipped when
+ *  A[.][p] is zero for all @R rows (dropped-out hidden units)
+ */
+template <typename V, int R>
+NNDEP_AVX2
+static void tile_nn_avx2(
+        const typename V::real * const * A,
+        const typename V::real * const * B,
+        typename V::real * const * C,
+        int j,
+        int n,
+        int k)
+{
+    typedef typename V::reg reg;
+    typedef typename V::mask mask;
+    const int W = V::width;
+
+    // lanes of the two registers inside [j, n)
+    bool full0 = (j + W <= n), full1 = (j + 2 * W <= n);
+    mask mk0 = V::tail(n - j);
+    mask mk1 = V::tail(n - j - W);
+    bool use1 = (j + W < n);
+
+    reg acc[R][2];
+    for (int r = 0; r < R; ++r)
+    {
+        acc[r][0] = full0 ? V::load(C[r] + j) : V::load(C[r] + j, mk0);
+        acc[r][1] = V::zero();
+        if (use1)
+            acc[r][1] = full1 ? V::load(C[r] + j + W) : V::load(C[r] + j + W, mk1);
+    }
+
+    for (int p = 0; p < k; ++p)
+    {
+        bool skip = true;
+        for (int r = 0; r < R; ++r)
+            skip = skip && (A[r][p] == 0);
+        if (skip)
+            continue;
+
+        const typename V::real * b = B[p] + j;
+        reg b0 = full0 ? V::load(b) : V::load(b, mk0);
+        reg b1 = V::zero();
+        if (use1)
+            b1 = full1 ? V::load(b + W) : V::load(b + W, mk1);
+        for (int r = 0; r < R; ++r)
+        {
+            reg av = V::set1(A[r][p]);
+            acc[r][0] = V::fmadd(av, b0, acc[r][0]);
+            acc[r][1] = V::fmadd(av, b1, acc[r][1]);
+        }
+    }
+
+    for (int r = 0; r < R; ++r)
+    {
+        if (full0) V::store(C[r] + j, acc[r][0]);
+        else       V::store(C[r] + j, acc[r][0], mk0);
+        if (use1)
+        {
+            if (full1) V::store(C[r] + j + W, acc[r][1]);
+            else       V::store(C[r] + j + W, acc[r][1], mk1);
+        }
+    }
+}
+
+template <typename V>
+NNDEP_AVX2
+static void gemm_nn_avx2(
+        const typename V::real * const * A,
+        const typename V::real * const * B,
+        typename V::real * const * C,
+        int m,
+        int n,
+        int k)
+{
+    int i = 0;
+    for (; i + 4 <= m; i += 4)
+        for (int j = 0; j < n; j += 2 * V::width)
+            tile_nn_avx2<V, 4>(A + i, B, C + i, j, n, k);
+    for (; i < m; ++i)
+        for (int j = 0; j < n; j += 2 * V::width)
+            tile_nn_avx2<V, 1>(A + i, B, C + i, j, n, k);
+}
+
+template <typename V>
+NNDEP_AVX2
+static void add_avx2(typename V::real * y, const typename V::real * x, int n)
+{
+    int i = 0;
+    for (; i + V::width <= n; i += V::width)
+        V::store(y + i, V::add(V::load(y + i), V::load(x + i)));
+    for (; i < n; ++i)
+        y[i] += x[i];
+}
+
+template <typename V>
+NNDEP_AVX2
+static void cube_avx2(typename V::real * h, const typename V::real * b, int n)
+{
+    int i = 0;
+    for (; i + V::width <= n; i += V::width)
+    {
+        typename V::reg v = V::add(V::load(h + i), V::load(b + i));
+        V::store(h + i, V::mul(V::mul(v, v), v));
+    }
+    for (; i < n; ++i)
+    {
+        h[i] += b[i];
+        h[i] = h[i] * h[i] * h[i];
+    }
+}
+
+template <typename V>
+NNDEP_AVX2
+static void axpy_i8_avx2(
+        typename V::real * y,
+        typename V::real a,
+        const int8_t * x,
+        int n)
+{
+    typename V::reg va = V::set1(a);
+    int i = 0;
+    for (; i + V::width <= n; i += V::width)
+        V::store(y + i, V::fmadd(va, V::load_i8(x + i), V::load(y + i)));
+    for (; i < n; ++i)
+        y[i] += a * x[i];
+}
+
+/**
+ * AVX-512, 512-bit registers with lane masks
+ */
+#define NNDEP_AVX512 __attribute__((target("avx512f")))
+
+struct Avx512Double
+{
+    typedef double real;
+    typedef __m512d reg;
+    typedef __mmask8 mask;
+    static const int width = 8;
+
+    // first min(r, width) lanes
+    NNDEP_AVX512 static inline mask tail(int r)
+    {
+        return (r >= width) ? (mask)0xFF : (mask)((1u << r) - 1);
+    }
+    NNDEP_AVX512 static inline reg zero() { return _mm512_setzero_pd(); }
+    NNDEP_AVX512 static inline reg set1(real a) { return _mm512_set1_pd(a); }
+    NNDEP_AVX512 static inline reg load_i8(const int8_t * p)
+    {
+        return _mm512_cvtepi32_pd(_mm256_cvtepi8_epi32(
+                    _mm_loadl_epi64((const __m128i *)p)));
+    }
+    NNDEP_AVX512 static inline reg load(const real * p, mask m) { return _mm512_maskz_loadu_pd(m, p); }
+    NNDEP_AVX512 static inline void store(real * p, reg v, mask m) { _mm512_mask_storeu_pd(p, m, v); }
+    NNDEP_AVX512 static inline reg add(reg a, reg b) { return _mm512_add_pd(a, b); }
+    NNDEP_AVX512 static inline reg mul(reg a, reg b) { return _mm512_mul_pd(a, b); }
+    NNDEP_AVX512 static inline reg fmadd(reg a, reg b, reg c) { return _mm512_fmadd_pd(a, b, c); }
+    NNDEP_AVX512 static inline real hsum(reg v) { return _mm512_reduce_add_pd(v); }
+};
+
+struct Avx512Float
+{
+    typedef float real;
+    typedef __m512 reg;
+    typedef __mmask16 mask;
+    static const int width = 16;
+
+    NNDEP_AVX512 static inline mask tail(int r)
+    {
+        return (r >= width) ? (mask)0xFFFF : (mask)((1u << r) - 1);
+    }
+    NNDEP_AVX512 static inline reg zero() { return _mm512_setzero_ps(); }
+    NNDEP_AVX512 static inline reg set1(real a) { return _mm512_set1_ps(a); }
+    NNDEP_AVX512 static inline reg load_i8(const int8_t * p)
+    {
+        return _mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(
+                    _mm_loadu_si128((const __m128i *)p)));
+    }
+    NNDEP_AVX512 static inline reg load(const real * p, mask m) { return _mm512_maskz_loadu_ps(m, p); }
+    NNDEP_AVX512 static inline void store(real * p, reg v, mask m) { _mm512_mask_storeu_ps(p, m, v); }
+    NNDEP_AVX512 static inline reg add(reg a, reg b) { return _mm512_add_ps(a, b); }
+    NNDEP_AVX512 static inline reg mul(reg a, reg b) { return _mm512_mul_ps(a, b); }
+    NNDEP_AVX512 static inline reg fmadd(reg a, reg b, reg c) { return _mm512_fmadd_ps(a, b, c); }
+    NNDEP_AVX512 static inline real hsum(reg v) { return _mm512_reduce_add_ps(v); }
+};
+
+template <typename V>
+NNDEP_AVX512
+static typename V::real dot_avx512(
+        const typename V::real * x,
+        const typename V::real * y,
+        int n)
+{
+    typename V::reg acc = V::zero();
+    for (int i = 0; i < n; i += V::width)
+    {
+        typename V::mask mk = V::tail(n - i);
+        acc = V::fmadd(V::load(x + i, mk), V::load(y + i, mk), acc);
+    }
+    return V::hsum(acc);
+}
+
+template <typename V>
+NNDEP_AVX512
+static void tile_1x4_avx512(
+        const typename V::real * a,
+        const typename V::real * B,
+        int ldb,
+        typename V::real * c,
+        int k)
+{
+    typedef typename V::reg reg;
+    const typename V::real * b0 = B;
+    const typename V::real * b1 = b0 + ldb;
+    const typename V::real * b2 = b1 + ldb;
+    const typename V::real * b3 = b2 + ldb;
+
+    reg acc0 = V::zero(), acc1 = V::zero(), acc2 = V::zero(), acc3 = V::zero();
+    for (int l = 0; l < k; l += V::width)
+    {
+        typename V::mask mk = V::tail(k - l);
+        reg av = V::load(a + l, mk);
+        acc0 = V::fmadd(av, V::load(b0 + l, mk), acc0);
+        acc1 = V::fmadd(av, V::load(b1 + l, mk), acc1);
+        acc2 = V::fmadd(av, V::load(b2 + l, mk), acc2);
+        acc3 = V::fmadd(av, V::load(b3 + l, mk), acc3);
+    }
+    c[0] += V::hsum(acc0);
+    c[1] += V::hsum(acc1);
+    c[2] += V::hsum(acc2);
+    c[3] += V::hsum(acc3);
+}
+
+// four rows of A against four rows of B
+template <typename V>
+NNDEP_AVX512
+static void tile_4x4_avx512(
+        const typename V::real * const * A,
+        const typename V::real * B,
+        int ldb,
+        typename V::real * const * C,
+        int j,
+        int k)
+{
+    typedef typename V::reg reg;
+    const typename V::real * b0 = B + (long)j * ldb;
+    const typename V::real * b1 = b0 + ldb;
+    const typename V::real * b2 = b1 + ldb;
+    const typename V::real * b3 = b2 + ldb;
+
+    reg acc[4][4];
+    for (int r = 0; r < 4; ++r)
+        for (int c = 0; c < 4; ++c)
+            acc[r][c] = V::zero();
+
+    for (int l = 0; l < k; l += V::width)
+    {
+        typename V::mask mk = V::tail(k - l);
+        reg bv0 = V::load(b0 + l, mk);
+        reg bv1 = V::load(b1 + l, mk);
+        reg bv2 = V::load(b2 + l, mk);
+        reg bv3 = V::load(b3 + l, mk);
+        for (int r = 0; r < 4; ++r)
+        {
+            reg av = V::load(A[r] + l, mk);
+            acc[r][0] = V::fmadd(av, bv0, acc[r][0]);
+            acc[r][1] = V::fmadd(av, bv1, acc[r][1]);
+            acc[r][2] = V::fmadd(av, bv2, acc[r][2]);
+            acc[r][3] = V::fmadd(av, bv3, acc[r][3]);
+        }
+    }
+    for (int r = 0; r < 4; ++r)
+        for (int c = 0; c < 4; ++c)
+            C[r][j + c] += V::hsum(acc[r][c]);
+}
+
+template <typename V>
+NNDEP_AVX512
+static void gemm_avx512(
+        const typename V::real * const * A,
+        const typename V::real * B,
+        int ldb,
+        typename V::real * const * C,
+        int m,
+        int n,
+        int k)
+{
+    for (int jb = 0; jb < n; jb += GEMM_NB)
+    {
+        int je = (jb + GEMM_NB < n) ? jb + GEMM_NB : n;
+        int i = 0;
+        for (; i + 4 <= m; i += 4)
+        {
+            int j = jb;
+            for (; j + 4 <= je; j += 4)
+                tile_4x4_avx512<V>(A + i, B, ldb, C + i, j, k);
+            for (; j < je; ++j)
+                for (int r = i; r < i + 4; ++r)
+                    C[r][j] += dot_avx512<V>(A[r], B + (long)j * ldb, k);
+        }
+        for (; i < m; ++i)
+        {
+            int j = jb;
+            for (; j + 4 <= je; j += 4)
+                tile_1x4_avx512<V>(A[i], B + (long)j * ldb, ldb, C[i] + j, k);
+            for (; j < je; ++j)
+                C[i][j] += dot_avx512<V>(A[i], B + (long)j * ldb, k);
+        }
+    }
+}
+
+// bernoulli_mask: 16 counters at a time, compare straight into a mask
+NNDEP_AVX512
+static void bernoulli_mask_avx512(
+        uint32_t key,
+        uint32_t threshold,
+        uint64_t * bits,
+        int n)
+{
+    const __m512i vkey = _mm512_set1_epi32(key);
+    const __m512i vt = _mm512_set1_epi32(threshold);
+    const __m512i golden = _mm512_set1_epi32(0x9E3779B9U);
+    const __m512i m1 = _mm512_set1_epi32(0x7FEB352DU);
+    const __m512i m2 = _mm512_set1_epi32(0x846CA68BU);
+    const __m512i step = _mm512_set1_epi32(16);
+    __m512i ctr = _mm512_setr_epi32(
+            0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+
+    for (int w = 0; w * 64 < n; ++w)
+    {
+        uint64_t word = 0;
+        for (int i = 0; i < 64; i += 16)
+        {
+            __m512i x = _mm512_add_epi32(_mm512_mullo_epi32(ctr, golden), vkey);
+            x = _mm512_xor_si512(x, _mm512_srli_epi32(x, 16));
+            x = _mm512_mullo_epi32(x, m1);
+            x = _mm512_xor_si512(x, _mm512_srli_epi32(x, 15));
+            x = _mm512_mullo_epi32(x, m2);
+            x = _mm512_xor_si512(x, _mm512_srli_epi32(x, 16));
+            uint64_t b = _mm512_cmpge_epu32_mask(x, vt);
+            word |= b << i;
+            ctr = _mm512_add_epi32(ctr, step);
+        }
+        int rest = n - w * 64;
+        if (rest < 64)
+            word &= (1ULL << rest) - 1;
+        bits[w] = word;
+    }
+}
+
+// gemm_nn: @R rows of C, four registers wide (see tile_nn_avx2)
+template <typename V, int R>
+NNDEP_AVX512
+static void tile_nn_avx512(
+        const typename V::real * const * A,
+        const typename V::real * const * B,
+        typename V::real * const * C,
+        int j,
+        int n,
+        int k)
+{
+    typedef typename V::reg reg;
+    typedef typename V::mask mask;
+    const int W = V::width;
+
+    mask mk[4];
+    for (int v = 0; v < 4; ++v)
+    {
+        int r = n - j - v * W;
+        mk[v] = (r > 0) ? V::tail(r) : (mask)0;
+    }
+
+    reg acc[R][4];
+    for (int r = 0; r < R; ++r)
+        for (int v = 0; v < 4; ++v)
+            acc[r][v] = V::load(C[r] + j + v * W, mk[v]);
+
+    for (int p = 0; p < k; ++p)
+    {
+        bool skip = true;
+        for (int r = 0; r < R; ++r)
+            skip = skip && (A[r][p] == 0);
+        if (skip)
+            continue;
+
+        const typename V::real * b = B[p] + j;
+        reg bv[4];
+        for (int v = 0; v < 4; ++v)
+            bv[v] = V::load(b + v * W, mk[v]);
+        for (int r = 0; r < R; ++r)
+        {
+            reg av = V::set1(A[r][p]);
+            for (int v = 0; v < 4; ++v)
+                acc[r][v] = V::fmadd(av, bv[v], acc[r][v]);
+        }
+    }
+
+    for (int r = 0; r < R; ++r)
+        for (int v = 0; v < 4; ++v)
+            V::store(C[r] + j + v * W, acc[r][v], mk[v]);
+}
+
+template <typename V>
+NNDEP_AVX512
+static void gemm_nn_avx512(
+        const typename V::real * const * A,
+        const typename V::real * const * B,
+        typename V::real * const * C,
+        int m,
+        int n,
+        int k)
+{
+    int i = 0;
+    for (; i + 4 <= m; i += 4)
+        for (int j = 0; j < n; j += 4 * V::width)
+            tile_nn_avx512<V, 4>(A + i, B, C + i, j, n, k);
+    for (; i < m; ++i)
+        for (int j = 0; j < n; j += 4 * V::width)
+            tile_nn_avx512<V, 1>(A + i, B, C + i, j, n, k);
+}
+
+template <typename V>
+NNDEP_AVX512
+static void add_avx512(typename V::real * y, const typename V::real * x, int n)
+{
+    for (int i = 0; i < n; i += V::width)
+    {
+        typename V::mask mk = V::tail(n - i);
+        V::store(y + i, V::add(V::load(y + i, mk), V::load(x + i, mk)), mk);
+    }
+}
+
+template <typename V>
+NNDEP_AVX512
+static void cube_avx512(typename V::real * h, const typename V::real * b, int n)
+{
+    for (int i = 0; i < n; i += V::width)
+    {
+        typename V::mask mk = V::tail(n - i);
+        typename V::reg v = V::add(V::load(h + i, mk), V::load(b + i, mk));
+        V::store(h + i, V::mul(V::mul(v, v), v), mk);
+    }
+}
+
+template <typename V>
+NNDEP_AVX512
+static void axpy_i8_avx512(
+        typename V::real * y,
+        typename V::real a,
+        const int8_t * x,
+        int n)
+{
+    typename V::reg va = V::set1(a);
+    typename V::mask all = V::tail(V::width);
+    int i = 0;
+    // no masked int8 loads in AVX-512F: full registers, scalar tail
+    for (; i + V::width <= n; i += V::width)
+        V::store(y + i, V::fmadd(va, V::load_i8(x + i), V::load(y + i, all)), all);
+    for (; i < n; ++i)
+        y[i] += a * x[i];
+}
+
+#endif // NNDEP_X86
+
+/**
+ * Runtime dispatch
+ */
+template <typename Real>
+struct KernelTable
+{
+    const char * name;
+    void (*gemm)(const Real * const *, const Real *, int,
+                 Real * const *, int, int, int);
+    void (*gemm_nn)(const Real * const *, const Real * const *,
+                 Real * const *, int, int, int);
+    Real (*dot)(const Real *, const Real *, int);
+    void (*add)(Real *, const Real *, int);
+    void (*cube)(Real *, const Real *, int);
+    void (*axpy_i8)(Real *, Real, const int8_t *, int);
+};
+
+/**
+ * @V512 / @V256: register traits of AVX-512 / AVX2 for @Real
+ */
+template <typename Real, typename V512, typename V256>
+static KernelTable<Real> select_kernels()
+{
+#ifdef NNDEP_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+    {
+        KernelTable<Real> t = {"avx512",
+            gemm_avx512<V512>, gemm_nn_avx512<V512>, dot_avx512<V512>,
+            add_avx512<V512>, cube_avx512<V512>,
+            axpy_i8_avx512<V512>};
+        return t;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    {
+        KernelTable<Real> t = {"avx2",
+            gemm_avx2<V256>, gemm_nn_avx2<V256>, dot_avx2<V256>,
+            add_avx2<V256>, cube_avx2<V256>,
+            axpy_i8_avx2<V256>};
+        return t;
+    }
+#endif
+    KernelTable<Real> t = {"scalar",
+        gemm_scalar<Real>, gemm_nn_scalar<Real>, dot_scalar<Real>,
+        add_scalar<Real>, cube_scalar<Real>,
+        axpy_i8_scalar<Real>};
+    return t;
+}
+
+#ifdef NNDEP_X86
+typedef Avx512Double D512;
+typedef Avx2Double   D256;
+typedef Avx512Float  F512;
+typedef Avx2Float    F256;
+#else
+typedef void D512;
+typedef void D256;
+typedef void F512;
+typedef void F256;
+#endif
+
+template <typename Real>
+static const KernelTable<Real> & kernels();
+
+template <>
+const KernelTable<double> & kernels<double>()
+{
+    static const KernelTable<double> table = select_kernels<double, D512, D256>();
+    return table;
+}
+
+template <>
+const KernelTable<float> & kernels<float>()
+{
+    static const KernelTable<float> table = select_kernels<float, F512, F256>();
+    return table;
+}
+
+template <typename Real>
+static inline void gemm_impl(
+        const Real * const * A,
+        const Real * B,
+        int ldb,
+        Real * const * C,
+        int m,
+        int n,
+        int k)
+{
+    if (m > 0 && n > 0)
+        kernels<Real>().gemm(A, B, ldb, C, m, n, k);
+}
+
+void Kernels::gemm(
+        const double * const * A,
+        const double * B,
+        int ldb,
+        double * const * C,
+        int m,
+        int n,
+        int k)
+{
+    gemm_impl(A, B, ldb, C, m, n, k);
+}
+
+void Kernels::gemm(
+        const float * const * A,
+        const float * B,
+        int ldb,
+        float * const * C,
+        int m,
+        int n,
+        int k)
+{
+    gemm_impl(A, B, ldb, C, m, n, k);
+}
+
+template <typename Real>
+static inline void gemm_nn_impl(
+        const Real * const * A,
+        const Real * const * B,
+        Real * const * C,
+        int m,
+        int n,
+        int k)
+{
+    if (m > 0 && n > 0)
+        kernels<Real>().gemm_nn(A, B, C, m, n, k);
+}
+
+void Kernels::gemm_nn(
+        const double * const * A,
+        const double * const * B,
+        double * const * C,
+        int m,
+        int n,
+        int k)
+{
+    gemm_nn_impl(A, B, C, m, n, k);
+}
+
+void Kernels::gemm_nn(
+        const float * const * A,
+        const float * const * B,
+        float * const * C,
+        int m,
+        int n,
+        int k)
+{
+    gemm_nn_impl(A, B, C, m, n, k);
+}
+
+void Kernels::gemv(
+        const double * A,
+        int lda,
+        int m,
+        int n,
+        const double * x,
+        double * y)
+{
+    // y^T += x^T * A^T, a gemm with a single row
+    gemm_impl(&x, A, lda, &y, 1, m, n);
+}
+
+void Kernels::gemv(
+        const float * A,
+        int lda,
+        int m,
+        int n,
+        const float * x,
+        float * y)
+{
+    gemm_impl(&x, A, lda, &y, 1, m, n);
+}
+
+double Kernels::dot(const double * x, const double * y, int n)
+{
+    return kernels<double>().dot(x, y, n);
+}
+
+float Kernels::dot(const float * x, const float * y, int n)
+{
+    return kernels<float>().dot(x, y, n);
+}
+
+void Kernels::add(double * y, const double * x, int n)
+{
+    kernels<double>().add(y, x, n);
+}
+
+void Kernels::add(float * y, const float * x, int n)
+{
+    kernels<float>().add(y, x, n);
+}
+
+void Kernels::cube(double * h, const double * b, int n)
+{
+    kernels<double>().cube(h, b, n);
+}
+
+void Kernels::cube(float * h, const float * b, int n)
+{
+    kernels<float>().cube(h, b, n);
+}
+
+void Kernels::axpy_i8(double * y, double a, const int8_t * x, int n)
+{
+    kernels<double>().axpy_i8(y, a, x, n);
+}
+
+void Kernels::axpy_i8(float * y, float a, const int8_t * x, int n)
+{
+    kernels<float>().axpy_i8(y, a, x, n);
+}
+
+typedef void (*GemvI8)(const int8_t *, int, int, int, const int8_t *, int32_t *);
+
+static GemvI8 select_gemv_i8()
+{
+#ifdef NNDEP_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return gemv_i8_avx2;
+#endif
+    return gemv_i8_scalar;
+}
+
+void Kernels::gemv_i8(
+        const int8_t * A,
+        int lda,
+        int m,
+        int n,
+        const int8_t * x,
+        int32_t * y)
+{
+    static const GemvI8 impl = select_gemv_i8();
+    impl(A, lda, m, n, x, y);
+}
+
+typedef void (*BernoulliMask)(uint32_t, uint32_t, uint64_t *, int);
+
+static BernoulliMask select_bernoulli_mask()
+{
+#ifdef NNDEP_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return bernoulli_mask_avx512;
+    if (__builtin_cpu_supports("avx2"))
+        return bernoulli_mask_avx2;
+#endif
+    return bernoulli_mask_scalar;
+}
+
+void Kernels::bernoulli_mask(
+        uint32_t key,
+        uint32_t threshold,
+        uint64_t * bits,
+        int n)
+{
+    static const BernoulliMask impl = select_bernoulli_mask();
+    impl(key, threshold, bits, n);
+}
+
+const char * Kernels::isa()
+{
+    return kernels<double>().name;
+}
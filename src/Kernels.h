@@ -0,0 +1,136 @@
+#ifndef __NNDEP_KERNELS_H__
+#define __NNDEP_KERNELS_H__
+
+#include <stdint.h>
+
+/**
+ * Dense kernels for the feed-forward pass of the classifier.
+ *
+ * The implementation (AVX-512, AVX2+FMA or plain scalar code) is
+ * selected once at runtime according to the CPU, so the binary does
+ * not need to be built with -mavx2 / -mavx512f.
+ *
+ * The vectorized dot products sum in a different order than the
+ * scalar loops, hence results agree with the scalar path up to
+ * rounding (relative error ~1e-15). add() and cube() are exact.
+ * Within one implementation, dot(), gemv() and gemm() produce
+ * bit-identical values for the same pair of rows.
+ *
+ * Every kernel exists for double and float (twice the lanes).
+ */
+class Kernels
+{
+    private:
+        Kernels() {} // static methods
+
+    public:
+        /**
+         * C[i][j] += A[i][0..k) * B[j][0..k), i in [0, m), j in [0, n)
+         *  - rows of A and C are given as pointers, so scattered
+         *    rows (e.g. embedding rows of a batch) need no gathering
+         *  - consecutive rows of B are @ldb elements apart
+         */
+        static void gemm(
+                const double * const * A,
+                const double * B,
+                int ldb,
+                double * const * C,
+                int m,
+                int n,
+                int k);
+        static void gemm(
+                const float * const * A,
+                const float * B,
+                int ldb,
+                float * const * C,
+                int m,
+                int n,
+                int k);
+
+        /**
+         * C[i][0..n) += sum_p A[i][p] * B[p][0..n), i in [0, m), p in [0, k)
+         *  - rows of A, B and C are given as pointers
+         *  - vectorized along the rows of B and C, with no horizontal
+         *    sums: suited to a short k (embedding size, number of
+         *    labels) against a long n (hidden size)
+         *  - rows of B whose coefficients in A are zero are skipped
+         */
+        static void gemm_nn(
+                const double * const * A,
+                const double * const * B,
+                double * const * C,
+                int m,
+                int n,
+                int k);
+        static void gemm_nn(
+                const float * const * A,
+                const float * const * B,
+                float * const * C,
+                int m,
+                int n,
+                int k);
+
+        /**
+         * y[i] += A[i][0..n) * x, for i in [0, m)
+         *  - consecutive rows of A are @lda elements apart,
+         *    so that A can be a column slice of a larger matrix
+         */
+        static void gemv(
+                const double * A,
+                int lda,
+                int m,
+                int n,
+                const double * x,
+                double * y);
+        static void gemv(
+                const float * A,
+                int lda,
+                int m,
+                int n,
+                const float * x,
+                float * y);
+
+        static double dot(const double * x, const double * y, int n);
+        static float dot(const float * x, const float * y, int n);
+
+        // y += x
+        static void add(double * y, const double * x, int n);
+        static void add(float * y, const float * x, int n);
+
+        // h = (h + b)^3, the cube activation
+        static void cube(double * h, const double * b, int n);
+        static void cube(float * h, const float * b, int n);
+
+        // y += a * x, for int8 x (dequantize and accumulate)
+        static void axpy_i8(double * y, double a, const int8_t * x, int n);
+        static void axpy_i8(float * y, float a, const int8_t * x, int n);
+
+        /**
+         * y[i] = A[i][0..n) * x, for i in [0, m), on int8 data
+         *  with exact int32 accumulation (quantized inference)
+         */
+        static void gemv_i8(
+                const int8_t * A,
+                int lda,
+                int m,
+                int n,
+                const int8_t * x,
+                int32_t * y);
+
+        /**
+         * bit i of @bits (i in [0, n)) is set iff
+         *  Random::at(key, i) >= threshold, i.e. with probability
+         *  1 - p for threshold = Random::threshold(p). Unused bits
+         *  of the last word are cleared; the same bits on any ISA.
+         */
+        static void bernoulli_mask(
+                uint32_t key,
+                uint32_t threshold,
+                uint64_t * bits,
+                int n);
+
+        // name of the selected implementation: avx512/avx2/scalar
+        static const char * isa();
+};
+
+#endif
@@ -32,14 +32,14 @@ ListSystem::~ListSystem()
 void ListSystem::make_transitions()
 {
     for (size_t i = 0; i < labels.size() - 1; ++i)
-        transitions.push_back("LP(" + labels[i] + ")"); // left pop
+        add_transition("LP(" + labels[i] + ")", LEFT_POP, i); // left pop
     for (size_t i = 0; i < labels.size(); ++i)
-        transitions.push_back("RA(" + labels[i] + ")"); // right arc
+        add_transition("RA(" + labels[i] + ")", RIGHT_ARC, i); // right arc
     for (size_t i = 0; i < labels.size() - 1; ++i)
-        transitions.push_back("LA(" + labels[i] + ")"); // left arc
+        add_transition("LA(" + labels[i] + ")", LEFT_ARC, i); // left arc
 
-    transitions.push_back("NS"); // no shift
-    transitions.push_back("NP"); // no pass
+    no_shift = add_transition("NS", NO_SHIFT); // no shift
+    add_transition("NP", NO_PASS); // no pass
 
     cerr << "Transition types:" << endl;
     for (size_t i = 0; i < transitions.size(); ++i)
@@ -48,30 +48,52 @@ void ListSystem::make_transitions()
 }   
 
 bool ListSystem::can_apply(Configuration& c, const string& t)
+{
+    int id = find_transition(t);
+    if (id < 0)
+        return false;
+    vector<char> mask;
+    legal_mask(c, mask);
+    return mask[id];
+}
+
+void ListSystem::legal_mask(Configuration& c, vector<char>& mask)
 {
     int n_stack = c.get_stack_size();
     int n_buffer = c.get_buffer_size();
     int w = c.get_stack(0);
     int b = c.get_buffer(0);
-    std::vector<int> head_w = c.get_head(w);
-    std::vector<int> head_b = c.get_head(b);
-    int w_head = head_w.size();
-    int b_head = head_b.size();
-    root_label = labels[labels.size() - 1];
+    int root = labels.size() - 1; // label id of root_label
+
+    bool left = (w > 0 && b > 0 && !c.has_path_to(w, b) && !c.is_root(w));
+    // RA with the root label (from w = 0), and with any other label
+    bool right_root = false;
+    bool right = false;
+    if (w == 0)
+        right_root = (!c.graph.is_single_root() && c.get_head(b).size() == 0);
+    else
+        right = (b > 0 && w > 0 && !c.has_path_to(b, w));
 
-    if (startswith(t, "LA") || startswith(t, "LP"))
-        return (w > 0 && b > 0 && !c.has_path_to(w, b) && !c.is_root(w));
-    else if (startswith(t, "RA")){
-        string l = t.substr(3, t.length() - 4);
-        if (w == 0)
-            return (l == root_label && !c.graph.is_single_root() && b_head == 0);
-        else
-            return (l != root_label && b > 0 && w >0 && !c.has_path_to(b, w));
+    mask.resize(transitions.size());
+    for (size_t i = 0; i < transitions.size(); ++i)
+    {
+        switch (trans_actions[i])
+        {
+            case LEFT_POP:
+            case LEFT_ARC:
+                mask[i] = left;
+                break;
+            case RIGHT_ARC:
+                mask[i] = (trans_labels[i] == root) ? right_root : right;
+                break;
+            case NO_SHIFT:
+                mask[i] = (n_buffer > 0);
+                break;
+            case NO_PASS: // can not pass root(0)
+                mask[i] = (n_stack > 1 && n_buffer > 0);
+                break;
+        }
     }
-    else if (t == "NS")
-        return (n_buffer > 0);
-    else if (t == "NP") // can not pass root(0)
-        return (n_stack > 1 && n_buffer > 0);
 }
 
 void ListSystem::apply(Configuration& c, const string& t)
@@ -115,6 +137,48 @@ void ListSystem::apply(Configuration& c, const string& t)
     }
 }
 
+void ListSystem::apply(Configuration& c, int t)
+{
+    if (t < 0)
+        return;
+
+    int b = c.get_buffer(0);
+    int w = c.get_stack(0);
+
+    switch (trans_actions[t])
+    {
+        // Left Pop
+        case LEFT_POP:
+            c.add_arc(b, w, arc_labels[trans_labels[t]]);
+            c.reduce();
+            c.lvalency[b] += 1;
+            c.rhvalency[w] += 1;
+            break;
+        // Left Arc
+        case LEFT_ARC:
+            c.add_arc(b, w, arc_labels[trans_labels[t]]);
+            c.pass();
+            c.lvalency[b] += 1;
+            c.rhvalency[w] += 1;
+            break;
+        // Right Arc
+        case RIGHT_ARC:
+            c.add_arc(w, b, arc_labels[trans_labels[t]]);
+            c.pass();
+            c.rvalency[w] += 1;
+            c.lhvalency[b] += 1;
+            break;
+        // No Shift
+        case NO_SHIFT:
+            c.shift();
+            break;
+        // No Pass
+        case NO_PASS:
+            c.pass();
+            break;
+    }
+}
+
 const string ListSystem::get_oracle(
         Configuration& c,
         DependencyGraph& graph)
@@ -8,6 +8,9 @@
 class ListSystem : public ParsingSystem
 {
     public:
+        // actions of the compiled transitions (trans_actions)
+        enum { LEFT_POP, RIGHT_ARC, LEFT_ARC, NO_SHIFT, NO_PASS };
+
         ListSystem() { lang = "english"; }
         explicit ListSystem(std::vector<std::string>& ldict,
                               std::string& language,
@@ -20,6 +23,10 @@ class ListSystem : public ParsingSystem
 
         void apply(Configuration& c, const std::string& t);
 
+        void legal_mask(Configuration& c, std::vector<char>& mask);
+
+        void apply(Configuration& c, int t);
+
         const std::string get_oracle(
                 Configuration& c,
                 DependencyGraph& graph);
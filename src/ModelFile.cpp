@@ -0,0 +1,368 @@
+#include "ModelFile.h"
+#include "Random.h"
+
+#include <iostream>
+#include <cstring>
+#include <cstdio>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+const char ModelFile::MAGIC[8] = {'N', 'N', 'D', 'E', 'P', 'B', 'I', 'N'};
+
+bool ModelFile::is_binary(const char * filename)
+{
+    char magic[sizeof(MAGIC)];
+    ifstream input(filename, ios::binary);
+    return input.read(magic, sizeof(magic))
+        && memcmp(magic, MAGIC, sizeof(MAGIC)) == 0;
+}
+
+bool ModelFile::open(const char * filename)
+{
+    close();
+
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        cerr << "ERROR: cannot open model file " << filename << endl;
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Header))
+    {
+        cerr << "ERROR: " << filename << " is too short" << endl;
+        ::close(fd);
+        return false;
+    }
+
+    void * p = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED)
+    {
+        cerr << "ERROR: cannot map " << filename << endl;
+        return false;
+    }
+    data = (char *)p;
+    size = st.st_size;
+
+    Header header;
+    memcpy(&header, data, sizeof(header));
+    const char * error = NULL;
+    if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0)
+        error = "not a binary model file";
+    else if (header.endian_mark != ENDIAN_MARK)
+        error = "written on a machine of another byte order";
+    else if (header.version > VERSION)
+        error = "written by a newer version";
+    else if (header.file_size != size)
+        error = "truncated";
+    else if (header.table_offset > size
+            || (size - header.table_offset) / sizeof(Section) < header.n_sections)
+        error = "corrupted section table";
+
+    if (error == NULL)
+    {
+        sections.resize(header.n_sections);
+        if (header.n_sections > 0)
+            memcpy(&sections[0], data + header.table_offset,
+                    header.n_sections * sizeof(Section));
+        for (size_t i = 0; i < sections.size(); ++i)
+            if (sections[i].offset > size
+                    || sections[i].bytes > size - sections[i].offset)
+                error = "section out of the file";
+    }
+
+    if (error != NULL)
+    {
+        cerr << "ERROR: " << filename << ": " << error << endl;
+        close();
+        return false;
+    }
+    return true;
+}
+
+void ModelFile::close()
+{
+    if (data != NULL)
+        munmap(data, size);
+    data = NULL;
+    size = 0;
+    sections.clear();
+}
+
+void ModelFile::swap(ModelFile & other)
+{
+    std::swap(data, other.data);
+    std::swap(size, other.size);
+    sections.swap(other.sections);
+}
+
+const ModelFile::Section * ModelFile::find(uint32_t id) const
+{
+    for (size_t i = 0; i < sections.size(); ++i)
+        if (sections[i].id == id)
+            return &sections[i];
+    return NULL;
+}
+
+bool ModelFile::get_strings(uint32_t id, vector<string> & strings) const
+{
+    const Section * s = find(id);
+    if (s == NULL || s->elem_size != 0
+            || s->bytes < (s->rows + 1ULL) * sizeof(uint32_t))
+        return false;
+
+    const uint32_t * offsets = (const uint32_t *)at(s);
+    const char * chars = (const char *)(offsets + s->rows + 1);
+    uint64_t n_chars = s->bytes - (s->rows + 1ULL) * sizeof(uint32_t);
+    if (offsets[s->rows] > n_chars)
+        return false;
+
+    strings.resize(s->rows);
+    for (uint32_t i = 0; i < s->rows; ++i)
+    {
+        if (offsets[i] > offsets[i + 1])
+            return false;
+        strings[i].assign(chars + offsets[i], offsets[i + 1] - offsets[i]);
+    }
+    return true;
+}
+
+bool ModelFile::get_ints(uint32_t id, vector<int> & ints) const
+{
+    const Section * s = find(id);
+    if (s == NULL || s->elem_size != sizeof(int32_t)
+            || s->bytes != (uint64_t)s->rows * sizeof(int32_t))
+        return false;
+
+    const int32_t * p = (const int32_t *)at(s);
+    ints.assign(p, p + s->rows);
+    return true;
+}
+
+bool ModelFile::get_uint64(uint32_t id, uint64_t & value) const
+{
+    const Section * s = find(id);
+    if (s == NULL || s->elem_size != sizeof(uint64_t)
+            || s->rows != 0 || s->bytes != sizeof(uint64_t))
+        return false;
+
+    memcpy(&value, at(s), sizeof(value));
+    return true;
+}
+
+uint64_t ModelFile::checksum(uint64_t h, const void * p, uint64_t bytes)
+{
+    const char * c = (const char *)p;
+    uint64_t w;
+    for (; bytes >= sizeof(w); bytes -= sizeof(w), c += sizeof(w))
+    {
+        memcpy(&w, c, sizeof(w));
+        h = Random::mix64(h ^ w);
+    }
+    if (bytes > 0)
+    {
+        w = 0;
+        memcpy(&w, c, bytes);
+        h = Random::mix64(h ^ w ^ (bytes << 56));
+    }
+    return h;
+}
+
+template <typename T>
+bool ModelFile::get_reals(
+        uint32_t id,
+        T * & p,
+        int & rows,
+        int & cols,
+        vector<T> & buf)
+{
+    const Section * s = find(id);
+    if (s == NULL)
+        return false;
+    uint64_t n = (uint64_t)s->rows * s->cols;
+    if ((s->elem_size != sizeof(float) && s->elem_size != sizeof(double))
+            || s->bytes != n * s->elem_size)
+        return false;
+
+    rows = s->rows;
+    cols = s->cols;
+    if (s->elem_size == sizeof(T))
+    {
+        p = (T *)(data + s->offset);
+        return true;
+    }
+
+    // written by a build of the other real type
+    buf.resize(n);
+    if (s->elem_size == sizeof(float))
+    {
+        const float * q = (const float *)at(s);
+        for (uint64_t i = 0; i < n; ++i)
+            buf[i] = q[i];
+    }
+    else
+    {
+        const double * q = (const double *)at(s);
+        for (uint64_t i = 0; i < n; ++i)
+            buf[i] = q[i];
+    }
+    p = n > 0 ? &buf[0] : NULL;
+    return true;
+}
+
+template <typename T>
+bool ModelFile::get_matrix(uint32_t id, Mat<T> & m)
+{
+    T * p;
+    int rows, cols;
+    vector<T> buf;
+    if (!get_reals(id, p, rows, cols, buf))
+        return false;
+
+    m.dealloc();
+    if (buf.empty())
+        m.borrow(p, rows, cols);
+    else
+        m = Mat<T>(p, rows, cols);
+    return true;
+}
+
+template <typename T>
+bool ModelFile::get_vector(uint32_t id, Vec<T> & v)
+{
+    T * p;
+    int rows, cols;
+    vector<T> buf;
+    if (!get_reals(id, p, rows, cols, buf) || cols != 1)
+        return false;
+
+    v.dealloc();
+    if (buf.empty())
+        v.borrow(p, rows);
+    else
+        v = buf;
+    return true;
+}
+
+template bool ModelFile::get_matrix(uint32_t id, Mat<float> & m);
+template bool ModelFile::get_matrix(uint32_t id, Mat<double> & m);
+template bool ModelFile::get_vector(uint32_t id, Vec<float> & v);
+template bool ModelFile::get_vector(uint32_t id, Vec<double> & v);
+
+bool ModelFileWriter::open(const char * filename)
+{
+    sections.clear();
+    target = filename;
+    tmp_name = target + ".tmp";
+    output.open(tmp_name.c_str(), ios::binary | ios::trunc);
+
+    // the header is written by finish()
+    ModelFile::Header header;
+    memset(&header, 0, sizeof(header));
+    output.write((const char *)&header, sizeof(header));
+    return output.good();
+}
+
+// pad the output to the next multiple of ModelFile::ALIGN
+static void align_output(ofstream & output)
+{
+    static const char zeros[ModelFile::ALIGN] = {0};
+    uint64_t pos = output.tellp();
+    output.write(zeros, (ModelFile::ALIGN - pos % ModelFile::ALIGN) % ModelFile::ALIGN);
+}
+
+void ModelFileWriter::add_block(
+        uint32_t id,
+        uint32_t elem_size,
+        uint32_t rows,
+        uint32_t cols,
+        const void * p,
+        uint64_t bytes)
+{
+    align_output(output);
+
+    ModelFile::Section s;
+    s.id = id;
+    s.elem_size = elem_size;
+    s.rows = rows;
+    s.cols = cols;
+    s.offset = output.tellp();
+    s.bytes = bytes;
+    sections.push_back(s);
+
+    if (bytes > 0)
+        output.write((const char *)p, bytes);
+}
+
+void ModelFileWriter::add_strings(uint32_t id, const vector<string> & strings)
+{
+    vector<uint32_t> offsets(1, 0);
+    string chars;
+    for (size_t i = 0; i < strings.size(); ++i)
+    {
+        chars += strings[i];
+        offsets.push_back(chars.size());
+    }
+
+    align_output(output);
+
+    ModelFile::Section s;
+    s.id = id;
+    s.elem_size = 0;
+    s.rows = strings.size();
+    s.cols = 1;
+    s.offset = output.tellp();
+    s.bytes = offsets.size() * sizeof(uint32_t) + chars.size();
+    sections.push_back(s);
+
+    output.write((const char *)&offsets[0], offsets.size() * sizeof(uint32_t));
+    output.write(chars.data(), chars.size());
+}
+
+void ModelFileWriter::add_ints(uint32_t id, const vector<int> & ints)
+{
+    vector<int32_t> buf(ints.begin(), ints.end());
+    add_block(id, sizeof(int32_t), buf.size(), 1,
+            buf.empty() ? NULL : &buf[0], buf.size() * sizeof(int32_t));
+}
+
+void ModelFileWriter::add_uint64(uint32_t id, uint64_t value)
+{
+    add_block(id, sizeof(value), 0, 0, &value, sizeof(value));
+}
+
+bool ModelFileWriter::finish()
+{
+    align_output(output);
+
+    ModelFile::Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ModelFile::MAGIC, sizeof(header.magic));
+    header.version = ModelFile::VERSION;
+    header.endian_mark = ModelFile::ENDIAN_MARK;
+    header.n_sections = sections.size();
+    header.table_offset = output.tellp();
+    if (!sections.empty())
+        output.write((const char *)&sections[0],
+                sections.size() * sizeof(ModelFile::Section));
+    header.file_size = output.tellp();
+
+    output.seekp(0);
+    output.write((const char *)&header, sizeof(header));
+    output.close();
+
+    // the old file stays intact for any process mapping it
+    if (output.fail() || rename(tmp_name.c_str(), target.c_str()) != 0)
+    {
+        remove(tmp_name.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,206 @@
+#ifndef __NNDEP_MODEL_FILE_H__
+#define __NNDEP_MODEL_FILE_H__
+
+#include <stdint.h>
+#include <cstddef>
+#include <vector>
+#include <string>
+#include <fstream>
+
+#include "math/mat.h"
+
+/**
+ * Binary model file, the counterpart of the text format of
+ *  DependencyParser::save_model.
+ *
+ * Layout (host byte order, checked through Header::endian_mark):
+ *  - Header
+ *  - the data of every section, at an offset aligned on ALIGN bytes
+ *  - Header::n_sections entries of Section, at Header::table_offset
+ *
+ * A section is identified by its id (SectionId): readers skip ids
+ *  they do not know, so that sections can be added without breaking
+ *  older files. A section is one of
+ *  - a string table: uint32 offsets[rows + 1] into the characters
+ *    that follow them, the strings are not 0-terminated
+ *  - an int32 array of rows elements
+ *  - a uint64 value (elem_size 8, rows and cols 0)
+ *  - a row-major rows x cols block of reals of elem_size bytes
+ *
+ * ModelFile maps the file privately (copy-on-write), so the weight
+ *  blocks are used in place through Mat::borrow / Vec::borrow: pages
+ *  stay shared with the page cache, and only the pages someone
+ *  writes to (e.g. when finetuning) are copied.
+ */
+class ModelFile
+{
+    public:
+        static const char MAGIC[8];
+        static const uint32_t VERSION = 1;
+        static const uint32_t ENDIAN_MARK = 0x01020304;
+        static const int ALIGN = 64;
+
+        enum SectionId
+        {
+            // string tables
+            WORDS = 1,
+            POSS,
+            LABELS,
+            VALENCIES,
+            CLUSTERS,
+            // int arrays
+            DISTANCES,
+            LENGTHS,
+            PRE_COMPUTED,
+            /**
+             * num_basic_tokens, num_dist_tokens, num_valency_tokens,
+             *  num_cluster_tokens, num_length_tokens
+             */
+            TOKENS,
+            // weights
+            EB,
+            ED,
+            EV,
+            EC,
+            EL,
+            W1,
+            B1,
+            W2,
+            /**
+             * optional pre-computed table (NNClassifier::saved):
+             *  the feature ID of every row, the rows, and the
+             *  checksum of the ids and of the weights it was
+             *  computed from (see pre_computed_checksum)
+             */
+            SAVED_IDS,
+            SAVED,
+            SAVED_CHECKSUM
+        };
+
+        struct Header
+        {
+            char magic[8];
+            uint32_t version;
+            uint32_t endian_mark;
+            uint32_t n_sections;
+            uint32_t reserved;
+            uint64_t table_offset;
+            uint64_t file_size;
+        };
+
+        struct Section
+        {
+            uint32_t id;
+            uint32_t elem_size; // bytes per element, 0 for a string table
+            uint32_t rows;
+            uint32_t cols;
+            uint64_t offset;    // from the start of the file
+            uint64_t bytes;
+        };
+
+    public:
+        ModelFile() : data(NULL), size(0) {}
+        ~ModelFile() { close(); }
+
+        // whether @filename starts with MAGIC
+        static bool is_binary(const char * filename);
+
+        /**
+         * map @filename and check its header and section table,
+         *  false (with a message on cerr) if it is not a valid file
+         */
+        bool open(const char * filename);
+        void close();
+        bool is_open() const { return data != NULL; }
+
+        void swap(ModelFile & other);
+
+        // section @id, NULL if absent
+        const Section * find(uint32_t id) const;
+        const char * at(const Section * s) const { return data + s->offset; }
+
+        // the contents of section @id (false if absent or of another kind)
+        bool get_strings(uint32_t id, std::vector<std::string> & strings) const;
+        bool get_ints(uint32_t id, std::vector<int> & ints) const;
+        bool get_uint64(uint32_t id, uint64_t & value) const;
+
+        /**
+         * fold @bytes bytes at @p into the checksum @h, 8 bytes at a
+         *  time (the bytes are hashed as they are: files written by
+         *  builds of another real type do not match)
+         */
+        static uint64_t checksum(uint64_t h, const void * p, uint64_t bytes);
+
+        /**
+         * @m views section @id in place if its elements are of type
+         *  T, otherwise gets a converted copy
+         */
+        template <typename T>
+        bool get_matrix(uint32_t id, Mat<T> & m);
+        template <typename T>
+        bool get_vector(uint32_t id, Vec<T> & v);
+
+    private:
+        // not copyable: the mapping is owned
+        ModelFile(const ModelFile &);
+        ModelFile & operator=(const ModelFile &);
+
+        template <typename T>
+        bool get_reals(uint32_t id, T * & p, int & rows, int & cols, std::vector<T> & buf);
+
+        char * data;
+        size_t size;
+        std::vector<Section> sections;
+};
+
+/**
+ * Writes a ModelFile: add the sections, then finish().
+ *  The data are written as they are added, then the section
+ *  table, and the header last. All of it goes to <filename>.tmp,
+ *  renamed over <filename> by finish(): a process that has the
+ *  old file mapped keeps reading the old contents.
+ */
+class ModelFileWriter
+{
+    public:
+        ModelFileWriter() {}
+
+        bool open(const char * filename);
+
+        void add_strings(uint32_t id, const std::vector<std::string> & strings);
+        void add_ints(uint32_t id, const std::vector<int> & ints);
+        void add_uint64(uint32_t id, uint64_t value);
+
+        template <typename T>
+        void add_matrix(uint32_t id, Mat<T> & m)
+        {
+            add_block(id, sizeof(T), m.nrows(), m.ncols(),
+                    m.c_buf(), (uint64_t)m.total_size() * sizeof(T));
+        }
+
+        template <typename T>
+        void add_vector(uint32_t id, Vec<T> & v)
+        {
+            add_block(id, sizeof(T), v.size(), 1,
+                    v.c_buf(), (uint64_t)v.size() * sizeof(T));
+        }
+
+        // write the header and section table, false on I/O error
+        bool finish();
+
+    private:
+        void add_block(
+                uint32_t id,
+                uint32_t elem_size,
+                uint32_t rows,
+                uint32_t cols,
+                const void * p,
+                uint64_t bytes);
+
+        std::string target;   // the file written
+        std::string tmp_name; // written first, then renamed to @target
+        std::ofstream output;
+        std::vector<ModelFile::Section> sections;
+};
+
+#endif
@@ -5,17 +5,57 @@
 
 using namespace std;
 
+ParsingSystem::ParsingSystem()
+    : no_shift(-1)
+{
+}
+
 ParsingSystem::~ParsingSystem()
 {
 }
 
 int ParsingSystem::get_transition_id(const string & s)
 {
+    int t = find_transition(s);
+    if (t < 0)
+        cerr << "unrecognized label: " << s << endl;
+    return t;
+}
+
+int ParsingSystem::find_transition(const string & s) const
+{
+    unordered_map<string, int>::const_iterator it = transition_ids.find(s);
+    return (it == transition_ids.end()) ? -1 : it->second;
+}
+
+int ParsingSystem::add_transition(const string& name, int action, int label)
+{
+    if (arc_labels.size() != labels.size())
+    {
+        arc_labels.clear();
+        for (size_t i = 0; i < labels.size(); ++i)
+            arc_labels.push_back(DependencyGraph::label_id(labels[i]));
+    }
+
+    int t = transitions.size();
+    transitions.push_back(name);
+    trans_actions.push_back(action);
+    trans_labels.push_back(label);
+    trans_dirs.push_back(label < 0 ? 0 : (name[0] == 'L' ? 1 : -1));
+    transition_ids[name] = t;
+    return t;
+}
+
+void ParsingSystem::legal_mask(Configuration& c, vector<char>& mask)
+{
+    mask.resize(transitions.size());
     for (size_t i = 0; i < transitions.size(); ++i)
-        if (transitions[i] == s)
-            return i;
-    cerr << "unrecognized label: " << s << endl;
-    return -1;
+        mask[i] = can_apply(c, transitions[i]);
+}
+
+void ParsingSystem::apply(Configuration& c, int t)
+{
+    apply(c, t < 0 ? string() : transitions[t]);
 }
 
 set<string> ParsingSystem::get_punctuation_tags()
@@ -158,9 +198,9 @@ void ParsingSystem::evaluate(
 
         for (int j = 1; j <= pred_graphs[i].n; ++j)
         {
-            std::vector<int> gold_heads = gold_graphs[i].get_head(j);
-            std::vector<std::string> gold_labels = gold_graphs[i].get_label(j);
-            std::vector<int> pred_heads = pred_graphs[i].get_head(j);
+            DependencyGraph::Span gold_heads = gold_graphs[i].get_head(j);
+            DependencyGraph::Span gold_labels = gold_graphs[i].get_label(j);
+            DependencyGraph::Span pred_heads = pred_graphs[i].get_head(j);
             sum_pred_arcs += pred_heads.size();
             sum_gold_arcs += gold_heads.size();
             for (int m=0; m < (int)gold_heads.size(); m++){
@@ -168,7 +208,7 @@ void ParsingSystem::evaluate(
                 {
                     ++ correct_heads;
                     ++ n_correct_head;
-                    if (pred_graphs[i].get_arc_label(j, gold_heads[m]) == gold_labels[m])
+                    if (pred_graphs[i].get_arc_label_id(j, gold_heads[m]) == gold_labels[m])
                         ++ correct_arcs;
                 }
                 //++ sum_gold_arcs;
@@ -185,7 +225,7 @@ void ParsingSystem::evaluate(
                     {
                         ++ correct_heads_wo_punc;
                         ++ n_correct_head_wo_punc;
-                        if (pred_graphs[i].get_arc_label(j, gold_heads[m]) == gold_labels[m])
+                        if (pred_graphs[i].get_arc_label_id(j, gold_heads[m]) == gold_labels[m])
                             ++ correct_arcs_wo_punc;
                     }
                 //++ sum_arcs;
@@ -200,7 +240,7 @@ void ParsingSystem::evaluate(
                     if (pred_graphs[i].has_head(j, gold_heads[m]))
                     {
                         ++ correct_non_local_heads;
-                        if (pred_graphs[i].get_arc_label(j, gold_heads[m]) == gold_labels[m])
+                        if (pred_graphs[i].get_arc_label_id(j, gold_heads[m]) == gold_labels[m])
                             ++ correct_non_local_arcs;
                     }
                 //++ sum_arcs;
@@ -208,7 +248,7 @@ void ParsingSystem::evaluate(
             }
 
             for (int m=0; m < (int)gold_heads.size(); m++){
-                string gold_rel = gold_labels[m];
+                const string & gold_rel = DependencyGraph::label_name(gold_labels[m]);
                 if (sub_obj_relations.find(gold_rel) != sub_obj_relations.end())
                 {
                     ++ sum_arcs_sub_obj;
@@ -4,6 +4,8 @@
 #include <vector>
 #include <map>
 #include <set>
+#include <string>
+#include <unordered_map>
 
 #include "Configuration.h"
 #include "DependencySent.h"
@@ -14,10 +16,14 @@
 class ParsingSystem
 {
     public:
+        ParsingSystem();
         // ParsingSystem(std::vector<std::string>& ldict);
 
         int get_transition_id(const std::string & s);
 
+        // id of transition @s, -1 if unknown (quiet get_transition_id)
+        int find_transition(const std::string & s) const;
+
         void set_language(const std::string & s);
 
         void evaluate(
@@ -43,6 +49,17 @@ class ParsingSystem
 
         virtual void apply(Configuration& c, const std::string& t) = 0;
 
+        /**
+         * mask[i] = whether transitions[i] can be applied to @c,
+         *  for all transitions at once. The default asks can_apply
+         *  for each transition; systems override it to test the
+         *  configuration once and go through the compiled table.
+         */
+        virtual void legal_mask(Configuration& c, std::vector<char>& mask);
+
+        // apply transitions[t]; t = -1 is the empty transition
+        virtual void apply(Configuration& c, int t);
+
         virtual const std::string get_oracle(
                 Configuration& c,
                 DependencyGraph& graph) = 0;
@@ -68,7 +85,29 @@ class ParsingSystem
         std::vector<std::string> labels;
         std::vector<std::string> transitions;
 
+        /**
+         * Compiled transition table, filled by add_transition:
+         *  transitions[i] is action trans_actions[i] (a code of the
+         *  system) with label trans_labels[i] (index in @labels,
+         *  -1 if unlabeled). trans_dirs[i] is 1 for arcs from the
+         *  buffer front to the stack top (names "L..."), -1 for the
+         *  reverse ("R...") and 0 for transitions without an arc.
+         */
+        std::vector<int> trans_actions;
+        std::vector<int> trans_labels;
+        std::vector<int> trans_dirs;
+        int no_shift; // id of "NS" (set by the system), -1 if none
+        // DependencyGraph label id of labels[i]
+        std::vector<int> arc_labels;
+
         bool labeled;
+
+    protected:
+        // append a transition to @transitions and the table, return its id
+        int add_transition(const std::string& name, int action, int label = -1);
+
+    private:
+        std::unordered_map<std::string, int> transition_ids;
 };
 
 #endif
@@ -0,0 +1,50 @@
+#include "PreComputeIndex.h"
+
+#include <cassert>
+
+using namespace std;
+
+void PreComputeIndex::set_num_tokens(int _num_tokens)
+{
+    if (_num_tokens == num_tokens)
+        return;
+
+    num_tokens = _num_tokens;
+    clear();
+}
+
+void PreComputeIndex::clear()
+{
+    slots.assign(num_tokens, Slot());
+    feature_ids.clear();
+    num_keys = 0;
+}
+
+void PreComputeIndex::insert(int feature_id, int index)
+{
+    assert (num_tokens > 0 && feature_id >= 0 && index >= 0);
+
+    int pos = feature_id % num_tokens;
+    int tok = feature_id / num_tokens;
+    Slot & s = slots[pos];
+
+    if (s.rows.empty())
+        s.base = tok;
+    else if (tok < s.base)
+    {
+        // grow to the left
+        s.rows.insert(s.rows.begin(), s.base - tok, -1);
+        s.base = tok;
+    }
+
+    size_t k = tok - s.base;
+    if (k >= s.rows.size())
+        s.rows.resize(k + 1, -1);
+
+    if (s.rows[k] < 0)
+    {
+        feature_ids.push_back(feature_id);
+        ++num_keys;
+    }
+    s.rows[k] = index;
+}
@@ -0,0 +1,79 @@
+#ifndef __NNDEP_PRE_COMPUTE_INDEX_H__
+#define __NNDEP_PRE_COMPUTE_INDEX_H__
+
+#include <vector>
+
+/**
+ * Maps a feature ID (tok * num_tokens + pos) to its row in the
+ *  pre-computed hidden layer table, replacing an unordered_map.
+ *
+ * Each token position owns a flat array of row indices covering
+ *  the range of token IDs inserted at that position, so a lookup
+ *  is one bounds check and one load, with no hashing.
+ *
+ * The ranges are small in practice: a position only ever sees IDs
+ *  of its own feature type (words, POS tags, labels, ...) and the
+ *  pre-computed IDs are the most frequent ones.
+ */
+class PreComputeIndex
+{
+    public:
+        PreComputeIndex() : num_tokens(0), num_keys(0) {}
+
+        /**
+         * must be called before insert(...); drops all entries
+         *  if the number of token positions changes
+         */
+        void set_num_tokens(int _num_tokens);
+
+        /**
+         * map @feature_id to @index, overwriting an existing entry
+         */
+        void insert(int feature_id, int index);
+
+        /**
+         * row index of token @tok at position @pos, -1 if absent
+         */
+        inline int find(int pos, int tok) const
+        {
+            const Slot & s = slots[pos];
+            unsigned int k = (unsigned int)(tok - s.base);
+            return k < s.rows.size() ? s.rows[k] : -1;
+        }
+
+        inline int find(int feature_id) const
+        {
+            return find(feature_id % num_tokens, feature_id / num_tokens);
+        }
+
+        inline bool contains(int feature_id) const
+        {
+            return find(feature_id) >= 0;
+        }
+
+        void clear();
+
+        // number of distinct feature IDs
+        int size() const { return num_keys; }
+
+        /**
+         * all feature IDs, in insertion order
+         */
+        const std::vector<int> & keys() const { return feature_ids; }
+
+    private:
+        struct Slot
+        {
+            int base; // smallest token ID covered
+            std::vector<int> rows;
+
+            Slot() : base(0) {}
+        };
+
+        int num_tokens;
+        int num_keys;
+        std::vector<Slot> slots; // per token position
+        std::vector<int> feature_ids;
+};
+
+#endif
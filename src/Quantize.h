@@ -0,0 +1,65 @@
+#ifndef __NNDEP_QUANTIZE_H__
+#define __NNDEP_QUANTIZE_H__
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <stdint.h>
+
+#include "math/mat.h"
+
+/**
+ * Symmetric int8 quantization with one scale per row:
+ *  m[i][j] ~= scale[i] * q[i][j], q in [-127, 127]
+ */
+class QuantMat
+{
+    public:
+        Mat<int8_t> q;
+        std::vector<float> scale;
+
+    public:
+        template <typename Real>
+        void quantize(Mat<Real> & m)
+        {
+            q.resize(m.nrows(), m.ncols());
+            scale.assign(m.nrows(), 0.0f);
+            for (int i = 0; i < m.nrows(); ++i)
+            {
+                double max_abs = 0.0;
+                for (int j = 0; j < m.ncols(); ++j)
+                    max_abs = std::max(max_abs, std::fabs((double)m[i][j]));
+
+                scale[i] = max_abs / 127.0;
+                double inv = (max_abs > 0) ? 127.0 / max_abs : 0.0;
+                for (int j = 0; j < m.ncols(); ++j)
+                    q[i][j] = (int8_t)lround(m[i][j] * inv);
+            }
+        }
+
+        void clear()
+        {
+            q.dealloc();
+            scale.clear();
+        }
+
+        // memory footprint in bytes
+        size_t bytes() const
+        {
+            return (size_t)q.total_size() * sizeof(int8_t)
+                    + scale.size() * sizeof(float);
+        }
+};
+
+/**
+ * quantize one value with a given scale, clipping to [-127, 127]
+ */
+inline int8_t quantize_value(double x, double inv_scale)
+{
+    long v = lround(x * inv_scale);
+    if (v > 127) v = 127;
+    if (v < -127) v = -127;
+    return (int8_t)v;
+}
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef __NNDEP_RANDOM_H__
+#define __NNDEP_RANDOM_H__
+
+#include <stdint.h>
+#include <chrono>
+
+/**
+ * Counter-based random numbers.
+ *
+ * The n-th number of a stream is a hash of (stream key, n), so it
+ *  involves no shared state: any thread draws any stream without
+ *  locking, and a stream keyed by e.g. (seed, round, sample) gives
+ *  the same numbers whichever thread draws it and however many
+ *  threads there are.
+ */
+class Random
+{
+    private:
+        Random() {} // static methods
+
+    public:
+        // finalizer of SplitMix64
+        static inline uint64_t mix64(uint64_t z)
+        {
+            z += 0x9E3779B97F4A7C15ULL;
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            return z ^ (z >> 31);
+        }
+
+        // key of the stream (@seed, @a, @b)
+        static inline uint32_t stream_key(uint64_t seed, uint64_t a, uint64_t b)
+        {
+            uint64_t z = mix64(mix64(mix64(seed) ^ a) ^ b);
+            return (uint32_t)(z ^ (z >> 32));
+        }
+
+        /**
+         * n-th number of the stream @key, uniform on 32 bits.
+         *  Only 32-bit multiplies, so that it vectorizes
+         *  (see Kernels::bernoulli_mask)
+         */
+        static inline uint32_t at(uint32_t key, uint32_t n)
+        {
+            uint32_t x = n * 0x9E3779B9U + key;
+            x ^= x >> 16;
+            x *= 0x7FEB352DU;
+            x ^= x >> 15;
+            x *= 0x846CA68BU;
+            x ^= x >> 16;
+            return x;
+        }
+
+        // at(key, n) as a uniform double in [0, 1)
+        static inline double uniform(uint32_t key, uint32_t n)
+        {
+            return at(key, n) * (1.0 / 4294967296.0);
+        }
+
+        // @seed, or a seed from the clock if it is 0
+        static inline uint64_t seed_or_clock(int seed)
+        {
+            if (seed != 0)
+                return (uint64_t)seed;
+            return (uint64_t)std::chrono::high_resolution_clock::now()
+                .time_since_epoch().count();
+        }
+
+        /**
+         * threshold t such that at(key, n) >= t
+         *  has probability 1 - @p
+         */
+        static inline uint32_t threshold(double p)
+        {
+            if (p <= 0) return 0;
+            if (p >= 1) return 0xFFFFFFFFU;
+            return (uint32_t)(p * 4294967296.0);
+        }
+};
+
+#endif
@@ -8,7 +8,7 @@ class Snd_head
     public:
         int head = -1;
         double score = -100000;
-        std::string label;
+        int label = -1; // DependencyGraph label id
 };
 
 #endif
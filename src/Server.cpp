@@ -0,0 +1,291 @@
+#include "Server.h"
+#include "ConllReader.h"
+#include "Socket.h"
+#include "Util.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <csignal>
+
+#include <omp.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+using namespace std;
+
+// set by SIGINT and SIGTERM
+static volatile sig_atomic_t stop_requested = 0;
+
+static void request_stop(int)
+{
+    stop_requested = 1;
+}
+
+ParseServer::ParseServer(const char * cfg_filename)
+    : cfg_file(cfg_filename), config(cfg_filename),
+      parser(NULL), stopping(false)
+{
+}
+
+ParseServer::~ParseServer()
+{
+    delete parser;
+}
+
+bool ParseServer::load_model(const char * filename)
+{
+    DependencyParser * p = new DependencyParser(cfg_file.c_str());
+    if (!p->load_model(filename, false))
+    {
+        delete p;
+        return false;
+    }
+
+    /**
+     * requests are read unlabeled: intern the UNKNOWN label now, so
+     *  that workers never extend the label tables of the parser
+     */
+    DependencyGraph::label_id(Config::UNKNOWN);
+    p->intern_labels();
+
+    delete parser;
+    parser = p;
+    model_name = filename;
+    return true;
+}
+
+bool ParseServer::run(const char * address)
+{
+    if (parser == NULL)
+    {
+        cerr << "ERROR: no model to serve" << endl;
+        return false;
+    }
+
+    int listen_fd = Socket::listen_on(address);
+    if (listen_fd < 0)
+        return false;
+
+    // the socket file created, removed when done
+    string path = Socket::unix_path(address);
+    dev_t path_dev = 0;
+    ino_t path_ino = 0;
+    bool own_path = !path.empty() && Socket::file_id(path, path_dev, path_ino);
+
+    struct sigaction action;
+    action.sa_handler = request_stop;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = 0;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    int n_threads = config.decode_threads > 0
+                        ? config.decode_threads
+                        : omp_get_num_procs();
+    for (int t = 0; t < n_threads; ++t)
+        workers.push_back(thread(&ParseServer::work, this));
+
+    cerr << "Serving " << model_name << " on " << address
+         << " with " << n_threads << " threads, "
+         << config.decode_batch_size << " sentences per batch" << endl;
+
+    // the signals interrupt any thread: poll the flag
+    while (!stop_requested)
+    {
+        pollfd p;
+        p.fd = listen_fd;
+        p.events = POLLIN;
+        if (poll(&p, 1, 200) <= 0)
+            continue;
+
+        int fd = Socket::accept_from(listen_fd);
+        if (fd < 0)
+            continue;
+        lock_guard<mutex> guard(lock);
+        connections.insert(fd);
+        thread(&ParseServer::serve_connection, this, fd).detach();
+    }
+    cerr << "Stopping" << endl;
+
+    close(listen_fd);
+    if (own_path)
+        Socket::remove_socket_file(path, path_dev, path_ino);
+
+    // finish the requests received, then end the connections
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+        for (set<int>::iterator it = connections.begin(); it != connections.end(); ++it)
+            shutdown(*it, SHUT_RD);
+    }
+    work_ready.notify_all();
+    for (size_t t = 0; t < workers.size(); ++t)
+        workers[t].join();
+    workers.clear();
+
+    unique_lock<mutex> guard(lock);
+    while (!connections.empty())
+        closed.wait(guard);
+    return true;
+}
+
+void ParseServer::serve_connection(int fd)
+{
+    SocketReader reader(fd);
+    string line;
+    string body;
+    while (reader.read_line(line))
+    {
+        if (line.empty())
+            continue;
+
+        if (line.compare(0, 5, "PARSE") != 0
+                || (line.size() > 5 && line[5] != ' '))
+        {
+            Socket::write_all(fd, "ERROR unknown command\n");
+            break;
+        }
+        string name = line.size() > 6 ? line.substr(6) : string();
+
+        // the CoNLL lines up to END
+        body.clear();
+        bool ended = false;
+        bool blank = true; // whether the last line is empty
+        while (reader.read_line(line))
+        {
+            if (line == "END")
+            {
+                ended = true;
+                break;
+            }
+            body += line;
+            body += '\n';
+            blank = line.empty();
+        }
+        if (!ended)
+            break;
+        if (!blank) // end the last sentence
+            body += '\n';
+
+        if (!name.empty() && name != model_name)
+        {
+            if (!Socket::write_all(fd, "ERROR unknown model " + name + "\n"))
+                break;
+            continue;
+        }
+
+        Request request;
+        istringstream input(body);
+        ConllReader conll(false);
+        conll.open(input);
+        while (true)
+        {
+            request.sents.push_back(DependencySent());
+            request.graphs.push_back(DependencyGraph());
+            if (!conll.next(request.sents.back(), request.graphs.back()))
+            {
+                request.sents.pop_back();
+                request.graphs.pop_back();
+                break;
+            }
+        }
+
+        if (!parse(request))
+        {
+            Socket::write_all(fd, "ERROR server stopping\n");
+            break;
+        }
+
+        ostringstream output;
+        output << "OK " << request.sents.size() << "\n";
+        for (size_t i = 0; i < request.sents.size(); ++i)
+            Util::write_conll_graph(output, request.sents[i], request.graphs[i]);
+        output << "END\n";
+        if (!Socket::write_all(fd, output.str()))
+            break;
+    }
+
+    lock_guard<mutex> guard(lock);
+    connections.erase(fd);
+    close(fd);
+    closed.notify_all();
+}
+
+bool ParseServer::parse(Request & request)
+{
+    request.n_left = request.sents.size();
+    if (request.n_left == 0)
+        return true;
+
+    unique_lock<mutex> guard(lock);
+    if (stopping)
+        return false;
+    for (int i = 0; i < request.n_left; ++i)
+    {
+        Task task;
+        task.request = &request;
+        task.index = i;
+        pending.push_back(task);
+    }
+    work_ready.notify_all();
+
+    while (request.n_left > 0)
+        request.done.wait(guard);
+    return true;
+}
+
+void ParseServer::work()
+{
+    /**
+     * take the sentences waiting, up to decode_batch_size of them
+     *  and from any requests, without waiting for more
+     */
+    size_t width = max(config.decode_batch_size, 1);
+    vector<Task> tasks;
+    vector<DependencySent> sents;
+    vector<DependencyGraph> graphs;
+    vector<int> order;
+    while (true)
+    {
+        tasks.clear();
+        {
+            unique_lock<mutex> guard(lock);
+            while (pending.empty() && !stopping)
+                work_ready.wait(guard);
+            if (pending.empty())
+                return;
+
+            while (!pending.empty() && tasks.size() < width)
+            {
+                tasks.push_back(pending.front());
+                pending.pop_front();
+            }
+        }
+
+        sents.resize(tasks.size());
+        graphs.resize(tasks.size());
+        order.resize(tasks.size());
+        for (size_t i = 0; i < tasks.size(); ++i)
+        {
+            swap(sents[i], tasks[i].request->sents[tasks[i].index]);
+            parser->intern(sents[i]);
+            order[i] = i;
+        }
+        int cursor = 0;
+        parser->decode_lockstep(sents, order, cursor, graphs, false);
+
+        lock_guard<mutex> guard(lock);
+        for (size_t i = 0; i < tasks.size(); ++i)
+        {
+            Request * request = tasks[i].request;
+            swap(request->sents[tasks[i].index], sents[i]);
+            swap(request->graphs[tasks[i].index], graphs[i]);
+            if (--request->n_left == 0)
+                request->done.notify_all();
+        }
+    }
+}
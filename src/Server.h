@@ -0,0 +1,96 @@
+#ifndef __NNDEP_SERVER_H__
+#define __NNDEP_SERVER_H__
+
+#include <vector>
+#include <deque>
+#include <set>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "Config.h"
+#include "DependencyParser.h"
+
+/**
+ * Resident parser: loads its model once, then parses the CoNLL
+ *  sentences sent by clients over a socket (see Socket for the
+ *  addresses). A connection sends any number of requests, each
+ *  answered in turn:
+ *
+ *    PARSE [model]          if given, the model file as given to
+ *    <CoNLL sentences>       load_model, checked against it
+ *    END
+ *
+ *    OK <sentences>   or    ERROR <message>
+ *    <parsed CoNLL>
+ *    END
+ *
+ * The sentences of all requests go to one queue, from which
+ *  decode_threads workers take up to decode_batch_size of them at
+ *  a time and decode them in lockstep: concurrent requests share
+ *  batched scoring calls.
+ *
+ * A server holds one model: the weights of NNClassifier are static
+ *  members, which a second parser would overwrite.
+ */
+class ParseServer
+{
+    public:
+        ParseServer(const char * cfg_filename);
+        ~ParseServer();
+
+        // load the model @filename, false if it cannot be loaded
+        bool load_model(const char * filename);
+
+        /**
+         * serve on @address until SIGINT or SIGTERM (the requests
+         *  received are answered first); false if it cannot listen
+         */
+        bool run(const char * address);
+
+    private:
+        // the sentences of a request, parsed in place
+        struct Request
+        {
+            std::vector<DependencySent> sents;
+            std::vector<DependencyGraph> graphs;
+            int n_left; // sentences not parsed yet
+            std::condition_variable done;
+        };
+
+        // a sentence of a request
+        struct Task
+        {
+            Request * request;
+            int index;
+        };
+
+        // answer the requests of the connection @fd, then close it
+        void serve_connection(int fd);
+
+        // parse the sentences of @request, false when stopping
+        bool parse(Request & request);
+
+        // worker thread: decode batches of pending sentences
+        void work();
+
+    private:
+        std::string cfg_file;
+        Config config;
+
+        std::string model_name; // the file loaded
+        DependencyParser * parser;
+
+        std::mutex lock;
+        std::condition_variable work_ready;
+        std::deque<Task> pending; // sentences waiting for a worker
+        bool stopping;
+        std::vector<std::thread> workers;
+
+        // connections being served, shut down when stopping
+        std::set<int> connections;
+        std::condition_variable closed;
+};
+
+#endif
@@ -0,0 +1,261 @@
+#include "Socket.h"
+
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+using namespace std;
+
+string Socket::unix_path(const char * address)
+{
+    return strchr(address, ':') == NULL ? string(address) : string();
+}
+
+// fill @addr from the TCP address "host:port", false if invalid
+static bool tcp_address(const char * address, sockaddr_in & addr)
+{
+    const char * colon = strrchr(address, ':');
+    string host(address, colon - address);
+    if (host.empty())
+        host = "127.0.0.1";
+    int port = atoi(colon + 1);
+    if (port <= 0 || port > 65535)
+        return false;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) == 1)
+        return true;
+
+    addrinfo hints, * found = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), NULL, &hints, &found) != 0 || found == NULL)
+        return false;
+    addr.sin_addr = ((sockaddr_in *)found->ai_addr)->sin_addr;
+    freeaddrinfo(found);
+    return true;
+}
+
+// fill @addr from the Unix socket path @path, false if too long
+static bool unix_address(const string & path, sockaddr_un & addr)
+{
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path))
+        return false;
+    memcpy(addr.sun_path, path.data(), path.size());
+    return true;
+}
+
+/**
+ * make way for a Unix socket at @path: a socket file that nothing
+ *  answers on (left by a server that died) is removed. False if
+ *  @path is another kind of file, or the socket of a live server.
+ */
+static bool clear_stale_socket(const string & path, const sockaddr_un & addr)
+{
+    struct stat st;
+    if (lstat(path.c_str(), &st) != 0)
+        return errno == ENOENT;
+    if (!S_ISSOCK(st.st_mode))
+        return false;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return false;
+    int ret = connect(fd, (sockaddr *)&addr, sizeof(addr));
+    int err = errno;
+    close(fd);
+    if (ret == 0 || err != ECONNREFUSED)
+        return false;
+    return unlink(path.c_str()) == 0;
+}
+
+/**
+ * a request or reply is written at once: send its last segment
+ *  without waiting for the ack of the previous ones
+ */
+static void no_delay(int fd)
+{
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+}
+
+int Socket::listen_on(const char * address)
+{
+    string path = unix_path(address);
+    int fd = -1;
+    int ret = -1;
+    if (path.empty())
+    {
+        sockaddr_in addr;
+        if (!tcp_address(address, addr))
+        {
+            cerr << "ERROR: invalid address " << address << endl;
+            return -1;
+        }
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        int on = 1;
+        if (fd >= 0)
+        {
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+            ret = bind(fd, (sockaddr *)&addr, sizeof(addr));
+        }
+    }
+    else
+    {
+        sockaddr_un addr;
+        if (!unix_address(path, addr))
+        {
+            cerr << "ERROR: invalid socket path " << path << endl;
+            return -1;
+        }
+        if (!clear_stale_socket(path, addr))
+        {
+            cerr << "ERROR: cannot listen on " << address
+                 << ": address in use" << endl;
+            return -1;
+        }
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0)
+            ret = bind(fd, (sockaddr *)&addr, sizeof(addr));
+    }
+
+    if (ret == 0)
+        ret = listen(fd, SOMAXCONN);
+    if (ret != 0)
+    {
+        cerr << "ERROR: cannot listen on " << address
+             << ": " << strerror(errno) << endl;
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool Socket::file_id(const string & path, dev_t & dev, ino_t & ino)
+{
+    struct stat st;
+    if (lstat(path.c_str(), &st) != 0)
+        return false;
+    dev = st.st_dev;
+    ino = st.st_ino;
+    return true;
+}
+
+void Socket::remove_socket_file(const string & path, dev_t dev, ino_t ino)
+{
+    struct stat st;
+    if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)
+            && st.st_dev == dev && st.st_ino == ino)
+        unlink(path.c_str());
+}
+
+int Socket::accept_from(int listen_fd)
+{
+    int fd = accept(listen_fd, NULL, NULL);
+    sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    if (fd >= 0 && getsockname(fd, (sockaddr *)&addr, &len) == 0
+            && addr.ss_family == AF_INET)
+        no_delay(fd);
+    return fd;
+}
+
+int Socket::connect_to(const char * address)
+{
+    string path = unix_path(address);
+    int fd = -1;
+    int ret = -1;
+    if (path.empty())
+    {
+        sockaddr_in addr;
+        if (!tcp_address(address, addr))
+        {
+            cerr << "ERROR: invalid address " << address << endl;
+            return -1;
+        }
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd >= 0)
+            ret = connect(fd, (sockaddr *)&addr, sizeof(addr));
+        if (ret == 0)
+            no_delay(fd);
+    }
+    else
+    {
+        sockaddr_un addr;
+        if (!unix_address(path, addr))
+        {
+            cerr << "ERROR: invalid socket path " << path << endl;
+            return -1;
+        }
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0)
+            ret = connect(fd, (sockaddr *)&addr, sizeof(addr));
+    }
+
+    if (ret != 0)
+    {
+        cerr << "ERROR: cannot connect to " << address
+             << ": " << strerror(errno) << endl;
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool Socket::write_all(int fd, const char * p, size_t n)
+{
+    while (n > 0)
+    {
+        ssize_t k = send(fd, p, n, MSG_NOSIGNAL);
+        if (k < 0 && errno == EINTR)
+            continue;
+        if (k <= 0)
+            return false;
+        p += k;
+        n -= k;
+    }
+    return true;
+}
+
+bool SocketReader::read_line(string & line)
+{
+    line.clear();
+    while (true)
+    {
+        char * nl = (char *)memchr(buffer + begin, '\n', end - begin);
+        if (nl != NULL)
+        {
+            line.append(buffer + begin, nl - (buffer + begin));
+            begin = nl - buffer + 1;
+            if (!line.empty() && line[line.size() - 1] == '\r')
+                line.erase(line.size() - 1);
+            return true;
+        }
+        line.append(buffer + begin, end - begin);
+        begin = end = 0;
+
+        ssize_t k = recv(fd, buffer, BUFFER_SIZE, 0);
+        if (k < 0 && errno == EINTR)
+            continue;
+        if (k <= 0)
+            return !line.empty(); // a last line without '\n'
+        end = k;
+    }
+}
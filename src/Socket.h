@@ -0,0 +1,74 @@
+#ifndef __NNDEP_SOCKET_H__
+#define __NNDEP_SOCKET_H__
+
+#include <cstddef>
+#include <string>
+
+#include <sys/types.h>
+
+/**
+ * Stream sockets of the parse server and its clients. An address is
+ *  - host:port (or :port, for 127.0.0.1) for TCP
+ *  - the path of a Unix domain socket otherwise
+ */
+class Socket
+{
+    public:
+        /**
+         * listen on @address, the descriptor or -1 (with a message on
+         *  cerr). A Unix socket file nothing answers on is replaced;
+         *  any other file at the path is left alone, and the address
+         *  is in use.
+         */
+        static int listen_on(const char * address);
+
+        // accept a connection on @listen_fd, its descriptor or -1
+        static int accept_from(int listen_fd);
+
+        // connect to @address, the descriptor or -1
+        static int connect_to(const char * address);
+
+        // the path of @address if it is a Unix socket, "" otherwise
+        static std::string unix_path(const char * address);
+
+        // device and inode of the file @path, false if there is none
+        static bool file_id(const std::string & path, dev_t & dev, ino_t & ino);
+
+        /**
+         * remove the socket file @path if it is still the file @dev,
+         *  @ino (see file_id): not one another server put there since
+         */
+        static void remove_socket_file(const std::string & path, dev_t dev, ino_t ino);
+
+        // write the @n bytes at @p, false if the peer is gone
+        static bool write_all(int fd, const char * p, size_t n);
+        static bool write_all(int fd, const std::string & s)
+        {
+            return write_all(fd, s.data(), s.size());
+        }
+};
+
+/**
+ * Buffered reading of the lines of a socket
+ */
+class SocketReader
+{
+    public:
+        SocketReader(int fd) : fd(fd), begin(0), end(0) {}
+
+        /**
+         * the next line into @line, without its '\n' (nor a '\r'
+         *  before it); false at the end of the input
+         */
+        bool read_line(std::string & line);
+
+    private:
+        static const int BUFFER_SIZE = 65536;
+
+        int fd;
+        char buffer[BUFFER_SIZE];
+        int begin;
+        int end;
+};
+
+#endif
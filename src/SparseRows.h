@@ -0,0 +1,112 @@
+#ifndef __NNDEP_SPARSE_ROWS_H__
+#define __NNDEP_SPARSE_ROWS_H__
+
+#include <vector>
+#include <cstddef>
+
+#include "math/mat.h"
+
+/**
+ * Row-sparse gradient of a (nrows x ncols) matrix.
+ *
+ * Only the rows touched by a mini-batch are stored, packed in
+ *  the order they were first touched. Untouched rows are zero.
+ *  Used for the embedding tables, of which a mini-batch hits
+ *  a few thousand rows out of the whole vocabulary. A dense
+ *  row -> slot index finds the packed row of a touched one.
+ */
+template <typename Real>
+class SparseRows
+{
+    public:
+        SparseRows() : n(0), m(0) {}
+        SparseRows(int _n, int _m) : n(_n), m(_m), slot(_n, -1) {}
+
+        void resize(int _n, int _m)
+        {
+            n = _n;
+            m = _m;
+            ids.clear();
+            values.clear();
+            slot.assign(n, -1);
+        }
+
+        // only the touched rows are reset in @slot
+        void clear()
+        {
+            for (size_t k = 0; k < ids.size(); ++k)
+                slot[ids[k]] = -1;
+            ids.clear();
+            values.clear();
+        }
+
+        /**
+         * row @i, zero-filled when first touched.
+         *  The pointer is valid until the next new row is touched.
+         */
+        Real * row(int i)
+        {
+            int k = slot[i];
+            if (k >= 0)
+                return &values[(size_t)k * m];
+
+            slot[i] = ids.size();
+            ids.push_back(i);
+            values.resize(values.size() + m, 0);
+            return &values[values.size() - m];
+        }
+
+        // row @i, or NULL if not touched
+        const Real * find(int i) const
+        {
+            int k = slot[i];
+            if (k < 0)
+                return NULL;
+            return &values[(size_t)k * m];
+        }
+
+        /**
+         * k-th touched row, 0 <= k < size()
+         */
+        int row_id(size_t k) const { return ids[k]; }
+        Real * row_at(size_t k) { return &values[k * m]; }
+        const Real * row_at(size_t k) const { return &values[k * m]; }
+
+        // number of touched rows
+        size_t size() const { return ids.size(); }
+
+        int nrows() const { return n; }
+        int ncols() const { return m; }
+
+        /**
+         * this += c, visiting only the rows touched by @c
+         */
+        void merge(const SparseRows & c)
+        {
+            for (size_t k = 0; k < c.size(); ++k)
+            {
+                Real * dst = row(c.row_id(k));
+                const Real * src = c.row_at(k);
+                for (int j = 0; j < m; ++j)
+                    dst[j] += src[j];
+            }
+        }
+
+        // dense copy, for gradient checking
+        Mat<Real> to_mat() const
+        {
+            Mat<Real> mat((Real)0, n, m);
+            for (size_t k = 0; k < size(); ++k)
+                for (int j = 0; j < m; ++j)
+                    mat[ids[k]][j] = values[k * m + j];
+            return mat;
+        }
+
+    private:
+        int n, m;
+        std::vector<int> ids;       // k -> row id
+        std::vector<Real> values;   // packed rows
+        std::vector<int> slot;      // row id -> k, -1 if not touched
+};
+
+#endif
@@ -0,0 +1,106 @@
+/**
+ * Micro benchmark: pre-computed feature lookup through
+ *  unordered_map (find + operator[], as done before) vs
+ *  PreComputeIndex.
+ *
+ * Standalone driver, not part of the default build:
+ *  g++ -O3 -std=c++11 bench_pre_map.cpp PreComputeIndex.cpp -o bench_pre_map
+ *  ./bench_pre_map [num_tokens] [vocab] [num_pre_computed] [lookups]
+ */
+#include <iostream>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <random>
+#include <cstdlib>
+
+#include "PreComputeIndex.h"
+#include "time.h"
+
+using namespace std;
+
+int main(int argc, char** argv)
+{
+    int num_tokens       = argc > 1 ? atoi(argv[1]) : 48;
+    int vocab            = argc > 2 ? atoi(argv[2]) : 100000;
+    int num_pre_computed = argc > 3 ? atoi(argv[3]) : 100000;
+    long lookups         = argc > 4 ? atol(argv[4]) : 50000000;
+
+    mt19937 gen(1234);
+
+    // token frequencies are roughly Zipfian
+    vector<double> weights(vocab);
+    for (int i = 0; i < vocab; ++i)
+        weights[i] = 1.0 / (i + 1);
+    discrete_distribution<int> zipf(weights.begin(), weights.end());
+    uniform_int_distribution<int> any_pos(0, num_tokens - 1);
+
+    // the most frequent (tok, pos) pairs are pre-computed
+    unordered_map<int, int> pre_map;
+    PreComputeIndex index;
+    index.set_num_tokens(num_tokens);
+    for (int tok = 0; (int)pre_map.size() < num_pre_computed && tok < vocab; ++tok)
+        for (int pos = 0; pos < num_tokens
+                && (int)pre_map.size() < num_pre_computed; ++pos)
+        {
+            int id = tok * num_tokens + pos;
+            int row = pre_map.size();
+            pre_map[id] = row;
+            index.insert(id, row);
+        }
+
+    // feature vectors as seen in training / decoding
+    const int num_samples = 1 << 16;
+    vector<int> toks((long)num_samples * num_tokens);
+    for (size_t i = 0; i < toks.size(); ++i)
+        toks[i] = zipf(gen);
+
+    cerr << "num_tokens = " << num_tokens
+         << ", vocab = " << vocab
+         << ", pre-computed = " << pre_map.size()
+         << ", lookups = " << lookups << endl;
+
+    long rounds = max(1L, lookups / (long)toks.size());
+
+    double start = get_time();
+    long sum_map = 0;
+    for (long r = 0; r < rounds; ++r)
+        for (int s = 0; s < num_samples; ++s)
+            for (int j = 0; j < num_tokens; ++j)
+            {
+                int index = toks[(long)s * num_tokens + j] * num_tokens + j;
+                if (pre_map.find(index) != pre_map.end())
+                    sum_map += pre_map[index];
+                else
+                    sum_map -= 1;
+            }
+    double t_map = get_time() - start;
+
+    start = get_time();
+    long sum_index = 0;
+    for (long r = 0; r < rounds; ++r)
+        for (int s = 0; s < num_samples; ++s)
+            for (int j = 0; j < num_tokens; ++j)
+            {
+                int id = index.find(j, toks[(long)s * num_tokens + j]);
+                if (id >= 0)
+                    sum_index += id;
+                else
+                    sum_index -= 1;
+            }
+    double t_index = get_time() - start;
+
+    double n = (double)rounds * toks.size();
+    cerr << "unordered_map   : " << t_map   << " s, "
+         << t_map   / n * 1e9 << " ns/lookup" << endl;
+    cerr << "PreComputeIndex : " << t_index << " s, "
+         << t_index / n * 1e9 << " ns/lookup" << endl;
+    cerr << "speedup         : " << t_map / t_index << "x" << endl;
+
+    if (sum_map != sum_index)
+    {
+        cerr << "error: results differ" << endl;
+        return 1;
+    }
+    return 0;
+}
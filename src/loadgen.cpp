@@ -0,0 +1,270 @@
+/**
+ * Load generator for the parse server (nndep -serve): sends the
+ *  sentences of a CoNLL file in requests of -sents sentences from
+ *  -clients concurrent connections, and reports the throughput and
+ *  the latency of the requests.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <cstring>
+#include <cstdlib>
+
+#include <unistd.h>
+
+#include "Socket.h"
+#include "time.h"
+
+using namespace std;
+
+typedef struct
+{
+    string server;
+    string input_file;
+    string output_file;
+    string model;
+    int clients;
+    int sents;    // sentences per request
+    int requests; // -1: every sentence once
+} Option;
+
+Option opt;
+
+// requests to send, taken in turn by the clients
+struct Load
+{
+    vector<string> sents; // CoNLL lines of the input sentences
+    long n_requests;
+    long n_sents;         // sentences sent, in all
+
+    mutex lock;
+    long next;            // next request to send
+    vector<double> latencies;
+    vector<string> replies;
+    long n_errors;
+};
+
+void print_usage()
+{
+    cerr << "Load generator for the parse server\n\n"
+         << "Options:\n"
+         << "\t-server <address>\n"
+         << "\t\tUnix socket path, or host:port (:port for 127.0.0.1)\n"
+         << "\t-input <file>\n"
+         << "\t\tSentences to send (CoNLL format)\n"
+         << "\t-model <name>\n"
+         << "\t\tModel file the server must be serving (default: any)\n"
+         << "\t-clients <num>\n"
+         << "\t\tConcurrent connections (default: 1)\n"
+         << "\t-sents <num>\n"
+         << "\t\tSentences per request (default: 16)\n"
+         << "\t-requests <num>\n"
+         << "\t\tRequests to send, cycling over the input (default: the input once)\n"
+         << "\t-output <file>\n"
+         << "\t\tWrite the parsed sentences to <file>, in the order sent\n"
+         << "\nExample:\n"
+         << "./loadgen -server /tmp/nndep.sock -input data/test.dep -clients 8\n\n";
+}
+
+int arg_pos(char * str, int argc, char ** argv)
+{
+    for (int i = 0; i < argc; ++i)
+    {
+        if (!strcmp(str, argv[i]))
+        {
+            if (i == argc - 1)
+            {
+                cerr << "Argument missing for "
+                     << str
+                     << endl;
+                exit(1);
+            }
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+void parse_command_line(int argc, char ** argv)
+{
+    opt.clients = 1;
+    opt.sents = 16;
+    opt.requests = -1;
+
+    int i;
+    if ((i = arg_pos((char *)"-server",   argc, argv)) > 0)
+        opt.server = argv[i + 1];
+    if ((i = arg_pos((char *)"-input",    argc, argv)) > 0)
+        opt.input_file = argv[i + 1];
+    if ((i = arg_pos((char *)"-output",   argc, argv)) > 0)
+        opt.output_file = argv[i + 1];
+    if ((i = arg_pos((char *)"-model",    argc, argv)) > 0)
+        opt.model = argv[i + 1];
+    if ((i = arg_pos((char *)"-clients",  argc, argv)) > 0)
+        opt.clients = max(atoi(argv[i + 1]), 1);
+    if ((i = arg_pos((char *)"-sents",    argc, argv)) > 0)
+        opt.sents = max(atoi(argv[i + 1]), 1);
+    if ((i = arg_pos((char *)"-requests", argc, argv)) > 0)
+        opt.requests = atoi(argv[i + 1]);
+}
+
+// split @filename into sentences, each with its ending empty line
+bool load_sentences(const char * filename, vector<string> & sents)
+{
+    ifstream input(filename);
+    if (input.fail())
+    {
+        cerr << "# fail to open conll file: " << filename << endl;
+        return false;
+    }
+
+    string line, sent;
+    while (getline(input, line))
+    {
+        if (line.empty())
+        {
+            if (!sent.empty())
+                sents.push_back(sent + "\n");
+            sent.clear();
+        }
+        else
+            sent += line + "\n";
+    }
+    if (!sent.empty())
+        sents.push_back(sent + "\n");
+    return true;
+}
+
+void run_client(Load * load)
+{
+    int fd = Socket::connect_to(opt.server.c_str());
+    if (fd < 0)
+        return;
+    SocketReader reader(fd);
+
+    string request, reply, line;
+    while (true)
+    {
+        long r;
+        {
+            lock_guard<mutex> guard(load->lock);
+            r = load->next++;
+        }
+        if (r >= load->n_requests)
+            break;
+
+        request = "PARSE";
+        if (!opt.model.empty())
+            request += " " + opt.model;
+        request += "\n";
+        long first = r * opt.sents;
+        long last = min(first + opt.sents, load->n_sents);
+        for (long i = first; i < last; ++i)
+            request += load->sents[i % load->sents.size()];
+        request += "END\n";
+
+        double start = get_time();
+        bool ok = Socket::write_all(fd, request) && reader.read_line(line);
+        if (ok && line.compare(0, 3, "OK ") != 0)
+        {
+            cerr << "request " << r << ": " << line << endl;
+            ok = false;
+        }
+        reply.clear();
+        while (ok && (ok = reader.read_line(line)) && line != "END")
+        {
+            reply += line;
+            reply += '\n';
+        }
+        double latency = get_time() - start;
+
+        lock_guard<mutex> guard(load->lock);
+        if (!ok)
+        {
+            ++load->n_errors;
+            break;
+        }
+        load->latencies.push_back(latency);
+        if (!opt.output_file.empty())
+            load->replies[r].swap(reply);
+    }
+    close(fd);
+}
+
+int main(int argc, char ** argv)
+{
+    if (argc == 1) {
+        print_usage(); exit(1);
+    }
+
+    parse_command_line(argc, argv);
+    if (opt.server.empty() || opt.input_file.empty())
+    {
+        print_usage(); exit(1);
+    }
+
+    Load load;
+    if (!load_sentences(opt.input_file.c_str(), load.sents) || load.sents.empty())
+        return 1;
+    if (opt.requests < 0)
+    {
+        load.n_sents = load.sents.size();
+        load.n_requests = (load.n_sents + opt.sents - 1) / opt.sents;
+    }
+    else
+    {
+        load.n_requests = opt.requests;
+        load.n_sents = (long)opt.requests * opt.sents;
+    }
+    load.next = 0;
+    load.n_errors = 0;
+    if (!opt.output_file.empty())
+        load.replies.resize(load.n_requests);
+
+    cerr << "Sending " << load.n_requests << " requests of "
+         << opt.sents << " sentences from " << opt.clients << " clients" << endl;
+
+    double start = get_time();
+    vector<thread> clients;
+    for (int c = 0; c < opt.clients; ++c)
+        clients.push_back(thread(run_client, &load));
+    for (int c = 0; c < opt.clients; ++c)
+        clients[c].join();
+    double elapsed = get_time() - start;
+
+    vector<double> & lat = load.latencies;
+    sort(lat.begin(), lat.end());
+    long n_done = lat.size();
+    cerr << "Requests: " << n_done << " answered, "
+         << load.n_errors << " failed" << endl;
+    if (n_done > 0)
+    {
+        double total = 0;
+        for (long i = 0; i < n_done; ++i)
+            total += lat[i];
+        cerr << "Elapsed " << elapsed << "s, "
+             << n_done / elapsed << " requests per second, "
+             << min(n_done * opt.sents, load.n_sents) / elapsed
+             << " sentences per second" << endl;
+        cerr << "Latency (ms): mean " << 1000 * total / n_done
+             << ", p50 " << 1000 * lat[n_done / 2]
+             << ", p90 " << 1000 * lat[n_done * 9 / 10]
+             << ", p99 " << 1000 * lat[n_done * 99 / 100]
+             << ", max " << 1000 * lat[n_done - 1] << endl;
+    }
+
+    if (!opt.output_file.empty())
+    {
+        ofstream output(opt.output_file.c_str());
+        for (long r = 0; r < load.n_requests; ++r)
+            output << load.replies[r];
+    }
+    return load.n_errors == 0 && n_done == load.n_requests ? 0 : 1;
+}
@@ -8,6 +8,7 @@
  */
 
 #include "DependencyParser.h"
+#include "Server.h"
 #include "strutils.h"
 #include <cstring>
 #include <cstdlib>
@@ -25,6 +26,9 @@ typedef struct
     bool   is_finetune; // cross-lingual fine-tuning mode
     bool   is_getoracle;
     bool   extract_actseq; // extract oracle sequences only
+    bool   is_convert; // convert the model to the other format
+    bool   is_stream; // parse a stream of sentences
+    bool   is_serve; // resident parse server
 
     string train_file;
     string dev_file;
@@ -36,6 +40,10 @@ typedef struct
     string cfg_file;
     string output_file;
     string oracle_file;
+    string calib_file; // int8 inference, calibrated on this file
+    string convert_file;
+    string stream_file;
+    string serve_address;
     int sub_sampling;
 
 } Option;
@@ -53,6 +61,8 @@ Option opt;
  *   -emb    <embedding-file>
  *   -cfg    <cfg-file>
  *   -output <output-file>
+ *   -stream <input-file>
+ *   -serve  <address>
  */
 
 void print_usage()
@@ -86,6 +96,14 @@ void print_usage()
          << "\t\tUse <file>(target language) for finetuning the model\n"
          << "\t-actseq <file>\n"
          << "\t\tUse <file> for extacting oracle sequences\n"
+         << "\t-int8 <file>\n"
+         << "\t\tTest or -stream with int8 quantized scoring, calibrated on <file> (CoNLL format)\n"
+         << "\t-convert <file>\n"
+         << "\t\tConvert the -model file to <file>, text to binary or binary to text\n"
+         << "\t-stream <file>\n"
+         << "\t\tParse <file> (- for stdin) as it is read, writing to -output (stdout by default)\n"
+         << "\t-serve <address>\n"
+         << "\t\tServe the -model file on a Unix socket path, or host:port\n"
          << "\nExample(train):\n"
          << "./eagernndep -train data/train.dep -dev data/dev.dep"
          <<        " -model model -emb data/words.emb -cfg nndep.cfg\n"
@@ -122,6 +140,9 @@ void parse_command_line(int argc, char ** argv)
     opt.is_cltest = false;
     opt.is_finetune = false;
     opt.extract_actseq = false;
+    opt.is_convert = false;
+    opt.is_stream = false;
+    opt.is_serve = false;
     opt.sub_sampling = -1;
     opt.model_file = "model";
 
@@ -167,6 +188,23 @@ void parse_command_line(int argc, char ** argv)
         opt.output_file = argv[i + 1];
     if ((i = arg_pos((char *)"-sample", argc, argv)) > 0)
         opt.sub_sampling = to_int(argv[i + 1]);
+    if ((i = arg_pos((char *)"-int8",   argc, argv)) > 0)
+        opt.calib_file = argv[i + 1];
+    if ((i = arg_pos((char *)"-convert", argc, argv)) > 0)
+    {
+        opt.is_convert = true;
+        opt.convert_file = argv[i + 1];
+    }
+    if ((i = arg_pos((char *)"-stream", argc, argv)) > 0)
+    {
+        opt.is_stream = true;
+        opt.stream_file = argv[i + 1];
+    }
+    if ((i = arg_pos((char *)"-serve",  argc, argv)) > 0)
+    {
+        opt.is_serve = true;
+        opt.serve_address = argv[i + 1];
+    }
     if ((i = arg_pos((char *)"-oracle_file",  argc, argv)) > 0)
     {
         opt.is_getoracle = true;
@@ -186,11 +224,33 @@ int main(int argc, char** argv)
     srand(time(NULL));
     // srand(12345);
 
+    if (opt.is_serve)
+    {
+        ParseServer server(opt.cfg_file.c_str());
+        if (!server.load_model(opt.model_file.c_str()))
+            return 1;
+        return server.run(opt.serve_address.c_str()) ? 0 : 1;
+    }
+
     DependencyParser parser(opt.cfg_file);
 
     if (opt.extract_actseq)
         parser.extract_transition_sequence(opt.train_file,opt.oracle_file);
 
+    if (opt.is_convert)
+    {
+        return parser.convert_model(opt.model_file.c_str(), opt.convert_file.c_str()) ? 0 : 1;
+    }
+
+    if (opt.is_stream)
+    {
+        if (!parser.load_model(opt.model_file, false, opt.calib_file))
+            return 1;
+        parser.parse_stream(opt.stream_file.c_str(),
+                opt.output_file.empty() ? "-" : opt.output_file.c_str());
+        return 0;
+    }
+
     bool loaded = false;
     if (opt.is_getoracle) 
     {
@@ -222,11 +282,12 @@ int main(int argc, char** argv)
 
     if (opt.is_test)
     {
-        if (! loaded)
-            parser.load_model(opt.model_file, true);
+        if (! loaded && !parser.load_model(opt.model_file, true))
+            return 1;
         parser.test(opt.test_file,
                 opt.output_file,
-                true);
+                true,
+                opt.calib_file);
         // parser.save_model("tmp");
     }
 
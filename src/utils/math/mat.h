@@ -13,27 +13,28 @@ class Vec {
 private:
     int nn;
     T * v;
+    bool own; // false for a view of external memory (see borrow)
 public:
-    Vec() : nn(0), v(0) {}
+    Vec() : nn(0), v(0), own(true) {}
 
     ~Vec() {
         dealloc();
     }
 
     // zero-based array
-    explicit Vec(const int n) : nn(0), v(0) {
+    explicit Vec(const int n) : nn(0), v(0), own(true) {
         resize(n);
     }
 
     // initialize to constant value
-    Vec(const T &a, const int n) : nn(n), v(new T[n]) {
+    Vec(const T &a, const int n) : nn(n), v(new T[n]), own(true) {
         for (int i = 0; i < n; ++ i) {
             v[i] = a;
         }
     }
 
     // initialize to array
-    Vec(const T *a, const int n) : nn(n), v(new T[n]) {
+    Vec(const T *a, const int n) : nn(n), v(new T[n]), own(true) {
         for (int i = 0; i < n; ++ i) {
             v[i] = *a;
             a ++;
@@ -41,7 +42,7 @@ public:
     }
 
     // copy constructor
-    Vec(const Vec<T> &rhs): nn(rhs.nn), v(new T[nn]) {
+    Vec(const Vec<T> &rhs): nn(rhs.nn), v(new T[nn]), own(true) {
         for (int i = 0; i < nn; ++ i) {
             v[i] = rhs[i];
         }
@@ -49,23 +50,38 @@ public:
 
     Vec & resize(const int n) {
         if (nn != n) {
-            if (v != 0) {
+            if (v != 0 && own) {
                 delete [] (v);
             }
             nn = n;
             v = new T[n];
+            own = true;
         }
         return *this;
     }
 
+    // view of the @n elements at @a, which must outlive it (no copy)
+    Vec & borrow(T *a, const int n) {
+        dealloc();
+        nn = n;
+        v = a;
+        own = false;
+        return *this;
+    }
+
+    inline bool borrowed() const {
+        return v != 0 && !own;
+    }
+
     Vec & operator=(const Vec &rhs) {
         if (this != &rhs) {
             if (nn != rhs.nn) {
-                if (v != 0) {
+                if (v != 0 && own) {
                     delete [] (v);
                 }
                 nn = rhs.nn;
                 v = new T[nn];
+                own = true;
             }
 
             for (int i = 0; i < nn; ++ i) v[i] = rhs[i];
@@ -82,11 +98,12 @@ public:
 
     Vec & operator=(const std::vector<T> &a) {
         if (nn != a.size()) {
-            if (v != 0) {
+            if (v != 0 && own) {
                 delete [] (v);
             }
             nn = a.size();
             v = new T[nn];
+            own = true;
         }
 
         for (int i = 0; i < nn; ++ i) v[i] = a[i];
@@ -107,10 +124,13 @@ public:
 
     inline void dealloc() {
         if (v != 0) {
-            delete [] (v);
+            if (own) {
+                delete [] (v);
+            }
             v = 0;
             nn = 0;
         }
+        own = true;
     }
 
     inline T * c_buf() {
@@ -128,15 +148,16 @@ private:
     int mm;
     int tot_sz;
     T ** v;
+    bool own; // false for a view of external memory (see borrow)
 public:
-    Mat() : nn(0), mm(0), tot_sz(0), v(0) {}
+    Mat() : nn(0), mm(0), tot_sz(0), v(0), own(true) {}
 
     ~Mat() {
         dealloc();
     }
 
     explicit Mat(const int n, const int m)
-        : nn(0), mm(0), tot_sz(0), v(0) {
+        : nn(0), mm(0), tot_sz(0), v(0), own(true) {
         resize(n, m);
     }
 
@@ -145,6 +166,7 @@ public:
         // resize(n, m);
         nn = n; mm = m;
         tot_sz = n * m;
+        own = true;
 
         // assert (n != 0 && m != 0);
 
@@ -173,6 +195,7 @@ public:
         nn = n;
         mm = m;
         tot_sz = n * m;
+        own = true;
 
         // assert (n != 0 && m != 0);
 
@@ -202,6 +225,7 @@ public:
         nn = rhs.nn;
         mm = rhs.mm;
         tot_sz = nn * mm;
+        own = true;
 
         // assert (nn != 0 && mm != 0);
 
@@ -229,12 +253,15 @@ public:
         if (nn != n || mm != m) {
             // dealloc();
             if (v != 0) {
-                delete [] (v[0]);
+                if (own) {
+                    delete [] (v[0]);
+                }
                 delete [] (v);
             }
             nn = n;
             mm = m;
             tot_sz = n * m;
+            own = true;
 
             // if (m == 0 || n == 0)
             // {
@@ -266,12 +293,15 @@ public:
             // resize(rhs.nn, rhs.mm);
             if (nn != rhs.nn || mm != rhs.mm) {
                 if (v != 0) {
-                    delete [] (v[0]);
+                    if (own) {
+                        delete [] (v[0]);
+                    }
                     delete [] (v);
                 }
                 nn = rhs.nn;
                 mm = rhs.mm;
                 tot_sz = nn * mm;
+                own = true;
 
                 // assert (nn != 0 && mm != 0);
                 if (tot_sz == 0) {
@@ -318,13 +348,41 @@ public:
     inline void dealloc() {
         if (v != 0) {
             // if (!v[0] || v[0] != 0) delete [] (v[0]);
-            delete[] (v[0]);;
+            if (own) {
+                delete[] (v[0]);
+            }
             delete[] (v);
             v = 0;
             nn = 0;
             mm = 0;
             tot_sz = 0;
         }
+        own = true;
+    }
+
+    /**
+     * view of the @n x @m elements at @a (row-major), which must
+     *  outlive it: no copy, only the row pointers are allocated
+     */
+    Mat & borrow(T * a, const int n, const int m) {
+        dealloc();
+        if (n == 0 || m == 0) {
+            return *this;
+        }
+        nn = n;
+        mm = m;
+        tot_sz = n * m;
+        v = new T*[nn];
+        v[0] = a;
+        for (int i = 1; i < nn; ++ i) {
+            v[i] = v[i - 1] + mm;
+        }
+        own = false;
+        return *this;
+    }
+
+    inline bool borrowed() const {
+        return v != 0 && !own;
     }
 
     T * c_buf() {